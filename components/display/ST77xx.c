@@ -16,7 +16,6 @@
 #include "gds.h"
 #include "gds_private.h"
 
-#define SHADOW_BUFFER
 #define USE_IRAM
 #define PAGE_BLOCK		2048
 #define ENABLE_WRITE	0x2c
@@ -28,7 +27,7 @@ static char TAG[] = "ST77xx";
 enum { ST7735, ST7789 };
 
 struct PrivateSpace {
-	uint8_t *iRAM, *Shadowbuffer;
+	uint8_t *iRAM;
 	struct {
 		uint16_t Height, Width;
 	} Offset;
@@ -54,138 +53,51 @@ static void SetRowAddress( struct GDS_Device* Device, uint16_t Start, uint16_t E
 	Device->WriteData( Device, (uint8_t*) &Addr, 4 );
 }
 
-static void Update16( struct GDS_Device* Device ) {
+// push dirty areas straight from framebuffer, no need for a shadow copy to find what changed
+static void UpdateAreas( struct GDS_Device* Device, int Bytes ) {
 	struct PrivateSpace *Private = (struct PrivateSpace*) Device->Private;
-		
-#ifdef SHADOW_BUFFER
-	uint32_t *optr = (uint32_t*) Private->Shadowbuffer, *iptr = (uint32_t*) Device->Framebuffer;
-	int FirstCol = Device->Width / 2, LastCol = 0, FirstRow = -1, LastRow = 0;  
+	struct GDS_Area Full = { 0, 0, Device->Width - 1, Device->Height - 1 }, *Area = Device->DirtyAreas;
+	int Count = Device->DirtyCount;
 	
-	for (int r = 0; r < Device->Height; r++) {
-		// look for change and update shadow (cheap optimization = width is always a multiple of 2)
-		for (int c = 0; c < Device->Width / 2; c++, iptr++, optr++) {
-			if (*optr != *iptr) {
-				*optr = *iptr;
-				if (c < FirstCol) FirstCol = c;	
-				if (c > LastCol) LastCol = c;
-				if (FirstRow < 0) FirstRow = r;
-				LastRow = r;
-			}
-		}
-
-		// wait for a large enough window - careful that window size might increase by more than a line at once !
-		if (FirstRow < 0 || ((LastCol - FirstCol + 1) * (r - FirstRow + 1) * 4 < PAGE_BLOCK && r != Device->Height - 1)) continue;
+	// direct call to Update (init) means refresh all
+	if (!Count) {
+		Area = &Full;
+		Count = 1;
+	}	
 		
-		FirstCol *= 2;
-		LastCol = LastCol * 2 + 1;
-		SetRowAddress( Device, FirstRow + Private->Offset.Height, LastRow + Private->Offset.Height);
-		SetColumnAddress( Device, FirstCol + Private->Offset.Width, LastCol + Private->Offset.Width );
+	for (; Count--; Area++) {
+		int ChunkSize = (Area->x2 - Area->x1 + 1) * Bytes;
+		uint8_t *iptr = Device->Framebuffer + (Area->y1 * Device->Width + Area->x1) * Bytes;
+		
+		SetRowAddress( Device, Area->y1 + Private->Offset.Height, Area->y2 + Private->Offset.Height );
+		SetColumnAddress( Device, Area->x1 + Private->Offset.Width, Area->x2 + Private->Offset.Width );
 		Device->WriteCommand( Device, ENABLE_WRITE );
-			
-		int ChunkSize = (LastCol - FirstCol + 1) * 2;
-			
+		
 		// own use of IRAM has not proven to be much better than letting SPI do its copy
 		if (Private->iRAM) {
 			uint8_t *optr = Private->iRAM;
-			for (int i = FirstRow; i <= LastRow; i++) {
-				memcpy(optr, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 2, ChunkSize);
+			for (int i = Area->y1; i <= Area->y2; i++, iptr += Device->Width * Bytes) {
+				memcpy(optr, iptr, ChunkSize);
 				optr += ChunkSize;
-				if (optr - Private->iRAM <= (PAGE_BLOCK - ChunkSize) && i < LastRow) continue;
+				if (optr - Private->iRAM <= (PAGE_BLOCK - ChunkSize) && i < Area->y2) continue;
 				Device->WriteData(Device, Private->iRAM, optr - Private->iRAM);
 				optr = Private->iRAM;
 			}
-		} else for (int i = FirstRow; i <= LastRow; i++) {
-			Device->WriteData( Device, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 2, ChunkSize );
-		}	
-
-		FirstCol = Device->Width / 2; LastCol = 0;
-		FirstRow = -1;
-	}	
-#else
-	// always update by full lines
-	SetColumnAddress( Device, Private->Offset.Width, Device->Width - 1);
-	
-	for (int r = 0; r < Device->Height; r += min(Private->PageSize, Device->Height - r)) {
-		int Height = min(Private->PageSize, Device->Height - r);
-		
-		SetRowAddress( Device, Private->Offset.Height + r, Private->Offset.Height + r + Height - 1 );
-		Device->WriteCommand(Device, ENABLE_WRITE);
-		
-		if (Private->iRAM) {
-			memcpy(Private->iRAM, Device->Framebuffer + r * Device->Width * 2, Height * Device->Width * 2 );
-			Device->WriteData( Device, Private->iRAM, Height * Device->Width * 2 );
-		} else	{
-			Device->WriteData( Device, Device->Framebuffer + r * Device->Width * 2, Height * Device->Width * 2 );
+		} else if (ChunkSize == Device->Width * Bytes) {
+			// full lines are contiguous
+			Device->WriteData( Device, iptr, (Area->y2 - Area->y1 + 1) * ChunkSize );
+		} else for (int i = Area->y1; i <= Area->y2; i++, iptr += Device->Width * Bytes) {
+			Device->WriteData( Device, iptr, ChunkSize );
 		}	
 	}	
-#endif	
 }
 
-static void Update24( struct GDS_Device* Device ) {
-	struct PrivateSpace *Private = (struct PrivateSpace*) Device->Private;
-		
-#ifdef SHADOW_BUFFER
-	uint16_t *optr = (uint16_t*) Private->Shadowbuffer, *iptr = (uint16_t*) Device->Framebuffer;
-	int FirstCol = (Device->Width * 3) / 2, LastCol = 0, FirstRow = -1, LastRow = 0;  
-	
-	for (int r = 0; r < Device->Height; r++) {
-		// look for change and update shadow (cheap optimization = width always / by 2)
-		for (int c = 0; c < (Device->Width * 3) / 2; c++, optr++, iptr++) {
-			if (*optr != *iptr) {
-				*optr = *iptr;
-				if (c < FirstCol) FirstCol = c;	
-				if (c > LastCol) LastCol = c;
-				if (FirstRow < 0) FirstRow = r;
-				LastRow = r;
-			}
-		}
-		
-		// do we have enough to send (cols are divided by 3/2)
-		if (FirstRow < 0 || ((((LastCol - FirstCol + 1) * 2 + 3 - 1) / 3) * (r - FirstRow + 1) * 3 < PAGE_BLOCK && r != Device->Height - 1)) continue;
-		
-		FirstCol = (FirstCol * 2) / 3;
-		LastCol = (LastCol * 2 + 1) / 3; 
-		SetRowAddress( Device, FirstRow + Private->Offset.Height, LastRow + Private->Offset.Height);
-		SetColumnAddress( Device, FirstCol + Private->Offset.Width, LastCol + Private->Offset.Width );
-		Device->WriteCommand( Device, ENABLE_WRITE );
-			
-		int ChunkSize = (LastCol - FirstCol + 1) * 3;
-					
-		// own use of IRAM has not proven to be much better than letting SPI do its copy
-		if (Private->iRAM) {
-			uint8_t *optr = Private->iRAM;
-			for (int i = FirstRow; i <= LastRow; i++) {
-				memcpy(optr, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 3, ChunkSize);
-				optr += ChunkSize;
-				if (optr - Private->iRAM <= (PAGE_BLOCK - ChunkSize) && i < LastRow) continue;
-				Device->WriteData(Device, Private->iRAM, optr - Private->iRAM);
-				optr = Private->iRAM;
-			}	
-		} else for (int i = FirstRow; i <= LastRow; i++) {
-			Device->WriteData( Device, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 3, ChunkSize );
-		}	
+static void Update16( struct GDS_Device* Device ) {
+	UpdateAreas( Device, 2 );
+}
 
-		FirstCol = (Device->Width * 3) / 2; LastCol = 0;
-		FirstRow = -1;
-	}	
-#else
-	// always update by full lines
-	SetColumnAddress( Device, Private->Offset.Width, Device->Width - 1);
-	
-	for (int r = 0; r < Device->Height; r += min(Private->PageSize, Device->Height - r)) {
-		int Height = min(Private->PageSize, Device->Height - r);
-		
-		SetRowAddress( Device, Private->Offset.Height + r, Private->Offset.Height + r + Height - 1 );
-		Device->WriteCommand(Device, ENABLE_WRITE);
-		
-		if (Private->iRAM) {
-			memcpy(Private->iRAM, Device->Framebuffer + r * Device->Width * 3, Height * Device->Width * 3 );
-			Device->WriteData( Device, Private->iRAM, Height * Device->Width * 3 );
-		} else	{
-			Device->WriteData( Device, Device->Framebuffer + r * Device->Width * 3, Height * Device->Width * 3 );
-		}	
-	}	
-#endif	
+static void Update24( struct GDS_Device* Device ) {
+	UpdateAreas( Device, 3 );
 }
 
 static void SetLayout( struct GDS_Device* Device, struct GDS_Layout *Layout ) { 
@@ -207,10 +119,8 @@ static void SetLayout( struct GDS_Device* Device, struct GDS_Layout *Layout ) {
 	Device->WriteCommand( Device, 0x36 );
 	WriteByte( Device, Private->MADCtl );
 
-#ifdef SHADOW_BUFFER
-	// force a full refresh (almost ...)
-	memset(Private->Shadowbuffer, 0xAA, Device->FramebufferSize);
-#endif	
+	// force a full refresh
+	GDS_SetDirty( Device );
 }	
 
 static void DisplayOn( struct GDS_Device* Device ) { Device->WriteCommand( Device, 0x29 ); }
@@ -231,10 +141,6 @@ static bool Init( struct GDS_Device* Device ) {
 	
 	Private->PageSize = min(8, PAGE_BLOCK / (Device->Width * Depth));
 
-#ifdef SHADOW_BUFFER	
-	Private->Shadowbuffer = malloc( Device->FramebufferSize );	
-	memset(Private->Shadowbuffer, 0xFF, Device->FramebufferSize);
-#endif
 #ifdef USE_IRAM
 	Private->iRAM = heap_caps_malloc( (Private->PageSize + 1) * Device->Width * Depth, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA );
 #endif
@@ -261,7 +167,7 @@ static bool Init( struct GDS_Device* Device ) {
 	
 	// gone with the wind
 	Device->DisplayOn( Device );
-	Device->Update( Device );
+	GDS_Update( Device );
 
 	return true;
 }	
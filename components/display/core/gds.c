@@ -25,6 +25,9 @@
 #define LEDC_SPEED_MODE LEDC_HIGH_SPEED_MODE
 #endif                
 
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+
 static struct GDS_Device Display;
 static struct GDS_BacklightPWM PWMConfig;
 
@@ -70,7 +73,6 @@ void GDS_ClearExt(struct GDS_Device* Device, bool full, ...) {
 		va_end(args);
 	}
 	
-	Device->Dirty = true;
 	if (commit)	GDS_Update(Device);		
 }	
 
@@ -81,7 +83,7 @@ void GDS_Clear( struct GDS_Device* Device, int Color ) {
 	else if (Device->Depth == 4) memset( Device->Framebuffer, Color | (Color << 4), Device->FramebufferSize );
 	else if (Device->Depth == 8) memset( Device->Framebuffer, Color, Device->FramebufferSize );
 	else GDS_ClearWindow(Device, 0, 0, -1, -1, Color);
-	Device->Dirty = true;
+	GDS_SetDirty( Device );
 }
 
 #define CLEAR_WINDOW(x1,y1,x2,y2,F,W,C,T,N)				\
@@ -157,13 +159,59 @@ void GDS_ClearWindow( struct GDS_Device* Device, int x1, int y1, int x2, int y2,
 	}
 	
 	// make sure diplay will do update
-	Device->Dirty = true;
+	GDS_SetDirtyArea( Device, x1, y1, x2, y2 );
 }
 
 void GDS_Update( struct GDS_Device* Device ) {
 	GDS_CHECK_FOR_DEVICE(Device,return);
+	// someone did set Dirty without an area, so refresh all
+	if (Device->Dirty && !Device->DirtyCount) GDS_SetDirty( Device );
 	if (Device->Dirty) Device->Update( Device );
 	Device->Dirty = false;
+	Device->DirtyCount = 0;
+}
+
+void GDS_SetDirtyArea( struct GDS_Device* Device, int x1, int y1, int x2, int y2 ) {
+	GDS_CHECK_FOR_DEVICE(Device,return);
+	struct GDS_Area *Area = Device->DirtyAreas;
+	int Best = 0, Growth = -1;
+	
+	// -1 means up to width/height, then clip
+	if (x2 < 0) x2 = Device->Width - 1;
+	if (y2 < 0) y2 = Device->Height - 1;
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 >= Device->Width) x2 = Device->Width - 1;
+	if (y2 >= Device->Height) y2 = Device->Height - 1;
+	if (x1 > x2 || y1 > y2) return;
+	
+	Device->Dirty = true;
+
+	for (int i = 0; i < Device->DirtyCount; i++, Area++) {
+		// merge when touching or overlapping (scroller, bars, glyphs of a same string...)
+		if (x1 <= Area->x2 + 1 && x2 + 1 >= Area->x1 && y1 <= Area->y2 + 1 && y2 + 1 >= Area->y1) {
+			Best = i;
+			Growth = 0;
+			break;
+		}	
+		// otherwise remember the one that would grow the least
+		int Union = (max(x2, Area->x2) - min(x1, Area->x1) + 1) * (max(y2, Area->y2) - min(y1, Area->y1) + 1);
+		int Grow = Union - (Area->x2 - Area->x1 + 1) * (Area->y2 - Area->y1 + 1);
+		if (Growth < 0 || Grow < Growth) {
+			Best = i;
+			Growth = Grow;
+		}
+	}
+	
+	// add a new area if there is room, unless it can be merged for free
+	if (Growth && Device->DirtyCount < MAX_DIRTY) {
+		Device->DirtyAreas[Device->DirtyCount++] = (struct GDS_Area) { x1, y1, x2, y2 };
+		return;
+	}
+	
+	Area = Device->DirtyAreas + Best;
+	Area->x1 = min(x1, Area->x1); Area->y1 = min(y1, Area->y1);
+	Area->x2 = max(x2, Area->x2); Area->y2 = max(y2, Area->y2);
 }
 
 bool GDS_Reset( struct GDS_Device* Device ) {
@@ -238,6 +286,7 @@ bool GDS_Init( struct GDS_Device* Device ) {
     
     // set the proper DrawPixel function if not already set by driver
     if (!Device->DrawPixelFast) {
+        Device->DefaultDraw = true;
         if (Device->Depth == 1) Device->DrawPixelFast = DrawPixel1Fast;
         else if (Device->Depth == 4 && Device->HighNibble) Device->DrawPixelFast = DrawPixel4FastHigh;
         else if (Device->Depth == 4) Device->DrawPixelFast = DrawPixel4Fast;
@@ -316,7 +365,12 @@ void GDS_SetContrast( struct GDS_Device* Device, uint8_t Contrast ) {
 }
 
 void GDS_SetLayout( struct GDS_Device* Device, struct GDS_Layout *Layout ) { if (Device && Device->SetLayout) Device->SetLayout( Device, Layout ); }
-void GDS_SetDirty( struct GDS_Device* Device ) { GDS_CHECK_FOR_DEVICE(Device,return);  Device->Dirty = true; }
+void GDS_SetDirty( struct GDS_Device* Device ) { 
+	GDS_CHECK_FOR_DEVICE(Device,return);  
+	Device->DirtyAreas[0] = (struct GDS_Area) { 0, 0, Device->Width - 1, Device->Height - 1 };
+	Device->DirtyCount = 1;
+	Device->Dirty = true; 
+}
 int	 GDS_GetWidth( struct GDS_Device* Device ) { return Device ? Device->Width : 0; }
 void GDS_SetTextWidth( struct GDS_Device* Device, int TextWidth ) { GDS_CHECK_FOR_DEVICE(Device,return);  Device->TextWidth = Device && TextWidth && TextWidth < Device->Width ? TextWidth : Device->Width; }
 int	 GDS_GetHeight( struct GDS_Device* Device ) { return Device ? Device->Height : 0; }
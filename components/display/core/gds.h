@@ -43,6 +43,7 @@ void 	GDS_DisplayOff( struct GDS_Device* Device );
 void 	GDS_Update( struct GDS_Device* Device );
 void 	GDS_SetLayout( struct GDS_Device* Device, struct GDS_Layout* Layout);
 void 	GDS_SetDirty( struct GDS_Device* Device );
+void 	GDS_SetDirtyArea( struct GDS_Device* Device, int x1, int y1, int x2, int y2 );
 int 	GDS_GetWidth( struct GDS_Device* Device );
 void 	GDS_SetTextWidth( struct GDS_Device* Device, int TextWidth );
 int 	GDS_GetHeight( struct GDS_Device* Device );
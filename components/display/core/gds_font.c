@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
 #include "gds_private.h"
 #include "gds.h"
 #include "gds_font.h"
@@ -29,6 +31,110 @@ static const uint8_t* GetCharPtr( const struct GDS_FontDef* Font, char Character
     return &Font->FontData[ ( Character - Font->StartChar ) * ( ( Font->Width * ( RoundUpFontHeight( Font ) / 8 ) ) + 1 ) ];
 }
 
+/* 
+ * Glyphs are expanded once into a mask per column (bit 0 is top row) and kept in a
+ * direct-mapped cache, so drawing does not have to find byte & bit of each pixel. The
+ * cache is shared by all devices & tasks, so masks are copied out under a mutex
+ */
+#define GLYPH_CACHE_SIZE	64
+#define GLYPH_MAX_WIDTH		32
+
+struct GlyphCacheEntry {
+	const struct GDS_FontDef* Font;
+	char Character;
+	uint64_t Columns[ GLYPH_MAX_WIDTH ];
+};
+
+static EXT_RAM_ATTR struct GlyphCacheEntry GlyphCache[ GLYPH_CACHE_SIZE ];
+static pthread_mutex_t GlyphMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool GetGlyphColumns( const struct GDS_FontDef* Font, char Character, uint64_t* Columns ) {
+    struct GlyphCacheEntry* Entry = &GlyphCache[ ( (uintptr_t) Font ^ (uint8_t) Character ) % GLYPH_CACHE_SIZE ];
+
+    if ( Font->Width > GLYPH_MAX_WIDTH || Font->Height > 64 ) return false;
+
+    pthread_mutex_lock( &GlyphMutex );
+
+    if ( Entry->Font != Font || Entry->Character != Character ) {
+        const uint8_t* GlyphData = GetCharPtr( Font, Character ) + 1;
+        int GlyphColumnLen = RoundUpFontHeight( Font ) / 8;
+
+        for ( int c = 0; c < Font->Width; c++, GlyphData+= GlyphColumnLen ) {
+            uint64_t Mask = 0;
+            for ( int b = 0; b < GlyphColumnLen; b++ ) Mask |= (uint64_t) GlyphData[ b ] << ( b * 8 );
+            Entry->Columns[ c ] = Font->Height < 64 ? Mask & ( ( 1ULL << Font->Height ) - 1 ) : Mask;
+        }
+
+        Entry->Font = Font;
+        Entry->Character = Character;
+    }
+
+    memcpy( Columns, Entry->Columns, Font->Width * sizeof( uint64_t ) );
+    pthread_mutex_unlock( &GlyphMutex );
+
+    return true;
+}
+
+/* 
+ * Draw columns of a glyph already clipped, Rows is the number of rows to draw 
+ * starting at y, masks are aligned so that bit 0 is row y
+ */
+static void DrawGlyphColumns( struct GDS_Device* Device, const uint64_t* Columns, int Shift, int x, int y, int Width, int Rows, int Color ) {
+    uint64_t RowMask = Rows < 64 ? ( 1ULL << Rows ) - 1 : ~0ULL;
+
+    if ( Device->DefaultDraw && Device->Depth == 1 ) {
+        // framebuffer is made of vertical bytes, so write up to 8 rows at once
+        int YBit = y & 0x07;
+
+        for ( int c = 0; c < Width; c++ ) {
+            uint64_t Mask = ( Columns[ c ] >> Shift ) & RowMask;
+            uint8_t* FBOffset = Device->Framebuffer + ( y >> 3 ) * Device->Width + x + c;
+            uint8_t Bits = Mask << YBit;
+
+            for ( int b = 8 - YBit; ; b+= 8 ) {
+                if ( Color == GDS_COLOR_XOR ) *FBOffset ^= Bits;
+                else if ( Color == GDS_COLOR_BLACK ) *FBOffset &= ~Bits;
+                else *FBOffset |= Bits;
+
+                if ( b >= Rows ) break;
+                FBOffset+= Device->Width;
+                Bits = Mask >> b;
+            }
+        }
+    } else if ( Device->DefaultDraw && Device->Depth >= 8 && Color != GDS_COLOR_XOR ) {
+        // draw 1st pixel the normal way, then copy its native value (XOR depends on each pixel)
+        int Bytes = Device->Depth / 8;
+        uint8_t* Native = NULL;
+
+        for ( int c = 0; c < Width; c++ ) {
+            uint64_t Mask = ( Columns[ c ] >> Shift ) & RowMask;
+
+            while ( Mask ) {
+                int r = __builtin_ctzll( Mask );
+                uint8_t* FBOffset = Device->Framebuffer + ( ( y + r ) * Device->Width + x + c ) * Bytes;
+
+                if ( Native ) {
+                    memcpy( FBOffset, Native, Bytes );
+                } else {
+                    Device->DrawPixelFast( Device, x + c, y + r, Color );
+                    Native = FBOffset;
+                }
+
+                Mask&= Mask - 1;
+            }
+        }
+    } else {
+        for ( int c = 0; c < Width; c++ ) {
+            uint64_t Mask = ( Columns[ c ] >> Shift ) & RowMask;
+
+            while ( Mask ) {
+                Device->DrawPixelFast( Device, x + c, y + __builtin_ctzll( Mask ), Color );
+                Mask&= Mask - 1;
+            }
+        }
+    }
+}
+
 void GDS_FontDrawChar( struct GDS_Device* Device, char Character, int x, int y, int Color ) {
     const uint8_t* GlyphData = NULL;
     int GlyphColumnLen = 0;
@@ -44,6 +150,8 @@ void GDS_FontDrawChar( struct GDS_Device* Device, char Character, int x, int y,
     int YBit = 0;
     int i = 0;
 
+    uint64_t Columns[ GLYPH_MAX_WIDTH ];
+
     NullCheck( ( GlyphData = GetCharPtr( Device->Font, Character ) ), return );
 
     if ( Character >= Device->Font->StartChar && Character <= Device->Font->EndChar ) {
@@ -81,7 +189,16 @@ void GDS_FontDrawChar( struct GDS_Device* Device, char Character, int x, int y,
         /* Do not attempt to draw past the end of the screen */
         CharEndX = ( CharEndX >= Device->TextWidth ) ? Device->TextWidth - 1 : CharEndX;
         CharEndY = ( CharEndY >= Device->Height ) ? Device->Height - 1 : CharEndY;
-		Device->Dirty = true;
+		GDS_SetDirtyArea( Device, CharStartX, CharStartY, CharEndX - 1, CharEndY - 1 );
+
+        /* Clipping is done, draw all columns at once */
+        if ( GetGlyphColumns( Device->Font, Character, Columns ) ) {
+            if ( CharEndX > CharStartX && CharEndY > CharStartY ) {
+                DrawGlyphColumns( Device, Columns + OffsetX, OffsetY, CharStartX, CharStartY, CharEndX - CharStartX, 
+                                  CharEndY - CharStartY < CharHeight ? CharEndY - CharStartY : CharHeight, Color );
+            }
+            return;
+        }
 
         for ( x = CharStartX; x < CharEndX; x++ ) {
             for ( y = CharStartY, i = 0; y < CharEndY && i < CharHeight; y++, i++ ) {
@@ -6,7 +6,9 @@
  * 
  */
  
+#include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include "math.h"
 #ifdef TJPGD_ROM
 #include "esp32/rom/tjpgd.h"
@@ -14,6 +16,8 @@
 #include "tjpgd.h"
 #endif
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "perf_counters.h"
 
 #include "gds.h"
 #include "gds_private.h"
@@ -23,23 +27,49 @@ const static char TAG[] = "ImageDec";
 
 #define SCRATCH_SIZE	3100
 
+// decoded images cache, in bytes of bitmap (3 bytes per pixel at most)
+#define CACHE_ENTRIES	8
+#define CACHE_SIZE		(256*1024)
+#define CACHE_KEY_SIZE	128
+
 //Data that is passed from the decoder function to the infunc/outfunc functions.
 typedef struct {
     const unsigned char *InData;	// Pointer to jpeg data
     int InPos;						// Current position in jpeg data
+	size_t (*Read)(void*, uint8_t*, size_t);	// or pull it from a stream
+	void *Handle;
+	void (*Lock)(bool);				// serialize with other display users
 	int Width, Height;	
 	uint8_t Mode;
-	union {
-		void *OutData;
-		struct {						// DirectDraw
-			struct GDS_Device *Device;
-			int XOfs, YOfs;
-			int XMin, YMin;
-			int Depth;
-		};	
+	void *OutData;
+	struct {						// DirectDraw
+		struct GDS_Device *Device;
+		int XOfs, YOfs;
+		int XMin, YMin;
+		int Depth;
 	};	
 } JpegCtx;
 
+typedef struct {
+	char Key[CACHE_KEY_SIZE];
+	int x, y, Fit, Mode;
+	int XOfs, YOfs, Width, Height;
+	uint8_t *Bitmap;
+	size_t Size;
+	uint32_t Used;
+} CacheEntry;
+
+static EXT_RAM_ATTR struct {
+	CacheEntry Entries[CACHE_ENTRIES];
+	size_t Size;
+	uint32_t Tick;
+	perf_metric_t *Hit, *Miss;
+} Cache;
+
+static pthread_mutex_t CacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool CacheInsert(struct GDS_Device* Device, const char *Key, int x, int y, int Fit, int XOfs, int YOfs, int Width, int Height, uint8_t *Bitmap);
+
 /****************************************************************************************
  * RGB conversion (24 bits 888: RRRRRRRRGGGGGGGGBBBBBBBB and 16 bits 565: RRRRRGGGGGGBBBBB = B31..B0)
  * so in other words for an array of 888 bytes: [0]=B, [1]=G, [2]=R, ...
@@ -76,6 +106,11 @@ static inline int ScalerGray(uint8_t *Pixels) {
 
 static unsigned InHandler(JDEC *Decoder, uint8_t *Buf, unsigned Len) {
     JpegCtx *Context = (JpegCtx*) Decoder->device;
+	if (Context->Read) {
+		Len = Context->Read(Context->Handle, Buf, Len);
+		Context->InPos += Len;
+		return Len;
+	}	
     if (Buf) memcpy(Buf, Context->InData +  Context->InPos, Len);
     Context->InPos += Len;
     return Len;
@@ -181,6 +216,7 @@ static void* DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, b
 	Context.OutData = NULL;
     Context.InData = Source;
     Context.InPos = 0;
+	Context.Read = NULL;
 	        
     //Prepare and decode the jpeg.
     int Res = jd_prepare(&Decoder, InHandler, Scratch, SCRATCH_SIZE, (void*) &Context);
@@ -314,7 +350,7 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 	// don't do anything if driver supplies a draw function
 	if (Device->DrawRGB) {
 		Device->DrawRGB( Device, Image, x, y, Width, Height, RGB_Mode );
-		Device->Dirty = true;	
+		GDS_SetDirtyArea( Device, x, y, x + Width - 1, y + Height - 1 );
 		return;
 	}
 	
@@ -334,7 +370,7 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 			DRAW_RGB24;
 		}	
 		
-		Device->Dirty = true;
+		GDS_SetDirtyArea( Device, x, y, x + Width - 1, y + Height - 1 );
 		return;
 	}
 	
@@ -366,7 +402,38 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 		}	
 	} 
 	
-	Device->Dirty = true;	
+	GDS_SetDirtyArea( Device, x, y, x + Width - 1, y + Height - 1 );
+}
+
+/****************************************************************************************
+ *  Scaling (2^N) and position of an image of Width x Height drawn at x,y
+ */
+static uint8_t Placement(struct GDS_Device* Device, int x, int y, int Fit, int *Width, int *Height, int *XOfs, int *YOfs) {
+	uint8_t N = 0;
+	
+	// do we need to fit the image
+	if (Fit & GDS_IMAGE_FIT) {
+		float XRatio = (Device->Width - x) / (float) *Width, YRatio = (Device->Height - y) / (float) *Height;
+		uint8_t Ratio = XRatio < YRatio ? ceil(1/XRatio) : ceil(1/YRatio);
+		Ratio--; Ratio |= Ratio >> 1; Ratio |= Ratio >> 2; Ratio++;
+		while (Ratio >>= 1) N++;
+		if (N > 3) {
+			ESP_LOGW(TAG, "Image will not fit %dx%d", *Width, *Height);
+			N = 3;
+		}	
+		*Width /= 1 << N;
+		*Height /= 1 << N;
+	} 
+	
+	// then place it
+	*XOfs = x;
+	*YOfs = y;
+	if (Fit & GDS_IMAGE_CENTER_X) *XOfs = (Device->Width + x - *Width) / 2;
+	else if (Fit & GDS_IMAGE_RIGHT) *XOfs = Device->Width - *Width;
+	if (Fit & GDS_IMAGE_CENTER_Y) *YOfs = (Device->Height + y - *Height) / 2;
+	else if (Fit & GDS_IMAGE_BOTTOM) *YOfs = Device->Height - *Height;
+	
+	return N;
 }
 
 /****************************************************************************************
@@ -386,6 +453,7 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
     // Populate fields of the JpegCtx struct.
     Context.InData = Source;
     Context.InPos = 0;
+	Context.Read = NULL;
 	Context.XOfs = x;
 	Context.YOfs = y;
 	Context.Device = Device;
@@ -397,27 +465,7 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 	Context.Height = Decoder.height;
 	
     if (Res == JDR_OK) {
-		uint8_t N = 0;
-		
-		// do we need to fit the image
-		if (Fit & GDS_IMAGE_FIT) {
-			float XRatio = (Device->Width - x) / (float) Decoder.width, YRatio = (Device->Height - y) / (float) Decoder.height;
-			uint8_t Ratio = XRatio < YRatio ? ceil(1/XRatio) : ceil(1/YRatio);
-			Ratio--; Ratio |= Ratio >> 1; Ratio |= Ratio >> 2; Ratio++;
-			while (Ratio >>= 1) N++;
-			if (N > 3) {
-				ESP_LOGW(TAG, "Image will not fit %dx%d", Decoder.width, Decoder.height);
-				N = 3;
-			}	
-			Context.Width /= 1 << N;
-			Context.Height /= 1 << N;
-		} 
-		
-		// then place it
-		if (Fit & GDS_IMAGE_CENTER_X) Context.XOfs = (Device->Width + x - Context.Width) / 2;
-		else if (Fit & GDS_IMAGE_RIGHT) Context.XOfs = Device->Width - Context.Width;
-		if (Fit & GDS_IMAGE_CENTER_Y) Context.YOfs = (Device->Height + y - Context.Height) / 2;
-		else if (Fit & GDS_IMAGE_BOTTOM) Context.YOfs = Device->Height - Context.Height;
+		uint8_t N = Placement(Device, x, y, Fit, &Context.Width, &Context.Height, &Context.XOfs, &Context.YOfs);
 
 		Context.XMin = x - Context.XOfs;
 		Context.YMin = y - Context.YOfs;
@@ -426,7 +474,7 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 		// do decompress & draw
 		Res = jd_decomp(&Decoder, OutHandlerDirect, N);
 		if (Res == JDR_OK) {
-			Device->Dirty = true;
+			GDS_SetDirtyArea( Device, Context.XOfs, Context.YOfs, Context.XOfs + Context.Width - 1, Context.YOfs + Context.Height - 1 );
 			Ret = true;
 		} else {	
 			ESP_LOGE(TAG, "Image decoder: jd_decode failed (%d)", Res);
@@ -440,3 +488,231 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 	return Ret;
 }
 
+
+/****************************************************************************************
+ *  Find a cached image drawn with the same parameters, with mutex locked
+ */
+static CacheEntry* CacheFind(struct GDS_Device* Device, const char *Key, int x, int y, int Fit) {
+	for (int i = 0; i < CACHE_ENTRIES; i++) {
+		CacheEntry *Entry = Cache.Entries + i;
+		if (Entry->Bitmap && Entry->x == x && Entry->y == y && Entry->Fit == Fit && 
+			Entry->Mode == Device->Mode && !strcmp(Entry->Key, Key)) return Entry;
+	}
+	return NULL;
+}
+
+/****************************************************************************************
+ *  Register hit/miss counters on first use
+ */
+static void CacheMetrics(void) {
+	if (Cache.Hit) return;
+	Cache.Hit = perf_register("artwork.hit", PERF_COUNTER, "images");
+	Cache.Miss = perf_register("artwork.miss", PERF_COUNTER, "images");
+}
+
+/****************************************************************************************
+ *  Check if an image is in cache (it might have been evicted when drawing it)
+ */
+bool GDS_IsJPEGCached(struct GDS_Device* Device, const char *Key, int x, int y, int Fit) {
+	pthread_mutex_lock(&CacheMutex);
+	bool Found = CacheFind(Device, Key, x, y, Fit) != NULL;
+	pthread_mutex_unlock(&CacheMutex);
+	return Found;
+}
+
+/****************************************************************************************
+ *  Make room for Size bytes by evicting least recently used images, with mutex locked
+ */
+static CacheEntry* CacheMakeRoom(size_t Size) {
+	while (1) {
+		CacheEntry *Free = NULL, *Oldest = NULL;
+		
+		for (int i = 0; i < CACHE_ENTRIES; i++) {
+			CacheEntry *Entry = Cache.Entries + i;
+			if (!Entry->Bitmap) Free = Entry;
+			else if (!Oldest || Entry->Used < Oldest->Used) Oldest = Entry;
+		}
+		
+		if (Free && Cache.Size + Size <= CACHE_SIZE) return Free;
+		if (!Oldest) return NULL;
+		
+		ESP_LOGD(TAG, "evicting %s from cache", Oldest->Key);
+		free(Oldest->Bitmap);
+		Oldest->Bitmap = NULL;
+		Cache.Size -= Oldest->Size;
+	}	
+}
+
+/****************************************************************************************
+ *  Same as GDS_DrawJPEG but keeps the decoded and scaled bitmap. Key identifies the image 
+ *  (e.g. its URL) or is NULL to use a hash of Source. When Source is NULL, draw only from 
+ *  cache. Returns false when image could not be drawn
+ */
+bool GDS_DrawJPEGCached(struct GDS_Device* Device, const char *Key, uint8_t *Source, size_t Size, int x, int y, int Fit) {
+	char Hash[20];
+	CacheEntry *Entry;
+	
+	CacheMetrics();
+
+	// use FNV-1a hash and size of data when there is no key
+	if (!Key) {
+		uint32_t h = 2166136261;
+		if (!Source) return false;
+		for (size_t i = 0; i < Size; i++) h = (h ^ Source[i]) * 16777619;
+		snprintf(Hash, sizeof(Hash), "#%08x:%zu", h, Size);
+		Key = Hash;
+	}
+	
+	pthread_mutex_lock(&CacheMutex);
+	
+	if ((Entry = CacheFind(Device, Key, x, y, Fit)) != NULL) {
+		perf_count(Cache.Hit, 1);
+		Entry->Used = ++Cache.Tick;
+		GDS_DrawRGB(Device, Entry->Bitmap, Entry->XOfs, Entry->YOfs, Entry->Width, Entry->Height, Entry->Mode);
+		pthread_mutex_unlock(&CacheMutex);
+		return true;
+	}	
+		
+	pthread_mutex_unlock(&CacheMutex);
+	
+	if (!Source) return false;
+	perf_count(Cache.Miss, 1);
+	
+	int Width, Height, XOfs, YOfs;
+	GDS_GetJPEGSize(Source, &Width, &Height);
+	if (!Width || !Height) return false;
+	uint8_t N = Placement(Device, x, y, Fit, &Width, &Height, &XOfs, &YOfs);
+	
+	// image has to be cropped or key is too long, just draw it
+	if (XOfs < x || YOfs < y || strlen(Key) >= CACHE_KEY_SIZE) return GDS_DrawJPEG(Device, Source, x, y, Fit);
+	
+	uint8_t *Bitmap = GDS_DecodeJPEG(Source, &Width, &Height, 1.0 / (1 << N), Device->Mode);
+	if (!Bitmap) return false;
+	
+	GDS_DrawRGB(Device, Bitmap, XOfs, YOfs, Width, Height, Device->Mode);
+	if (!CacheInsert(Device, Key, x, y, Fit, XOfs, YOfs, Width, Height, Bitmap)) free(Bitmap);
+	
+	return true;
+}
+
+/****************************************************************************************
+ *  Add a bitmap to the cache, returns false if it could not be added
+ */
+static bool CacheInsert(struct GDS_Device* Device, const char *Key, int x, int y, int Fit, int XOfs, int YOfs, int Width, int Height, uint8_t *Bitmap) {
+	CacheEntry *Entry;
+	bool Cached = false;
+	
+	// bytes per pixel are as per GDS_DecodeJPEG
+	size_t Size = Width * Height * (Device->Mode <= GDS_RGB332 ? 1 : (Device->Mode < GDS_RGB666 ? 2 : 3));
+	
+	pthread_mutex_lock(&CacheMutex);
+
+	// another task might have cached it meanwhile
+	if (Size <= CACHE_SIZE && !CacheFind(Device, Key, x, y, Fit) && (Entry = CacheMakeRoom(Size)) != NULL) {
+		strcpy(Entry->Key, Key);
+		Entry->x = x; 
+		Entry->y = y;
+		Entry->Fit = Fit;
+		Entry->Mode = Device->Mode;
+		Entry->XOfs = XOfs;
+		Entry->YOfs = YOfs;
+		Entry->Width = Width;
+		Entry->Height = Height;
+		Entry->Bitmap = Bitmap;
+		Entry->Size = Size;
+		Entry->Used = ++Cache.Tick;
+		Cache.Size += Size;
+		Cached = true;
+	}	
+	
+	pthread_mutex_unlock(&CacheMutex);
+	
+	return Cached;
+}
+
+/****************************************************************************************
+ *  Decode into cache bitmap (if any) and draw directly, showing each band of MCUs
+ */
+static unsigned OutHandlerStream(JDEC *Decoder, void *Bitmap, JRECT *Frame) {
+	JpegCtx *Context = (JpegCtx*) Decoder->device;
+	
+	if (Context->OutData) OutHandler(Decoder, Bitmap, Frame);
+	
+	// we are in the download task, display might be drawn & updated by others
+	if (Context->Lock) Context->Lock(true);
+	OutHandlerDirect(Decoder, Bitmap, Frame);
+	
+	// MCUs come left to right, so the band is complete when we reach the right side
+	if (Frame->right >= Context->Width - 1) {
+		GDS_SetDirtyArea(Context->Device, Context->XOfs + (Context->XMin > 0 ? Context->XMin : 0), Context->YOfs + Frame->top, 
+						 Context->XOfs + Context->Width - 1, Context->YOfs + Frame->bottom);
+		GDS_Update(Context->Device);
+	}	
+	if (Context->Lock) Context->Lock(false);
+	
+	return 1;
+}
+
+/****************************************************************************************
+ *  Same as GDS_DrawJPEGCached but JPEG data is pulled from a stream while it is being 
+ *  decoded and the image is displayed as it comes, so there is no intermediate buffer 
+ *  for the whole JPEG. Key can be NULL when image shall not be cached. Lock (optional)
+ *  is called around drawing and update of each band
+ */
+bool GDS_DrawJPEGStream(struct GDS_Device* Device, const char *Key, size_t (*Read)(void*, uint8_t*, size_t), void *Handle, void (*Lock)(bool), int x, int y, int Fit) {
+    JDEC Decoder;
+    JpegCtx Context;
+	bool Ret = false;
+	char *Scratch = malloc(SCRATCH_SIZE);
+	
+    if (!Scratch) {
+        ESP_LOGE(TAG, "Cannot allocate workspace");
+        return false;
+    }
+	
+	CacheMetrics();
+	if (Key) perf_count(Cache.Miss, 1);
+
+	Context.InData = NULL;
+	Context.InPos = 0;
+	Context.Read = Read;
+	Context.Handle = Handle;
+	Context.Lock = Lock;
+	Context.OutData = NULL;
+	Context.Device = Device;
+	Context.Depth = Device->Depth;
+	Context.Mode = Device->Mode;
+	
+    int Res = jd_prepare(&Decoder, InHandler, Scratch, SCRATCH_SIZE, (void*) &Context);
+	
+	if (Res == JDR_OK) {
+		Context.Width = Decoder.width;
+		Context.Height = Decoder.height;
+		uint8_t N = Placement(Device, x, y, Fit, &Context.Width, &Context.Height, &Context.XOfs, &Context.YOfs);
+		Context.XMin = x - Context.XOfs;
+		Context.YMin = y - Context.YOfs;
+		
+		// also decode in a bitmap for cache, unless image is cropped
+		if (Key && Context.XMin <= 0 && Context.YMin <= 0 && strlen(Key) < CACHE_KEY_SIZE) {
+			int Bpp = Device->Mode <= GDS_RGB332 ? 1 : (Device->Mode < GDS_RGB666 ? 2 : 3);
+			Context.OutData = malloc(Context.Width * Context.Height * Bpp);
+		}	
+		
+		Res = jd_decomp(&Decoder, OutHandlerStream, N);
+		if (Res == JDR_OK) {
+			Ret = true;
+			if (Context.OutData && CacheInsert(Device, Key, x, y, Fit, Context.XOfs, Context.YOfs, Context.Width, Context.Height, Context.OutData)) {
+				Context.OutData = NULL;
+			}	
+		} else {
+			ESP_LOGE(TAG, "Image decoder: jd_decode failed (%d) after %d bytes", Res, Context.InPos);
+		}	
+	} else {
+		ESP_LOGE(TAG, "Image decoder: jd_prepare failed (%d)", Res);
+	}	
+	
+	if (Context.OutData) free(Context.OutData);
+	free(Scratch);
+	
+	return Ret;
+}
@@ -9,6 +9,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "esp_err.h"
 
 // no progressive JPEG handling
@@ -29,4 +31,9 @@ struct GDS_Device;
 void*	 	GDS_DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, int RGB_Mode);	// can be 8, 16 or 24 bits per pixel in return
 void	 	GDS_GetJPEGSize(uint8_t *Source, int *Width, int *Height);
 bool 		GDS_DrawJPEG( struct GDS_Device* Device, uint8_t *Source, int x, int y, int Fit);	
+bool		GDS_IsJPEGCached( struct GDS_Device* Device, const char *Key, int x, int y, int Fit);
+// Key is an URL (or NULL to hash Source). Source can be NULL to only draw from cache 
+bool		GDS_DrawJPEGCached( struct GDS_Device* Device, const char *Key, uint8_t *Source, size_t Size, int x, int y, int Fit);
+// Read pulls (or skips when Buf is NULL) up to Len bytes and returns what has been read
+bool		GDS_DrawJPEGStream( struct GDS_Device* Device, const char *Key, size_t (*Read)(void *Handle, uint8_t *Buf, size_t Len), void *Handle, void (*Lock)(bool Lock), int x, int y, int Fit);
 void 		GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int Width, int Height, int RGB_Mode );
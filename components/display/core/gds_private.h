@@ -50,6 +50,7 @@
 #define GDS_ALWAYS_INLINE __attribute__( ( always_inline ) )
 
 #define MAX_LINES	8
+#define MAX_DIRTY	4
 
 #if ! defined BIT
 #define BIT( n ) ( 1 << ( n ) )
@@ -58,6 +59,10 @@
 struct GDS_Device;
 struct GDS_FontDef;
 
+struct GDS_Area {
+	int16_t x1, y1, x2, y2;
+};
+
 /*
  * These can optionally return a succeed/fail but are as of yet unused in the driver.
  */
@@ -99,11 +104,16 @@ struct GDS_Device {
     uint16_t Height;
 	uint8_t Depth, Mode;
     bool HighNibble;
+	// DrawPixelFast is ours, so framebuffer layout is known
+	bool DefaultDraw;
 	
 	uint8_t	Alloc;	
 	uint8_t* Framebuffer;
     uint32_t FramebufferSize;
 	bool Dirty;
+	// areas drawn since last update (inclusive), none means whole screen
+	struct GDS_Area DirtyAreas[MAX_DIRTY];
+	uint8_t DirtyCount;
 
 	// default fonts when using direct draw	
 	const struct GDS_FontDef* Font;
@@ -106,9 +106,9 @@ bool GDS_TextLine(struct GDS_Device* Device, int N, int Pos, int Attr, char *Tex
 	// erase if requested
 	if (Attr & GDS_TEXT_CLEAR) {
 		int Y_min = max(0, Device->Lines[N].Y), Y_max = max(0, Device->Lines[N].Y + Device->Lines[N].Font->Height);
-		for (int c = (Attr & GDS_TEXT_CLEAR_EOL) ? X : 0; c < Device->TextWidth; c++) 
-			for (int y = Y_min; y < Y_max; y++)
-				Device->DrawPixelFast( Device, c, y, GDS_COLOR_BLACK );
+		int X_min = (Attr & GDS_TEXT_CLEAR_EOL) ? max(0, X) : 0;
+		// ClearWindow does byte-wide erase when possible and sets dirty area
+		if (Y_max > Y_min && X_min < Device->TextWidth) GDS_ClearWindow( Device, X_min, Y_min, Device->TextWidth - 1, Y_max - 1, GDS_COLOR_BLACK );
 	}
 		
 	GDS_FontDrawString( Device, X, Device->Lines[N].Y, Text, GDS_COLOR_WHITE );
@@ -116,7 +116,6 @@ bool GDS_TextLine(struct GDS_Device* Device, int N, int Pos, int Attr, char *Tex
 	ESP_LOGD(TAG, "displaying %s line %u (x:%d, attr:%u)", Text, N+1, X, Attr);
 	
 	// update whole display if requested
-	Device->Dirty = true;
 	if (Attr & GDS_TEXT_UPDATE) GDS_Update( Device );
 		
 	return Width + X < Device->TextWidth;
@@ -200,7 +199,6 @@ void GDS_TextPos(struct GDS_Device* Device, int FontType, int Where, int Attr, c
 	GDS_SetFont( Device, GuessFont( Device, FontType ) );	
 	GDS_FontDrawAnchoredString( Device, Anchor, Text, GDS_COLOR_WHITE );
 	
-	Device->Dirty = true;
 	if (Attr & GDS_TEXT_UPDATE) GDS_Update( Device );
 	
 	va_end(args);
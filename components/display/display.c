@@ -38,7 +38,7 @@ extern const uint8_t default_artwork[]   asm("_binary_note_jpg_start");
 
 static EXT_RAM_ATTR struct {
 	TaskHandle_t task;
-	SemaphoreHandle_t mutex;
+	SemaphoreHandle_t mutex, draw;
 	int pause, speed, by;
 	enum { DISPLAYER_DOWN, DISPLAYER_IDLE, DISPLAYER_ACTIVE } state;
 	char header[HEADER_SIZE + 1];
@@ -160,6 +160,7 @@ void display_init(char *welcome) {
 
 		// start the task that will handle scrolling & counting
 		displayer.mutex = xSemaphoreCreateMutex();
+		displayer.draw = xSemaphoreCreateRecursiveMutex();
 		displayer.by = 2;
 		displayer.pause = 3600;
 		displayer.speed = 33;
@@ -193,6 +194,15 @@ static void display_sleep(void) {
     GDS_DisplayOff(display);
 }
 
+/****************************************************************************************
+ * Serialize drawing and update of the display between displayer_task and artwork, 
+ * which can be drawn from another task (and by bands while it is downloaded)
+ */
+static void draw_lock(bool lock) {
+	if (lock) xSemaphoreTakeRecursive(displayer.draw, portMAX_DELAY);
+	else xSemaphoreGiveRecursive(displayer.draw);
+}
+
 /****************************************************************************************
  * This is not thread-safe as displayer_task might be in the middle of line drawing
  * but it won't crash (I think) and making it thread-safe would be complicated for a
@@ -202,10 +212,14 @@ static void displayer_task(void *args) {
 	int scroll_sleep = 0, timer_sleep;
 		
 	while (1) {
+		draw_lock(true);
+		
 		// suspend ourselves if nothing to do
 		if (displayer.state < DISPLAYER_ACTIVE) {
 			if (displayer.state == DISPLAYER_IDLE) GDS_TextLine(display, 2, 0, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, displayer.string);
+			draw_lock(false);
 			vTaskSuspend(NULL);
+			draw_lock(true);
 			scroll_sleep = 0;
 			GDS_ClearExt(display, true);
 			GDS_TextLine(display, 1, GDS_TEXT_LEFT, GDS_TEXT_UPDATE, displayer.header);
@@ -276,6 +290,8 @@ static void displayer_task(void *args) {
 			} else timer_sleep = max(1000 - elapsed, 0);	
 		} else timer_sleep = DEFAULT_SLEEP;
 		
+		draw_lock(false);
+		
 		// then sleep the min amount of time
 		int sleep = min(scroll_sleep, timer_sleep);
 		ESP_LOGD(TAG, "timers s:%d t:%d", scroll_sleep, timer_sleep);
@@ -292,6 +308,7 @@ void displayer_artwork(uint8_t *data) {
 	
 	int x = displayer.artwork.offset ? displayer.artwork.offset + ARTWORK_BORDER : 0;
 	int y = x ? 0 : 32;
+	draw_lock(true);
 	GDS_ClearWindow(display, x, y, -1, -1, GDS_COLOR_BLACK);
 	if (data) {
 		displayer.artwork.updated = true;
@@ -300,7 +317,48 @@ void displayer_artwork(uint8_t *data) {
 		displayer.artwork.updated = false;
 		displayer.artwork.tick = xTaskGetTickCount();
 	}	
+	draw_lock(false);
+}
+
+/****************************************************************************************
+ * Same as above but decoded artwork is cached. Key is the URL or NULL to use a hash of
+ * data. When data is NULL, only draw from cache and return false if it is not there
+ */
+bool displayer_artwork_cached(const char *key, uint8_t *data, size_t len) {
+	if (!displayer.artwork.active || (!key && !data)) return false;
+	
+	int x = displayer.artwork.offset ? displayer.artwork.offset + ARTWORK_BORDER : 0;
+	int y = x ? 0 : 32;
+	int fit = GDS_IMAGE_CENTER | (displayer.artwork.fit ? GDS_IMAGE_FIT : 0);
+	
+	// don't clear current artwork if we have nothing to replace it
+	if (!data && !GDS_IsJPEGCached(display, key, x, y, fit)) return false;
+	
+	draw_lock(true);
+	GDS_ClearWindow(display, x, y, -1, -1, GDS_COLOR_BLACK);
+	displayer.artwork.updated = GDS_DrawJPEGCached(display, key, data, len, x, y, fit);
+	draw_lock(false);
+	
+	return displayer.artwork.updated;
+}
+
+/****************************************************************************************
+ * Same as above but artwork is decoded and displayed while data is pulled using read
+ */
+bool displayer_artwork_stream(const char *key, size_t (*read)(void *handle, uint8_t *data, size_t len), void *handle) {
+	if (!displayer.artwork.active) return false;
+	
+	int x = displayer.artwork.offset ? displayer.artwork.offset + ARTWORK_BORDER : 0;
+	int y = x ? 0 : 32;
+	
+	draw_lock(true);
+	GDS_ClearWindow(display, x, y, -1, -1, GDS_COLOR_BLACK);
+	draw_lock(false);
+	
+	// only lock while drawing each band, not while waiting for data
+	displayer.artwork.updated = GDS_DrawJPEGStream(display, key, read, handle, draw_lock, x, y, GDS_IMAGE_CENTER | (displayer.artwork.fit ? GDS_IMAGE_FIT : 0));
 	
+	return displayer.artwork.updated;
 }
 
 /****************************************************************************************
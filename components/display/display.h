@@ -39,6 +39,8 @@ void displayer_scroll(char *string, int speed, int pause);
 void displayer_control(enum displayer_cmd_e cmd, ...);
 void displayer_metadata(char *artist, char *album, char *title);
 void displayer_artwork(uint8_t *data);
+bool displayer_artwork_cached(const char *key, uint8_t *data, size_t len);
+bool displayer_artwork_stream(const char *key, size_t (*read)(void *handle, uint8_t *data, size_t len), void *handle);
 void displayer_timer(enum displayer_time_e mode, int elapsed, int duration);
 bool displayer_can_artwork(void);
 char * display_get_supported_drivers(void);
@@ -31,6 +31,7 @@
 #include "messaging.h"				  
 #include "platform_console.h"
 #include "tools.h"
+#include "perf_counters.h"
 
 #ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
 #pragma message("Runtime stats enabled")
@@ -75,6 +76,7 @@ static void register_set_services();
 #if WITH_TASKS_INFO
 static void register_tasks();
 #endif
+static void register_perf();
 extern BaseType_t network_manager_task;
 FILE * system_open_memstream(const char * cmdname,char **buf,size_t *buf_size){
 	FILE *f = open_memstream(buf, buf_size);
@@ -99,6 +101,7 @@ void register_system()
 #if WITH_TASKS_INFO
     register_tasks();
 #endif
+    register_perf();
 #if CONFIG_WITH_CONFIG_UI
     register_deep_sleep();
     register_light_sleep();
@@ -575,6 +578,69 @@ static void register_tasks()
 
 #endif // WITH_TASKS_INFO
 
+/** 'perf' command prints the performance counters registry */
+static struct {
+    struct arg_lit *json;
+    struct arg_lit *reset;
+    struct arg_end *end;
+} perf_args;
+
+static int perf_info(int argc, char **argv)
+{
+    int nerrors = arg_parse_msg(argc, argv,(struct arg_hdr **)&perf_args);
+    if (nerrors != 0) {
+        return 1;
+    }
+    bool reset = perf_args.reset->count > 0;
+
+    if (perf_args.json->count) {
+        cJSON *perf = perf_to_json(reset);
+        char *json_string = cJSON_PrintUnformatted(perf);
+        cmd_send_messaging(argv[0],MESSAGING_INFO,"%s\n", json_string);
+        FREE_AND_NULL(json_string);
+        cJSON_Delete(perf);
+        return 0;
+    }
+
+    char *buf = NULL;
+    size_t buf_size = 0;
+    FILE *f = system_open_memstream(argv[0],&buf, &buf_size);
+    if (f == NULL) {
+        return 1;
+    }
+    fprintf(f,"%-20s %-9s %-6s %10s %10s %10s %10s %10s %10s\n", "name", "type", "unit", "count", "min", "avg", "max", "p90", "total");
+    for (int i = 0; i < perf_get_count(); i++) {
+        perf_snapshot_t s;
+        perf_snapshot(perf_get(i), &s, reset);
+        if (s.type == PERF_COUNTER) {
+            fprintf(f,"%-20s %-9s %-6s %10u %10s %10s %10s %10s %10llu\n", s.name, perf_type_name(s.type), STR_OR_BLANK(s.unit), s.count, "", "", "", "", s.sum);
+        } else {
+            fprintf(f,"%-20s %-9s %-6s %10u %10u %10u %10u %10u %10s\n", s.name, perf_type_name(s.type), STR_OR_BLANK(s.unit), s.count, s.min, s.avg, s.max, s.p90, "");
+        }
+    }
+    fflush(f);
+    cmd_send_messaging(argv[0],MESSAGING_INFO,"%s", buf);
+    fclose(f);
+    FREE_AND_NULL(buf);
+    return 0;
+}
+
+static void register_perf()
+{
+    perf_args.json = arg_lit0("j", "json", "Output as JSON");
+    perf_args.reset = arg_lit0("r", "reset", "Reset counters once read");
+    perf_args.end = arg_end(2);
+
+    const esp_console_cmd_t cmd = {
+        .command = "perf",
+        .help = "Get performance counters (buffer levels, latencies...)",
+        .hint = NULL,
+        .func = &perf_info,
+        .argtable = &perf_args
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+}
+
 
 /** 'deep_sleep' command puts the chip into deep sleep mode */
 #if CONFIG_WITH_CONFIG_UI
@@ -33,8 +33,15 @@ char *level2debug(log_level level);
 
 #define LOG_ERROR(fmt, ...) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_WARN(fmt, ...)  if (*loglevel >= lWARN)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#if LOG_DEFERRED
+#include "log_ring.h"
+#define LOG_INFO(fmt, ...)  if (*loglevel >= lINFO)  log_ring_print(__FUNCTION__, __LINE__, fmt "\n", ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) if (*loglevel >= lDEBUG) log_ring_print(__FUNCTION__, __LINE__, fmt "\n", ##__VA_ARGS__)
+#define LOG_SDEBUG(fmt, ...) if (*loglevel >= lSDEBUG) log_ring_print(__FUNCTION__, __LINE__, fmt "\n", ##__VA_ARGS__)
+#else
 #define LOG_INFO(fmt, ...)  if (*loglevel >= lINFO)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_DEBUG(fmt, ...) if (*loglevel >= lDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_SDEBUG(fmt, ...) if (*loglevel >= lSDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#endif
 
 #endif
\ No newline at end of file
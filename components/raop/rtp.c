@@ -45,6 +45,7 @@
 #include "raop_sink.h"
 #include "log_util.h"
 #include "util.h"
+#include "perf_counters.h"
 
 #ifdef WIN32
 #include <openssl/aes.h>
@@ -78,6 +79,8 @@ static log_level 	*loglevel = &raop_loglevel;
 #define MAX_LATENCY   	( (120 * RAOP_SAMPLE_RATE * 2) / 100 )
 
 #define RTP_STACK_SIZE	(4*1024)
+#define DECODE_STACK_SIZE	(4*1024)
+#define DECODE_BATCH	8
 
 #define RTP_SYNC	(0x01)
 #define NTP_SYNC	(0x02)
@@ -90,11 +93,13 @@ static const u8_t silence_frame[MAX_PACKET] = { 0 };
 uint32_t buffer_frames = ((150 * RAOP_SAMPLE_RATE * 2) / (352 * 100));
 
 typedef u16_t seq_t;
-typedef struct __attribute__((__packed__)) audio_buffer_entry {   // decoded audio packets
+typedef struct __attribute__((__packed__)) audio_buffer_entry {   // received (then decoded in place) audio packets
 	u32_t rtptime, last_resend;
 	s16_t *data;
     u16_t len;    
     u8_t ready;
+    u8_t decoded;
+    u8_t busy;		// owned by decoder, can't be overwritten
     u8_t allocated;
     u8_t missed;
 } abuf_t;
@@ -133,13 +138,17 @@ typedef struct rtp_s {
 	u32_t discarded;
 	abuf_t audio_buffer[BUFFER_FRAMES_MAX];
 	seq_t ab_read, ab_write;
-	pthread_mutex_t ab_mutex;
+	pthread_mutex_t ab_mutex, push_mutex;
+	pthread_cond_t decode_cond;
+	bool pending;
+	u32_t flushes;
 #ifdef WIN32
-	pthread_t thread;
+	pthread_t thread, decoder;
 #else
-	TaskHandle_t thread, joiner;
-	StaticTask_t *xTaskBuffer;
+	TaskHandle_t thread, decoder, joiner;
+	StaticTask_t *xTaskBuffer, *xDecodeTaskBuffer;
     StackType_t xStack[RTP_STACK_SIZE] __attribute__ ((aligned (4)));
+    StackType_t xDecodeStack[DECODE_STACK_SIZE] __attribute__ ((aligned (4)));
 #endif
 
 	struct alac_codec_s *alac_codec;
@@ -150,19 +159,26 @@ typedef struct rtp_s {
 	raop_cmd_cb_t cmd_cb;
 } rtp_t;
 
+static struct {
+	perf_metric_t *resent_req, *resent_rec, *silent;
+} perf;
+
 
 #define BUFIDX(seqno) ((seq_t)(seqno) % buffer_frames)
 static void 	buffer_alloc(abuf_t *audio_buffer, int size, uint8_t *buf, size_t buf_size);
 static void 	buffer_release(abuf_t *audio_buffer);
 static void 	buffer_reset(abuf_t *audio_buffer);
 static void 	buffer_push_packet(rtp_t *ctx);
+static int		buffer_decode(rtp_t *ctx);
 static bool 	rtp_request_resend(rtp_t *ctx, seq_t first, seq_t last);
 static bool 	rtp_request_timing(rtp_t *ctx);
 static int	  	seq_order(seq_t a, seq_t b);
 #ifdef WIN32
 static void 	*rtp_thread_func(void *arg);
+static void 	*rtp_decode_func(void *arg);
 #else
 static void 	rtp_thread_func(void *arg);
+static void 	rtp_decode_func(void *arg);
 #endif	
 
 /*---------------------------------------------------------------------------*/
@@ -220,6 +236,10 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 
 	if (!ctx) return resp;
 	
+	perf.resent_req = perf_register("rtp.resent_req", PERF_COUNTER, "frames");
+	perf.resent_rec = perf_register("rtp.resent_rec", PERF_COUNTER, "frames");
+	perf.silent = perf_register("rtp.silent", PERF_COUNTER, "frames");
+	
 	ctx->host = host;
 	ctx->decrypt = false;
 	ctx->cmd_cb = cmd_cb;
@@ -227,6 +247,8 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 	ctx->rtp_host.sin_family = AF_INET;
 	ctx->rtp_host.sin_addr.s_addr = INADDR_ANY;
 	pthread_mutex_init(&ctx->ab_mutex, 0);
+	pthread_mutex_init(&ctx->push_mutex, 0);
+	pthread_cond_init(&ctx->decode_cond, 0);
 	ctx->first_seqno = -1;
 	ctx->latency = latency;
 	ctx->ab_read = ctx->ab_write;
@@ -248,9 +270,11 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 		mbedtls_aes_setkey_dec(&ctx->aes, (unsigned char*) aeskey, 128);
 #endif
 		ctx->decrypt = true;
-		ctx->decrypt_buf = malloc(MAX_PACKET);
 	}
 
+	// packets are decoded in place, so we always need a bounce buffer
+	ctx->decrypt_buf = malloc(MAX_PACKET);
+
 	memset(fmtp, 0, sizeof(fmtp));
 	while ((arg = strsep(&fmtpstr, " \t")) != NULL) fmtp[i++] = atoi(arg);
 
@@ -278,11 +302,16 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 
 #ifdef WIN32
 	pthread_create(&ctx->thread, NULL, rtp_thread_func, (void *) ctx);
+	pthread_create(&ctx->decoder, NULL, rtp_decode_func, (void *) ctx);
 #else
 	ctx->xTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 	ctx->thread = xTaskCreateStaticPinnedToCore( (TaskFunction_t) rtp_thread_func, "RTP_thread", RTP_STACK_SIZE, ctx,
 									 CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 1, ctx->xStack, ctx->xTaskBuffer,
 									 CONFIG_PTHREAD_TASK_CORE_DEFAULT );
+	ctx->xDecodeTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	ctx->decoder = xTaskCreateStaticPinnedToCore( (TaskFunction_t) rtp_decode_func, "RTP_decode", DECODE_STACK_SIZE, ctx,
+									 CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 1, ctx->xDecodeStack, ctx->xDecodeTaskBuffer,
+									 CONFIG_PTHREAD_TASK_CORE_DEFAULT );
 #endif
 	
 	// cleanup everything if we failed
@@ -307,13 +336,21 @@ void rtp_end(rtp_t *ctx)
 #if !defined WIN32		
 		ctx->joiner = xTaskGetCurrentTaskHandle();
 #endif
+		pthread_mutex_lock(&ctx->ab_mutex);
 		ctx->running = false;
+		pthread_cond_signal(&ctx->decode_cond);
+		pthread_mutex_unlock(&ctx->ab_mutex);
 #ifdef WIN32
 		pthread_join(ctx->thread, NULL);
+		pthread_join(ctx->decoder, NULL);
 #else
+		// one notification from each task
+		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
 		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
 		vTaskDelete(ctx->thread);
+		vTaskDelete(ctx->decoder);
 		SAFE_PTR_FREE(ctx->xTaskBuffer);
+		SAFE_PTR_FREE(ctx->xDecodeTaskBuffer);
 #endif
 	}
 	
@@ -323,6 +360,8 @@ void rtp_end(rtp_t *ctx)
 	if (ctx->decrypt_buf) free(ctx->decrypt_buf);
 	
 	pthread_mutex_destroy(&ctx->ab_mutex);
+	pthread_mutex_destroy(&ctx->push_mutex);
+	pthread_cond_destroy(&ctx->decode_cond);
 	buffer_release(ctx->audio_buffer);
 	
 	free(ctx);
@@ -336,6 +375,8 @@ void rtp_end(rtp_t *ctx)
 /*---------------------------------------------------------------------------*/
 bool rtp_flush(rtp_t *ctx, unsigned short seqno, unsigned int rtptime, bool exit_locked)
 {  
+	// wait for any frame being pushed and block the next ones
+	pthread_mutex_lock(&ctx->push_mutex);
     pthread_mutex_lock(&ctx->ab_mutex);
     
     // always store flush seqno as we only want stricly above it, even when equal to RECORD
@@ -345,18 +386,20 @@ bool rtp_flush(rtp_t *ctx, unsigned short seqno, unsigned int rtptime, bool exit
     // no need to stop playing if recent or equal to record - but first_seqno is needed
     if (ctx->state == RTP_PLAY) {
         buffer_reset(ctx->audio_buffer);
+        ctx->flushes++;
         ctx->state = RTP_WAIT;
         flushed = true;
         LOG_INFO("[%p]: FLUSH packets below %hu - %u", ctx, seqno, rtptime);
 	}
     
-	if (!exit_locked || !flushed) pthread_mutex_unlock(&ctx->ab_mutex);
+	pthread_mutex_unlock(&ctx->ab_mutex);
+	if (!exit_locked || !flushed) pthread_mutex_unlock(&ctx->push_mutex);
 	return flushed;
 }
 
 /*---------------------------------------------------------------------------*/
 void rtp_flush_release(rtp_t *ctx) {
-	pthread_mutex_unlock(&ctx->ab_mutex);
+	pthread_mutex_unlock(&ctx->push_mutex);
 }
 
 
@@ -373,6 +416,7 @@ static void buffer_alloc(abuf_t *audio_buffer, int size, uint8_t *buf, size_t bu
     	audio_buffer[buffer_frames].data = (s16_t*) buf;
 		audio_buffer[buffer_frames].allocated = 0;
         audio_buffer[buffer_frames].ready = 0;
+        audio_buffer[buffer_frames].busy = 0;
         buf += size;
         buf_size -= size;
     }    
@@ -383,6 +427,7 @@ static void buffer_alloc(abuf_t *audio_buffer, int size, uint8_t *buf, size_t bu
 		audio_buffer[buffer_frames].data = malloc(size);        
 		audio_buffer[buffer_frames].allocated = 1;
 		audio_buffer[buffer_frames].ready = 0;
+		audio_buffer[buffer_frames].busy = 0;
 	}
 }
 
@@ -397,7 +442,7 @@ static void buffer_release(abuf_t *audio_buffer) {
 /*---------------------------------------------------------------------------*/
 static void buffer_reset(abuf_t *audio_buffer) {
 	int i;
-	for (i = 0; i < buffer_frames; i++) audio_buffer[i].ready = 0;
+	for (i = 0; i < buffer_frames; i++) audio_buffer[i].ready = audio_buffer[i].decoded = 0;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -409,9 +454,11 @@ static int seq_order(seq_t a, seq_t b) {
 }
 
 /*---------------------------------------------------------------------------*/
+// buf and dest can be the same as the packet always goes through decrypt_buf
 static void alac_decode(rtp_t *ctx, s16_t *dest, char *buf, int len, u16_t *outsize) {
 	unsigned char iv[16];
 	int aeslen;
+	unsigned int frames;
 	assert(len<=MAX_PACKET);
 
 	if (ctx->decrypt) {
@@ -423,12 +470,12 @@ static void alac_decode(rtp_t *ctx, s16_t *dest, char *buf, int len, u16_t *outs
 		mbedtls_aes_crypt_cbc(&ctx->aes, MBEDTLS_AES_DECRYPT, aeslen, iv, (unsigned char*) buf, ctx->decrypt_buf);
 #endif
 		memcpy(ctx->decrypt_buf+aeslen, buf+aeslen, len-aeslen);
-		alac_to_pcm(ctx->alac_codec, (unsigned char*) ctx->decrypt_buf, (unsigned char*) dest, 2, (unsigned int*) outsize);
 	} else {
-		alac_to_pcm(ctx->alac_codec, (unsigned char*) buf, (unsigned char*) dest, 2, (unsigned int*) outsize);
+		memcpy(ctx->decrypt_buf, buf, len);
 	}	
 	
-	*outsize *= 4;
+	alac_to_pcm(ctx->alac_codec, (unsigned char*) ctx->decrypt_buf, (unsigned char*) dest, 2, &frames);
+	*outsize = frames * 4;
 }
 
 
@@ -510,6 +557,7 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 	} else if (seq_order(ctx->ab_read, seqno + 1)) {
 		// recovered packet, not yet sent
 		ctx->resent_rec++;
+		perf_count(perf.resent_rec, 1);
 		LOG_DEBUG("[%p]: packet recovered seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
 	} else {
         // too late
@@ -522,17 +570,26 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 		ctx->in_frames = 0;
 	}
 
+	// decoder owns that slot (being decoded or played), better lose that one
+	if (abuf && (abuf->busy || len > ctx->frame_size * 4)) {
+		LOG_DEBUG("[%p]: can't store packet seqno:%hu len:%d busy:%u", ctx, seqno, len, abuf->busy);
+		abuf = NULL;
+	}
+
 	if (abuf) {
-		alac_decode(ctx, abuf->data, data, len, &abuf->len);
+		// only store, decryption and decoding are done by decoder outside the lock
+		memcpy(abuf->data, data, len);
+		abuf->len = len;
 		abuf->ready = 1;
+		abuf->decoded = 0;
         abuf->missed = 0;
 		// this is the local rtptime when this frame is expected to play
 		abuf->rtptime = rtptime;
-		buffer_push_packet(ctx);
+		ctx->pending = true;
+		pthread_cond_signal(&ctx->decode_cond);
 
 #ifdef __RTP_STORE
 		fwrite(data, len, 1, ctx->rtpIN);
-		fwrite(abuf->data, abuf->len, 1, ctx->rtpOUT);
 #endif
 	}
 
@@ -540,7 +597,67 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 }
 
 /*---------------------------------------------------------------------------*/
-// push as many frames as possible through callback
+// decode a batch of received frames, called and returns with ab_mutex locked
+static int buffer_decode(rtp_t *ctx) {
+	abuf_t *batch[DECODE_BATCH];
+	u32_t flushes = ctx->flushes;
+	int n = 0;
+
+	for (seq_t i = ctx->ab_read; n < DECODE_BATCH && seq_order(i, ctx->ab_write + 1); i++) {
+		abuf_t *abuf = ctx->audio_buffer + BUFIDX(i);
+		if (!abuf->ready || abuf->decoded) continue;
+		abuf->busy = 1;
+		batch[n++] = abuf;
+	}
+
+	if (!n) return 0;
+
+	// receiver can store other frames meanwhile
+	pthread_mutex_unlock(&ctx->ab_mutex);
+
+	for (int i = 0; i < n; i++) {
+		alac_decode(ctx, batch[i]->data, (char*) batch[i]->data, batch[i]->len, &batch[i]->len);
+#ifdef __RTP_STORE
+		fwrite(batch[i]->data, batch[i]->len, 1, ctx->rtpOUT);
+#endif
+	}
+
+	pthread_mutex_lock(&ctx->ab_mutex);
+
+	// a flush or a re-sync might have happened
+	for (int i = 0; i < n; i++) {
+		batch[i]->busy = 0;
+		batch[i]->decoded = batch[i]->ready && flushes == ctx->flushes;
+	}
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+// send one frame to player, called and returns with ab_mutex locked
+static bool buffer_play_frame(rtp_t *ctx, abuf_t *frame, const u8_t *data, u16_t len, u32_t playtime) {
+	u32_t flushes = ctx->flushes;
+	bool played = false;
+
+	// data callback might block, so let receiver store frames meanwhile
+	if (frame) frame->busy = 1;
+	pthread_mutex_unlock(&ctx->ab_mutex);
+
+	pthread_mutex_lock(&ctx->push_mutex);
+	if (flushes == ctx->flushes) {
+		ctx->data_cb(data, len, playtime);
+		played = true;
+	}
+	pthread_mutex_unlock(&ctx->push_mutex);
+
+	pthread_mutex_lock(&ctx->ab_mutex);
+	if (frame) frame->busy = frame->ready = frame->decoded = 0;
+
+	return played && flushes == ctx->flushes;
+}
+
+/*---------------------------------------------------------------------------*/
+// push as many frames as possible through callback, called with ab_mutex locked
 static void buffer_push_packet(rtp_t *ctx) {
 	abuf_t *curframe = NULL;
 	u32_t now, playtime, hold = max((ctx->latency * 1000) / (8 * RAOP_SAMPLE_RATE), 100);
@@ -550,6 +667,10 @@ static void buffer_push_packet(rtp_t *ctx) {
 
 	// there is always at least one frame in the buffer
 	do {
+		abuf_t *frame = NULL;
+		const u8_t *data = NULL;
+		u16_t len = 0;
+
 		// re-evaluate time in loop in case data callback blocks ...
 		now = gettime_ms();
 
@@ -560,20 +681,20 @@ static void buffer_push_packet(rtp_t *ctx) {
 		if (now > playtime) {
 			LOG_DEBUG("[%p]: discarded frame now:%u missed by:%d (W:%hu R:%hu)", ctx, now, now - playtime, ctx->ab_write, ctx->ab_read);
 			ctx->discarded++;
-			curframe->ready = 0;
-		} else if (playtime - now <= hold) {
-			if (curframe->ready) {
-				ctx->data_cb((const u8_t*) curframe->data, curframe->len, playtime);
-				curframe->ready = 0;
-			} else {
-				LOG_DEBUG("[%p]: created zero frame (W:%hu R:%hu)", ctx, ctx->ab_write, ctx->ab_read);
-				ctx->data_cb(silence_frame, ctx->frame_size * 4, playtime);
-				ctx->silent_frames++;
-                curframe->missed = 1;
-			}
+			curframe->ready = curframe->decoded = 0;
 		} else if (curframe->ready) {
-			ctx->data_cb((const u8_t*) curframe->data, curframe->len, playtime);
-			curframe->ready = 0;
+			// just received, decoder will run again before we push it
+			if (!curframe->decoded) break;
+			frame = curframe;
+			data = (const u8_t*) curframe->data;
+			len = curframe->len;
+		} else if (playtime - now <= hold) {
+			LOG_DEBUG("[%p]: created zero frame (W:%hu R:%hu)", ctx, ctx->ab_write, ctx->ab_read);
+			data = silence_frame;
+			len = ctx->frame_size * 4;
+			ctx->silent_frames++;
+			perf_count(perf.silent, 1);
+			curframe->missed = 1;
 		} else {
 			break;
 		}
@@ -581,6 +702,9 @@ static void buffer_push_packet(rtp_t *ctx) {
 		ctx->ab_read++;
 		ctx->out_frames++;
 
+		// buffer has been flushed while we were sending
+		if (data && !buffer_play_frame(ctx, frame, data, len, playtime)) return;
+
 	} while (seq_order(ctx->ab_read, ctx->ab_write));
 
 	if (ctx->out_frames > 1000) {
@@ -612,6 +736,37 @@ static void buffer_push_packet(rtp_t *ctx) {
 }
 
 
+/*---------------------------------------------------------------------------*/
+#ifdef WIN32
+static void *rtp_decode_func(void *arg) {
+#else	
+static void rtp_decode_func(void *arg) {
+#endif	
+	rtp_t *ctx = (rtp_t*) arg;
+
+	pthread_mutex_lock(&ctx->ab_mutex);
+
+	while (ctx->running) {
+		// wait for receiver to store new frames
+		while (!ctx->pending && ctx->running) pthread_cond_wait(&ctx->decode_cond, &ctx->ab_mutex);
+		ctx->pending = false;
+
+		// decode everything received by batches then push what can be played
+		while (buffer_decode(ctx) == DECODE_BATCH);
+		buffer_push_packet(ctx);
+	}
+
+	pthread_mutex_unlock(&ctx->ab_mutex);
+	LOG_INFO("[%p]: decoder terminating", ctx);
+
+#ifndef WIN32
+	xTaskNotifyGive(ctx->joiner);
+	vTaskSuspend(NULL);
+#else	
+	return NULL;
+#endif
+}
+
 /*---------------------------------------------------------------------------*/
 #ifdef WIN32
 static void *rtp_thread_func(void *arg) {
@@ -843,6 +998,7 @@ static bool rtp_request_resend(rtp_t *ctx, seq_t first, seq_t last) {
 	if (seq_order(last, first) || last - first > buffer_frames / 2) return false;
 	
 	ctx->resent_req += (seq_t) (last - first) + 1;
+	perf_count(perf.resent_req, (seq_t) (last - first) + 1);
 
 	LOG_DEBUG("resend request [W:%hu R:%hu first=%hu last=%hu]", ctx->ab_write, ctx->ab_read, first, last);
 
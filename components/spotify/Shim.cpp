@@ -32,6 +32,7 @@
 #include "platform_config.h"
 #include "nvs_utilities.h"
 #include "tools.h"
+#include "perf_counters.h"
 
 static class cspotPlayer *player;
 
@@ -55,11 +56,12 @@ private:
     bool zeroConf;
     std::atomic<bool> flushed = false, notify = true;
         
-    int startOffset, volume = 0, bitrate = 160;
+    int startOffset, volume = 0, bitrate = 160, window = 0, preload = -1;
     httpd_handle_t serverHandle;
     int serverPort;
     cspot_cmd_cb_t cmdHandler;
     cspot_data_cb_t dataHandler;
+    perf_metric_t *perfWritten, *perfFull;
     std::string lastTrackId;
     cspot::TrackInfo trackInfo;
 
@@ -88,9 +90,14 @@ cspotPlayer::cspotPlayer(const char* name, httpd_handle_t server, int port, cspo
                         serverHandle(server), serverPort(port),
                         cmdHandler(cmdHandler), dataHandler(dataHandler) {
 
+    perfWritten = perf_register("cspot.written", PERF_COUNTER, "bytes");
+    perfFull = perf_register("cspot.full", PERF_COUNTER, "writes");
+
     cJSON *item, *config = config_alloc_get_cjson("cspot_config");
     if ((item = cJSON_GetObjectItem(config, "volume")) != NULL) volume = item->valueint;
     if ((item = cJSON_GetObjectItem(config, "bitrate")) != NULL) bitrate = item->valueint;   
+    if ((item = cJSON_GetObjectItem(config, "window")) != NULL) window = item->valueint;
+    if ((item = cJSON_GetObjectItem(config, "preload")) != NULL) preload = item->valueint;
     if ((item = cJSON_GetObjectItem(config, "deviceName") ) != NULL) this->name = item->valuestring;
     else this->name = name; 
     
@@ -122,7 +129,13 @@ size_t cspotPlayer::pcmWrite(uint8_t *pcm, size_t bytes, std::string_view trackI
         trackHandler();
     }
 
-    return dataHandler(pcm, bytes);
+    size_t written = dataHandler(pcm, bytes);
+
+    // sink is full, player will retry later
+    if (written) perf_count(perfWritten, written);
+    else perf_count(perfFull, 1);
+
+    return written;
 }    
 
 extern "C" {
@@ -362,6 +375,12 @@ void cspotPlayer::runTask() {
         if (bitrate == 320) ctx->config.audioFormat = AudioFormat_OGG_VORBIS_320;
         else if (bitrate == 96) ctx->config.audioFormat = AudioFormat_OGG_VORBIS_96;
         else ctx->config.audioFormat = AudioFormat_OGG_VORBIS_160;
+        
+        // CDN read-ahead window is in kBytes
+        if (window > 0) ctx->config.audioWindowSize = window * 1024;
+        
+        // next track is opened that many seconds before the end of current one
+        if (preload >= 0) ctx->config.preloadMs = preload * 1000;
 
         ctx->session->connectWithRandomAp();
         ctx->config.authData = ctx->session->authenticate(blob);
@@ -3,24 +3,132 @@
 #include <string.h>   // for memcpy
 #include <algorithm>  // for transform
 #include <cassert>    // for assert
+#include <atomic>     // for atomic
 #include <cctype>     // for tolower
+#include <chrono>     // for steady_clock
+#include <mutex>      // for scoped_lock
 #include <ostream>    // for operator<<, basic_ostream
 #include <stdexcept>  // for runtime_error
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>  // for select
+#endif
 
+#include "BellLogger.h"  // for BELL_LOG
 #include "BellSocket.h"  // for bell
+#include "TLSSocket.h"   // for TLSSocket
 
 using namespace bell;
 
+// Idle keep-alive connections, most recent last
+namespace {
+const size_t POOL_MAX_PER_HOST = 2;
+const size_t POOL_MAX_SIZE = 4;
+const auto POOL_IDLE_TIMEOUT = std::chrono::seconds(30);
+
+struct PooledConnection {
+  std::string key;
+  std::unique_ptr<bell::Socket> socket;
+  std::chrono::steady_clock::time_point since;
+};
+
+std::mutex poolMutex;
+std::vector<PooledConnection> pool;
+std::atomic<uint32_t> openedCount = 0, reusedCount = 0;
+
+// An idle connection must have nothing to read, otherwise it has been closed
+bool isIdle(bell::Socket* socket) {
+  int fd = socket->getFd();
+  fd_set fds;
+  struct timeval timeout = {0, 0};
+
+  FD_ZERO(&fds);
+  FD_SET(fd, &fds);
+
+  return socket->isOpen() && socket->poll() == 0 &&
+         select(fd + 1, &fds, NULL, NULL, &timeout) == 0;
+}
+}  // namespace
+
+HTTPClient::Stats HTTPClient::stats() {
+  return Stats{openedCount, reusedCount, TLSSocket::resumed()};
+}
+
 void HTTPClient::Response::connect(const std::string& url) {
   urlParser = bell::URLParser::parse(url);
+  poolKey = urlParser.schema + "://" + urlParser.host + ":" +
+            std::to_string(urlParser.port);
+  open(true);
+}
+
+void HTTPClient::Response::open(bool usePool) {
+  std::unique_ptr<bell::Socket> socket;
+
+  if (usePool) {
+    std::scoped_lock lock(poolMutex);
+    auto now = std::chrono::steady_clock::now();
+
+    // Take the most recent usable connection, drop stale ones on the way
+    for (auto it = pool.end(); it != pool.begin();) {
+      --it;
+      if (now - it->since > POOL_IDLE_TIMEOUT || !isIdle(it->socket.get())) {
+        it = pool.erase(it);
+      } else if (!socket && it->key == poolKey) {
+        socket = std::move(it->socket);
+        it = pool.erase(it);
+      }
+    }
+  }
 
-  // Open socket of type
-  this->socketStream.open(urlParser.host, urlParser.port,
-                          urlParser.schema == "https");
+  if (socket) {
+    // it has served at least one request already, and was left clean
+    this->socketStream.attach(std::move(socket));
+    this->requestCount = 1;
+    this->keepAlive = this->hasContentSize = true;
+    this->bodyEnd = this->socketStream.rdbuf()->consumed();
+  } else {
+    // Open socket of type
+    this->socketStream.open(urlParser.host, urlParser.port,
+                            urlParser.schema == "https");
+    this->socketStream.clear();
+    this->requestCount = 0;
+    openedCount++;
+  }
+}
+
+bool HTTPClient::Response::isReusable() {
+  // Body must have been read entirely and nothing else
+  return keepAlive && hasContentSize && socketStream.isOpen() &&
+         socketStream.good() && socketStream.rdbuf()->consumed() == bodyEnd &&
+         socketStream.rdbuf()->in_avail() == 0;
 }
 
 HTTPClient::Response::~Response() {
-  if (this->socketStream.isOpen()) {
+  if (!this->socketStream.isOpen()) {
+    return;
+  }
+
+  if (requestCount > 0 && !poolKey.empty() && isReusable()) {
+    std::scoped_lock lock(poolMutex);
+    size_t count = 0;
+
+    // Replace the oldest connection to the same host, or the oldest overall
+    for (auto& connection : pool) {
+      if (connection.key == poolKey) count++;
+    }
+
+    if (count >= POOL_MAX_PER_HOST || pool.size() >= POOL_MAX_SIZE) {
+      auto oldest = pool.begin();
+      if (count >= POOL_MAX_PER_HOST) {
+        while (oldest->key != poolKey) oldest++;
+      }
+      pool.erase(oldest);
+    }
+
+    pool.push_back(PooledConnection{poolKey, this->socketStream.release(),
+                                    std::chrono::steady_clock::now()});
+  } else {
     this->socketStream.close();
   }
 }
@@ -31,6 +139,36 @@ void HTTPClient::Response::rawRequest(const std::string& url,
                                       Headers& headers) {
   urlParser = bell::URLParser::parse(url);
 
+  // Previous response not fully read, connection can't be used anymore
+  if (requestCount > 0 && !isReusable()) {
+    open(false);
+  }
+
+  if (requestCount == 0) {
+    writeRequest(method, content, headers);
+    readResponseHeaders();
+  } else {
+    reusedCount++;
+
+    // Server may have closed an idle connection, retry once on a new one
+    try {
+      writeRequest(method, content, headers);
+      readResponseHeaders();
+    } catch (const std::runtime_error& e) {
+      BELL_LOG(info, "http", "Kept-alive connection failed (%s), reopening",
+               e.what());
+      open(false);
+      writeRequest(method, content, headers);
+      readResponseHeaders();
+    }
+  }
+
+  requestCount++;
+}
+
+void HTTPClient::Response::writeRequest(const std::string& method,
+                                        const std::vector<uint8_t>& content,
+                                        Headers& headers) {
   // Prepare a request
   const char* reqEnd = "\r\n";
 
@@ -57,9 +195,6 @@ void HTTPClient::Response::rawRequest(const std::string& url,
   }
 
   socketStream.flush();
-
-  // Parse response
-  readResponseHeaders();
 }
 
 void HTTPClient::Response::readResponseHeaders() {
@@ -72,10 +207,19 @@ void HTTPClient::Response::readResponseHeaders() {
   size_t prevbuflen = 0, numHeaders;
   this->httpBufferAvailable = 0;
 
+  // Forget about previous response on that connection
+  this->contentSize = 0;
+  this->hasContentSize = false;
+  this->keepAlive = false;
+  this->rawBody.clear();
+
   while (1) {
     socketStream.getline((char*)httpBuffer.data() + httpBufferAvailable,
                          httpBuffer.size() - httpBufferAvailable);
 
+    if (socketStream.gcount() == 0)
+      throw std::runtime_error("Connection closed");
+
     prevbuflen = httpBufferAvailable;
     httpBufferAvailable += socketStream.gcount();
 
@@ -117,6 +261,14 @@ void HTTPClient::Response::readResponseHeaders() {
     this->hasContentSize = true;
     this->contentSize = std::stoi(contentLengthValue);
   }
+
+  // HTTP/1.1 connections are persistent unless told otherwise
+  std::string connectionValue = std::string(header("connection"));
+  std::transform(connectionValue.begin(), connectionValue.end(),
+                 connectionValue.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  this->keepAlive = minorVersion >= 1 && connectionValue != "close";
+  this->bodyEnd = socketStream.rdbuf()->consumed() + contentSize;
 }
 
 void HTTPClient::Response::get(const std::string& url, Headers headers) {
@@ -18,6 +18,7 @@ int SocketBuffer::open(const std::string& hostname, int port, bool isSSL) {
     internalSocket = std::make_unique<bell::TCPSocket>();
   }
 
+  setg(NULL, NULL, NULL);
   internalSocket->open(hostname, port);
   return 0;
 }
@@ -31,6 +32,18 @@ int SocketBuffer::close() {
   return 0;
 }
 
+std::unique_ptr<bell::Socket> SocketBuffer::release() {
+  pubsync();
+  setg(NULL, NULL, NULL);
+  return std::move(internalSocket);
+}
+
+void SocketBuffer::attach(std::unique_ptr<bell::Socket> socket) {
+  close();
+  setg(NULL, NULL, NULL);
+  internalSocket = std::move(socket);
+}
+
 int SocketBuffer::sync() {
   ssize_t bw, n = pptr() - pbase();
   while (n > 0) {
@@ -52,6 +65,7 @@ SocketBuffer::int_type SocketBuffer::underflow() {
     setg(NULL, NULL, NULL);
     return traits_type::eof();
   }
+  received += br;
   setg(ibuf, ibuf, ibuf + br);
   return traits_type::to_int_type(*ibuf);
 }
@@ -82,6 +96,7 @@ std::streamsize SocketBuffer::xsgetn(char_type* __s, std::streamsize __n) {
     br = internalSocket->read(reinterpret_cast<uint8_t*>(end - remain), remain);
     if (br <= 0)
       return (__n - remain);
+    received += br;
     remain -= br;
   }
   return __n;
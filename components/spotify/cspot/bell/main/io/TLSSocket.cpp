@@ -4,7 +4,10 @@
 #include <mbedtls/entropy.h>      // for mbedtls_entropy_free, mbedtls_entro...
 #include <mbedtls/net_sockets.h>  // for mbedtls_net_connect, mbedtls_net_free
 #include <mbedtls/ssl.h>          // for mbedtls_ssl_conf_authmode, mbedtls_...
-#include <cstring>                // for strlen, NULL
+#include <cstring>                // for strlen, memcmp, NULL
+#include <map>                    // for map
+#include <memory>                 // for shared_ptr
+#include <mutex>                  // for scoped_lock
 #include <stdexcept>              // for runtime_error
 
 #include "BellLogger.h"  // for AbstractLogger, BELL_LOG
@@ -13,6 +16,16 @@
 /**
  * Platform TLSSocket implementation for the mbedtls
  */
+
+std::atomic<uint32_t> bell::TLSSocket::resumeCount = 0;
+
+// Last session per server, offered on next connection to skip a full handshake
+namespace {
+const size_t MAX_CACHED_SESSIONS = 4;
+std::mutex sessionMutex;
+std::map<std::string, std::shared_ptr<mbedtls_ssl_session>> sessionCache;
+}  // namespace
+
 bell::TLSSocket::TLSSocket() {
   this->isClosed = false;
   mbedtls_net_init(&server_fd);
@@ -69,12 +82,49 @@ void bell::TLSSocket::open(const std::string& hostUrl, uint16_t port) {
   mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv,
                       NULL);
 
+  std::string sessionKey = hostUrl + ":" + std::to_string(port);
+  std::shared_ptr<mbedtls_ssl_session> offered;
+  {
+    std::scoped_lock lock(sessionMutex);
+    auto cached = sessionCache.find(sessionKey);
+    if (cached != sessionCache.end() &&
+        mbedtls_ssl_set_session(&ssl, cached->second.get()) == 0) {
+      offered = cached->second;
+    }
+  }
+
   while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
     if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
       BELL_LOG(error, "http_tls", "failed! config returned %d\n", ret);
+
+      // don't offer that session again
+      std::scoped_lock lock(sessionMutex);
+      sessionCache.erase(sessionKey);
       throw std::runtime_error("mbedtls_ssl_handshake error");
     }
   }
+
+  auto session = std::shared_ptr<mbedtls_ssl_session>(
+      new mbedtls_ssl_session, [](mbedtls_ssl_session* session) {
+        mbedtls_ssl_session_free(session);
+        delete session;
+      });
+  mbedtls_ssl_session_init(session.get());
+
+  if (mbedtls_ssl_get_session(&ssl, session.get()) == 0) {
+    // server accepted the session only if it kept its master secret
+    if (offered && !memcmp(offered->master, session->master,
+                           sizeof(session->master))) {
+      resumeCount++;
+    }
+
+    std::scoped_lock lock(sessionMutex);
+    if (sessionCache.size() >= MAX_CACHED_SESSIONS &&
+        sessionCache.find(sessionKey) == sessionCache.end()) {
+      sessionCache.erase(sessionCache.begin());
+    }
+    sessionCache[sessionKey] = session;
+  }
 }
 
 size_t bell::TLSSocket::read(uint8_t* buf, size_t len) {
@@ -44,6 +44,10 @@ class HTTPClient {
     }
   };
 
+  /**
+  * Connections are kept alive and returned to a pool on destruction
+  * when their response body has been fully read.
+  */
   class Response {
    public:
     Response(){};
@@ -83,12 +87,31 @@ class HTTPClient {
     size_t contentSize = 0;
     bool hasContentSize = false;
 
+    // Keep-alive state of the connection
+    std::string poolKey;
+    bool keepAlive = false;
+    size_t requestCount = 0;
+    size_t bodyEnd = 0;
+
     Headers responseHeaders;
 
+    void open(bool usePool);
+    bool isReusable();
+    void writeRequest(const std::string& method,
+                      const std::vector<uint8_t>& content, Headers& headers);
     void readResponseHeaders();
     void readRawBody();
   };
 
+  // Connection reuse statistics, shared by all clients
+  struct Stats {
+    uint32_t opened;   // new connections
+    uint32_t reused;   // requests sent on an already used connection
+    uint32_t resumed;  // TLS handshakes that resumed a cached session
+  };
+
+  static Stats stats();
+
   enum class Method : uint8_t { GET = 0, POST = 1 };
 
   struct Request {
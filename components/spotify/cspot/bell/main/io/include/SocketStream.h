@@ -14,6 +14,9 @@ class SocketBuffer : public std::streambuf {
   static const int bufLen = 1024;
   char ibuf[bufLen], obuf[bufLen];
 
+  // Bytes read from the socket so far
+  size_t received = 0;
+
  public:
   SocketBuffer() { internalSocket = nullptr; }
 
@@ -29,6 +32,13 @@ class SocketBuffer : public std::streambuf {
     return internalSocket != nullptr && internalSocket->isOpen();
   }
 
+  // Hands the socket over (e.g. to a connection pool) or takes one back
+  std::unique_ptr<bell::Socket> release();
+  void attach(std::unique_ptr<bell::Socket> socket);
+
+  // Bytes extracted by the reader so far
+  size_t consumed() { return received - (egptr() - gptr()); }
+
   ~SocketBuffer() { close(); }
 
  protected:
@@ -67,5 +77,12 @@ class SocketStream : public std::iostream {
   int close() { return socketBuf.close(); }
 
   bool isOpen() { return socketBuf.isOpen(); }
+
+  std::unique_ptr<bell::Socket> release() { return socketBuf.release(); }
+
+  void attach(std::unique_ptr<bell::Socket> socket) {
+    socketBuf.attach(std::move(socket));
+    clear();
+  }
 };
 }  // namespace bell
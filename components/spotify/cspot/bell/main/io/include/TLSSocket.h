@@ -10,6 +10,7 @@
 #else
 #endif
 #include <stdlib.h>  // for size_t
+#include <atomic>    // for atomic
 #include <string>    // for string
 
 #include "mbedtls/ctr_drbg.h"     // for mbedtls_ctr_drbg_context
@@ -28,6 +29,8 @@ class TLSSocket : public bell::Socket {
 
   bool isClosed = true;
 
+  static std::atomic<uint32_t> resumeCount;
+
  public:
   TLSSocket();
   ~TLSSocket() { close(); };
@@ -41,6 +44,9 @@ class TLSSocket : public bell::Socket {
 
   void close();
   int getFd() { return server_fd.fd; }
+
+  // Number of handshakes that resumed a cached session
+  static uint32_t resumed() { return resumeCount; }
 };
 
 }  // namespace bell
@@ -0,0 +1,59 @@
+#include "AESCTRStream.h"
+
+#include <string.h>   // for memcpy
+#include <stdexcept>  // for runtime_error
+
+using namespace bell;
+
+AESCTRStream::AESCTRStream(const std::vector<uint8_t>& key,
+                           const std::vector<uint8_t>& iv) {
+  if (iv.size() != sizeof(this->iv)) {
+    throw std::runtime_error("AES CTR needs a 16 bytes IV");
+  }
+
+  mbedtls_aes_init(&aesCtx);
+  if (mbedtls_aes_setkey_enc(&aesCtx, key.data(), key.size() * 8) != 0) {
+    mbedtls_aes_free(&aesCtx);
+    throw std::runtime_error("Failed to set AES key");
+  }
+
+  memcpy(this->iv, iv.data(), sizeof(this->iv));
+  memcpy(this->counter, iv.data(), sizeof(this->counter));
+}
+
+AESCTRStream::~AESCTRStream() {
+  mbedtls_aes_free(&aesCtx);
+}
+
+void AESCTRStream::seek(size_t newPosition) {
+  if (newPosition == position) {
+    return;
+  }
+
+  // counter = iv + block index, as a 128 bits big endian number
+  uint64_t carry = newPosition / 16;
+  for (int i = sizeof(counter) - 1; i >= 0; i--) {
+    carry += iv[i];
+    counter[i] = carry & 0xff;
+    carry >>= 8;
+  }
+
+  // within a block, keystream of that block must be ready
+  blockOffset = newPosition % 16;
+  if (blockOffset) {
+    mbedtls_aes_crypt_ecb(&aesCtx, MBEDTLS_AES_ENCRYPT, counter, streamBlock);
+    for (int i = sizeof(counter) - 1; i >= 0 && ++counter[i] == 0; i--)
+      ;
+  }
+
+  position = newPosition;
+}
+
+void AESCTRStream::xcrypt(uint8_t* data, size_t nbytes) {
+  if (mbedtls_aes_crypt_ctr(&aesCtx, nbytes, &blockOffset, counter,
+                            streamBlock, data, data) != 0) {
+    throw std::runtime_error("Failed to decrypt");
+  }
+
+  position += nbytes;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <mbedtls/aes.h>  // for mbedtls_aes_context
+#include <stddef.h>       // for size_t
+#include <stdint.h>       // for uint8_t
+#include <vector>         // for vector
+
+namespace bell {
+/**
+ * Stateful AES-CTR transform over a stream. The key is expanded once and the
+ * counter advances with the data, so consecutive calls cost nothing but the
+ * cipher itself. Random access only costs recomputing the counter.
+ *
+ * On ESP32, mbedtls is built with the hardware AES (MBEDTLS_AES_ALT) so large
+ * calls are done by the accelerator.
+ */
+class AESCTRStream {
+ public:
+  AESCTRStream(const std::vector<uint8_t>& key, const std::vector<uint8_t>& iv);
+  ~AESCTRStream();
+
+  /**
+  * @brief Repositions the keystream at a byte offset of the stream
+  */
+  void seek(size_t position);
+
+  /**
+  * @brief Encrypts or decrypts in place and advances the stream
+  */
+  void xcrypt(uint8_t* data, size_t nbytes);
+
+  size_t getPosition() { return position; }
+
+ private:
+  mbedtls_aes_context aesCtx;
+  uint8_t iv[16];
+  uint8_t counter[16];
+  uint8_t streamBlock[16];
+  size_t blockOffset = 0;
+  size_t position = 0;
+};
+}  // namespace bell
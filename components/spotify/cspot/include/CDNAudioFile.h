@@ -1,13 +1,17 @@
 #pragma once
 
-#include <cstddef>  // for size_t
-#include <cstdint>  // for uint8_t
-#include <memory>   // for shared_ptr, unique_ptr
-#include <string>   // for string
-#include <vector>   // for vector
-
-#include "Crypto.h"      // for Crypto
-#include "HTTPClient.h"  // for HTTPClient
+#include <atomic>              // for atomic
+#include <condition_variable>  // for condition_variable
+#include <cstddef>             // for size_t
+#include <cstdint>             // for uint8_t
+#include <memory>              // for shared_ptr, unique_ptr
+#include <mutex>               // for mutex
+#include <string>              // for string
+#include <vector>              // for vector
+
+#include "AESCTRStream.h"  // for AESCTRStream
+#include "BellTask.h"      // for Task
+#include "HTTPClient.h"    // for HTTPClient
 
 namespace bell {
 class WrappedSemaphore;
@@ -16,10 +20,15 @@ class WrappedSemaphore;
 namespace cspot {
 class AccessKeyFetcher;
 
-class CDNAudioFile {
+class CDNAudioFile : bell::Task {
 
  public:
-  CDNAudioFile(const std::string& cdnUrl, const std::vector<uint8_t>& audioKey);
+  /**
+  * @param windowSize size of each read-ahead window, 0 for the default
+  */
+  CDNAudioFile(const std::string& cdnUrl, const std::vector<uint8_t>& audioKey,
+               size_t windowSize = 0);
+  ~CDNAudioFile();
 
   /**
   * @brief Opens connection to the provided cdn url, and fetches track metadata.
@@ -60,25 +69,46 @@ class CDNAudioFile {
   const int HTTP_BUFFER_SIZE = 1024 * 14;
   const int SPOTIFY_OPUS_HEADER = 167;
 
+  // Number of read-ahead windows, at least 2 so one is read while the next one is fetched
+  static const int PREFETCH_WINDOWS = 2;
+  // Attempts to fetch a window before giving up on the track
+  static const int FETCH_ATTEMPTS = 3;
+
   // Used to store opus metadata, speeds up read
   std::vector<uint8_t> header = std::vector<uint8_t>(OPUS_HEADER_SIZE);
   std::vector<uint8_t> footer;
 
-  // General purpose buffer to read data
-  std::vector<uint8_t> httpBuffer = std::vector<uint8_t>(HTTP_BUFFER_SIZE);
+  // Decrypted ranges of the stream, filled by the prefetch task
+  struct Window {
+    enum class State { EMPTY, QUEUED, FETCHING, READY, FAILED };
+    std::vector<uint8_t> data;
+    size_t position = 0;
+    size_t capacity = 0;
+    int attempts = 0;
+    uint32_t seekGeneration = 0;
+    State state = State::EMPTY;
+  };
+  std::vector<Window> windows = std::vector<Window>(PREFETCH_WINDOWS);
+  size_t windowSize;
+  // Incremented when reader moves away from all windows, so that stale ranges are not retried
+  uint32_t seekGeneration = 0;
+
+  std::mutex windowMutex;
+  std::condition_variable windowCond;
+
+  std::atomic<bool> isRunning = false;
+  std::unique_ptr<bell::WrappedSemaphore> taskFinished;
 
   // AES IV for decrypting the audio stream
   const std::vector<uint8_t> audioAESIV = {0x72, 0xe0, 0x67, 0xfb, 0xdd, 0xcb,
                                            0xcf, 0x77, 0xeb, 0xe8, 0xbc, 0x64,
                                            0x3f, 0x63, 0x0d, 0x93};
-  std::unique_ptr<Crypto> crypto;
+  std::unique_ptr<bell::AESCTRStream> aes;
 
   std::unique_ptr<bell::HTTPClient::Response> httpConnection;
 
   size_t position = 0;
   size_t totalFileSize = 0;
-  size_t lastRequestPosition = 0;
-  size_t lastRequestCapacity = 0;
 
   bool enableRequestMargin = false;
 
@@ -86,5 +116,10 @@ class CDNAudioFile {
   std::vector<uint8_t> audioKey;
 
   void decrypt(uint8_t* dst, size_t nbytes, size_t pos);
+
+  Window* findWindow(size_t offsetPosition, bool ready);
+  void queueWindow(size_t requestPosition);
+  void cancelWindows();
+  void runTask() override;
 };
 }  // namespace cspot
@@ -27,6 +27,12 @@ struct Context {
     std::vector<uint8_t> authData;
     int volume;
 
+    // Size of CDN read-ahead windows, 0 for default
+    size_t audioWindowSize = 0;
+
+    // Open next track that long before the end of current one, 0 to disable
+    uint32_t preloadMs = 10000;
+
     std::string username;
     std::string countryCode;
   };
@@ -51,12 +51,6 @@ class TrackPlayer : bell::Task {
   void seekMs(size_t ms);
   void resetState(bool paused = false);
 
-  // Vorbis codec callbacks
-  size_t _vorbisRead(void* ptr, size_t size, size_t nmemb);
-  size_t _vorbisClose();
-  int _vorbisSeek(int64_t offset, int whence);
-  long _vorbisTell();
-
   void stop();
   void start();
 
@@ -76,8 +70,17 @@ class TrackPlayer : bell::Task {
   std::mutex playbackMutex;
   std::mutex dataOutMutex;
 
-  // Vorbis related
-  OggVorbis_File vorbisFile;
+  // Next track, opened and primed during the last seconds of the current one
+  // by a short-lived task, so that playback never waits for the CDN
+  class PreloadTask;
+  std::unique_ptr<PreloadTask> preloadTask;
+  std::shared_ptr<QueuedTrack> nextTrack;
+  std::shared_ptr<cspot::CDNAudioFile> nextTrackStream;
+  int preloadAttempts = 0;
+
+  // Vorbis related, one decoder for the current track and one for the next
+  OggVorbis_File vorbisFiles[2];
+  int currentFile = 0;
   ov_callbacks vorbisCallbacks;
   int currentSection;
 
@@ -93,6 +96,9 @@ class TrackPlayer : bell::Task {
 
   std::mutex runningMutex;
 
+  bool preloadNextTrack(std::shared_ptr<QueuedTrack> track);
+  bool finishPreload(bool wait);
+  void dropNextTrack();
   void runTask() override;
 };
 }  // namespace cspot
@@ -1,6 +1,8 @@
 #include "CDNAudioFile.h"
 
 #include <string.h>          // for memcpy
+#include <algorithm>         // for max, min
+#include <chrono>            // for milliseconds
 #include <functional>        // for __base
 #include <initializer_list>  // for initializer_list
 #include <map>               // for operator!=, operator==
@@ -9,7 +11,6 @@
 
 #include "AccessKeyFetcher.h"  // for AccessKeyFetcher
 #include "BellLogger.h"        // for AbstractLogger
-#include "Crypto.h"
 #include "Logger.h"            // for CSPOT_LOG
 #include "Packet.h"            // for cspot
 #include "SocketStream.h"      // for SocketStream
@@ -25,9 +26,40 @@
 using namespace cspot;
 
 CDNAudioFile::CDNAudioFile(const std::string& cdnUrl,
-                           const std::vector<uint8_t>& audioKey)
-    : cdnUrl(cdnUrl), audioKey(audioKey) {
-  this->crypto = std::make_unique<Crypto>();
+                           const std::vector<uint8_t>& audioKey,
+                           size_t windowSize)
+    // Above player on the same core, so that it exits before the player can
+    // release it once it has signalled termination
+    : bell::Task("cspot_cdn", 12 * 1024, 6, 1),
+      cdnUrl(cdnUrl),
+      audioKey(audioKey) {
+  this->aes = std::make_unique<bell::AESCTRStream>(audioKey, audioAESIV);
+  this->taskFinished = std::make_unique<bell::WrappedSemaphore>(1);
+
+  // Ranges are requested on 16 bytes boundaries (AES block), keep windows aligned
+  if (windowSize == 0) {
+    windowSize = HTTP_BUFFER_SIZE;
+  }
+  this->windowSize = std::max<size_t>(windowSize - windowSize % 16, 1024);
+
+  for (auto& window : windows) {
+    window.data.resize(this->windowSize);
+  }
+}
+
+CDNAudioFile::~CDNAudioFile() {
+  if (isRunning) {
+    {
+      std::scoped_lock lock(windowMutex);
+      isRunning = false;
+    }
+    windowCond.notify_all();
+    taskFinished->wait();
+  }
+
+  auto stats = bell::HTTPClient::stats();
+  CSPOT_LOG(debug, "HTTP connections opened %d, reused %d, TLS resumed %d",
+            stats.opened, stats.reused, stats.resumed);
 }
 
 size_t CDNAudioFile::getPosition() {
@@ -35,8 +67,15 @@ size_t CDNAudioFile::getPosition() {
 }
 
 void CDNAudioFile::seek(size_t newPos) {
+  std::scoped_lock lock(windowMutex);
   this->enableRequestMargin = true;
   this->position = newPos;
+
+  // Queued ranges are useless if we seek away from them
+  if (!findWindow(newPos + SPOTIFY_OPUS_HEADER, true) &&
+      !findWindow(newPos + SPOTIFY_OPUS_HEADER, false)) {
+    cancelWindows();
+  }
 }
 
 void CDNAudioFile::openStream() {
@@ -69,8 +108,13 @@ void CDNAudioFile::openStream() {
   this->decrypt(footer.data(), footer.size(), footerStartLocation);
   CSPOT_LOG(info, "Header and footer bytes received");
   this->position = 0;
-  this->lastRequestPosition = 0;
-  this->lastRequestCapacity = 0;
+
+  // From now on, the connection belongs to the prefetch task
+  isRunning = true;
+  if (!startTask()) {
+    CSPOT_LOG(error, "Can't start prefetch task");
+    isRunning = false;
+  }
 }
 
 size_t CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
@@ -106,54 +150,207 @@ size_t CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
     return toReadBytes;
   }
 
-  // Data not in the headers. Make sense of whats going on.
-  // Position in bounds :)
-  if (offsetPosition >= this->lastRequestPosition &&
-      offsetPosition < this->lastRequestPosition + this->lastRequestCapacity) {
-    size_t toRead = bytes;
+  // Data not in the headers, serve it from the read-ahead windows
+  std::unique_lock lock(windowMutex);
+  Window* window;
+
+  while (isRunning && (window = findWindow(offsetPosition, true)) == nullptr) {
+    // Nothing fetched nor on its way, we have seeked: start again from there
+    if (!findWindow(offsetPosition, false)) {
+      size_t requestPosition = (offsetPosition) - ((offsetPosition) % 16);
+      if (this->enableRequestMargin && requestPosition > SEEK_MARGIN_SIZE) {
+        requestPosition = (offsetPosition - SEEK_MARGIN_SIZE) -
+                          ((offsetPosition - SEEK_MARGIN_SIZE) % 16);
+        this->enableRequestMargin = false;
+      }
+
+      cancelWindows();
+      queueWindow(requestPosition);
+    }
+
+    windowCond.wait(lock);
+  }
+
+  // Task is gone or range could not be fetched after retries
+  if (!isRunning || window->state == Window::State::FAILED) {
+    return 0;
+  }
+
+  size_t toRead =
+      std::min(bytes, window->position + window->capacity - offsetPosition);
+  memcpy(dst, window->data.data() + offsetPosition - window->position, toRead);
+  position += toRead;
+
+  // Half of this window is consumed, get the next one on its way
+  size_t nextPosition = window->position + window->capacity;
+  if (offsetPosition + toRead >= window->position + window->capacity / 2 &&
+      window->capacity == windowSize &&
+      nextPosition < actualFileSize - this->footer.size() &&
+      !findWindow(nextPosition, true) && !findWindow(nextPosition, false)) {
+    queueWindow(nextPosition);
+  }
+
+  return toRead;
+}
+
+size_t CDNAudioFile::getSize() {
+  return this->totalFileSize;
+}
 
-    if ((toRead + offsetPosition) >
-        this->lastRequestPosition + lastRequestCapacity) {
-      toRead = this->lastRequestPosition + lastRequestCapacity - offsetPosition;
+void CDNAudioFile::decrypt(uint8_t* dst, size_t nbytes, size_t pos) {
+  // Windows are mostly contiguous, so this is usually a no-op
+  this->aes->seek(pos);
+  this->aes->xcrypt(dst, nbytes);
+}
+
+CDNAudioFile::Window* CDNAudioFile::findWindow(size_t offsetPosition,
+                                               bool ready) {
+  for (auto& window : windows) {
+    // A short window only holds what was received (what follows is fetched
+    // again), but a failed one owns its full range so that reader gives up
+    size_t end = window.position;
+    if (window.state == Window::State::READY) {
+      end += ready ? window.capacity : 0;
+    } else if (window.state == Window::State::FAILED) {
+      end += ready ? windowSize : 0;
+    } else if (window.state != Window::State::EMPTY) {
+      end += ready ? 0 : windowSize;
     }
 
-    memcpy(dst, this->httpBuffer.data() + offsetPosition - lastRequestPosition,
-           toRead);
-    position += toRead;
-
-    return toRead;
-  } else {
-    size_t requestPosition = (offsetPosition) - ((offsetPosition) % 16);
-    if (this->enableRequestMargin && requestPosition > SEEK_MARGIN_SIZE) {
-      requestPosition = (offsetPosition - SEEK_MARGIN_SIZE) -
-                        ((offsetPosition - SEEK_MARGIN_SIZE) % 16);
-      this->enableRequestMargin = false;
+    if (offsetPosition >= window.position && offsetPosition < end) {
+      return &window;
     }
+  }
 
-    this->httpConnection->get(
-        cdnUrl, {bell::HTTPClient::RangeHeader::range(
-                    requestPosition, requestPosition + HTTP_BUFFER_SIZE - 1)});
-    this->lastRequestPosition = requestPosition;
-    this->lastRequestCapacity = this->httpConnection->contentLength();
+  return nullptr;
+}
 
-    this->httpConnection->stream().read((char*)this->httpBuffer.data(),
-                                        lastRequestCapacity);
-    this->decrypt(this->httpBuffer.data(), lastRequestCapacity,
+void CDNAudioFile::queueWindow(size_t requestPosition) {
+  size_t offsetPosition = position + SPOTIFY_OPUS_HEADER;
+  Window* slot = nullptr;
 
-                  this->lastRequestPosition);
+  // Use an empty window or a ready one that is not being read
+  for (auto& window : windows) {
+    if (window.state == Window::State::EMPTY) {
+      slot = &window;
+      break;
+    }
 
-    return readBytes(dst, bytes);
+    if ((window.state == Window::State::READY ||
+         window.state == Window::State::FAILED) &&
+        !slot &&
+        (offsetPosition < window.position ||
+         offsetPosition >= window.position + windowSize)) {
+      slot = &window;
+    }
+  }
+
+  // All busy, will retry on next read
+  if (!slot) {
+    return;
   }
 
-  return bytes;
+  slot->position = requestPosition;
+  slot->capacity = 0;
+  slot->attempts = 0;
+  slot->seekGeneration = seekGeneration;
+  slot->state = Window::State::QUEUED;
+  windowCond.notify_all();
 }
 
-size_t CDNAudioFile::getSize() {
-  return this->totalFileSize;
+void CDNAudioFile::cancelWindows() {
+  // Window being fetched will complete, but queued ones are dropped
+  for (auto& window : windows) {
+    if (window.state == Window::State::QUEUED) {
+      window.state = Window::State::EMPTY;
+    }
+  }
+
+  // A window waiting to be retried is not needed anymore either
+  seekGeneration++;
+  windowCond.notify_all();
 }
 
-void CDNAudioFile::decrypt(uint8_t* dst, size_t nbytes, size_t pos) {
-  auto calculatedIV = bigNumAdd(audioAESIV, pos / 16);
+void CDNAudioFile::runTask() {
+  std::unique_lock lock(windowMutex);
+
+  while (isRunning) {
+    // Fetch queued windows in stream order
+    Window* window = nullptr;
+    for (auto& candidate : windows) {
+      if (candidate.state == Window::State::QUEUED &&
+          (!window || candidate.position < window->position)) {
+        window = &candidate;
+      }
+    }
+
+    if (!window) {
+      windowCond.wait(lock);
+      continue;
+    }
+
+    size_t requestPosition = window->position, capacity = 0;
+    window->state = Window::State::FETCHING;
+    lock.unlock();
+
+    try {
+      bell::HTTPClient::Headers headers = {bell::HTTPClient::RangeHeader::range(
+          requestPosition, requestPosition + windowSize - 1)};
+
+      // Re-open connection if previous request failed
+      if (!this->httpConnection) {
+        this->httpConnection = bell::HTTPClient::get(cdnUrl, headers);
+      } else {
+        this->httpConnection->get(cdnUrl, headers);
+      }
+
+      size_t contentLength =
+          std::min(this->httpConnection->contentLength(), windowSize);
+      capacity = this->httpConnection->stream()
+                     .read((char*)window->data.data(), contentLength)
+                     .gcount();
+      this->decrypt(window->data.data(), capacity, requestPosition);
+
+      if (capacity != contentLength) {
+        CSPOT_LOG(error, "Short read at %d (%d/%d)", requestPosition, capacity,
+                  contentLength);
+        this->httpConnection = nullptr;
+      }
+    } catch (const std::exception& e) {
+      CSPOT_LOG(error, "Can't fetch range at %d: %s", requestPosition,
+                e.what());
+      this->httpConnection = nullptr;
+    }
+
+    lock.lock();
+    window->capacity = capacity;
+
+    // Got something, reader will queue what is missing when it gets there
+    if (capacity > 0) {
+      window->state = Window::State::READY;
+    } else if (window->seekGeneration != seekGeneration) {
+      // Reader has seeked away since this range was queued, don't retry it
+      window->state = Window::State::EMPTY;
+    } else if (++window->attempts < FETCH_ATTEMPTS) {
+      // Nothing received, retry a bit later (reader keeps waiting meanwhile)
+      windowCond.wait_for(
+          lock, std::chrono::milliseconds(250 * window->attempts),
+          [this, window] {
+            return !isRunning || window->seekGeneration != seekGeneration;
+          });
+      if (window->seekGeneration == seekGeneration) {
+        window->state = Window::State::QUEUED;
+        continue;
+      }
+      window->state = Window::State::EMPTY;
+    } else {
+      CSPOT_LOG(error, "Giving up on range at %d", requestPosition);
+      window->state = Window::State::FAILED;
+    }
+
+    windowCond.notify_all();
+  }
 
-  this->crypto->aesCTRXcrypt(this->audioKey, calculatedIV, dst, nbytes);
+  lock.unlock();
+  taskFinished->give();
 }
@@ -1,12 +1,15 @@
 #include "TrackPlayer.h"
 
+#include <exception>    // for exception
 #include <mutex>        // for mutex, scoped_lock
+#include <stdexcept>    // for runtime_error
 #include <string>       // for string
 #include <type_traits>  // for remove_extent_t
 #include <vector>       // for vector, vector<>::value_type
 
 #include "BellLogger.h"        // for AbstractLogger
 #include "BellUtils.h"         // for BELL_SLEEP_MS
+#include "CSpotContext.h"      // for Context, Context::ConfigState
 #include "Logger.h"            // for CSPOT_LOG
 #include "Packet.h"            // for cspot
 #include "TrackQueue.h"        // for CDNTrackStream, CDNTrackStream::TrackInfo
@@ -17,10 +20,12 @@
   (ov_time_seek(file, (double)position / 1000))
 #define VORBIS_READ(file, buffer, bufferSize, section) \
   (ov_read(file, buffer, bufferSize, 0, 2, 1, section))
+#define VORBIS_TELL(file) ((uint32_t)(ov_time_tell(file) * 1000))
 #else
 #define VORBIS_SEEK(file, position) (ov_time_seek(file, position))
 #define VORBIS_READ(file, buffer, bufferSize, section) \
   (ov_read(file, buffer, bufferSize, section))
+#define VORBIS_TELL(file) ((uint32_t)ov_time_tell(file))
 #endif
 
 namespace cspot {
@@ -30,24 +35,98 @@ struct TrackReference;
 
 using namespace cspot;
 
+// Attempts to open the next track before it is left to the regular path
+static const int PRELOAD_ATTEMPTS = 3;
+
+// Each decoder reads from its own stream, so the next track can be primed
+// while the current one is still playing
 static size_t vorbisReadCb(void* ptr, size_t size, size_t nmemb,
-                           TrackPlayer* self) {
-  return self->_vorbisRead(ptr, size, nmemb);
+                           CDNAudioFile* stream) {
+  return stream->readBytes((uint8_t*)ptr, nmemb * size);
 }
 
-static int vorbisCloseCb(TrackPlayer* self) {
-  return self->_vorbisClose();
+static int vorbisCloseCb(CDNAudioFile* stream) {
+  return 0;
 }
 
-static int vorbisSeekCb(TrackPlayer* self, int64_t offset, int whence) {
+static int vorbisSeekCb(CDNAudioFile* stream, int64_t offset, int whence) {
+  switch (whence) {
+    case 0:
+      stream->seek(offset);  // Spotify header offset
+      break;
+    case 1:
+      stream->seek(stream->getPosition() + offset);
+      break;
+    case 2:
+      stream->seek(stream->getSize() + offset);
+      break;
+  }
 
-  return self->_vorbisSeek(offset, whence);
+  return 0;
 }
 
-static long vorbisTellCb(TrackPlayer* self) {
-  return self->_vorbisTell();
+static long vorbisTellCb(CDNAudioFile* stream) {
+  return stream->getPosition();
 }
 
+// Opens the next track's stream and its decoder, both can block on the CDN
+class TrackPlayer::PreloadTask : public bell::Task {
+ public:
+  std::shared_ptr<QueuedTrack> track;
+  std::shared_ptr<cspot::CDNAudioFile> stream;
+  std::atomic<bool> done = false;
+  bool opened = false;
+
+  // Above player on the same core, so that it exits before the player can
+  // release it once it has signalled termination
+  PreloadTask(std::shared_ptr<QueuedTrack> track, OggVorbis_File* file,
+              ov_callbacks callbacks)
+      : bell::Task("cspot_preload", 16 * 1024, 6, 1),
+        track(track),
+        file(file),
+        callbacks(callbacks) {
+    finished = std::make_unique<bell::WrappedSemaphore>(1);
+  }
+
+  void wait() { finished->wait(); }
+
+ private:
+  OggVorbis_File* file;
+  ov_callbacks callbacks;
+  std::unique_ptr<bell::WrappedSemaphore> finished;
+
+  void runTask() override {
+    try {
+      stream = track->getAudioFile();
+      if (stream == nullptr) {
+        throw std::runtime_error("track not resolved");
+      }
+      stream->openStream();
+
+      if (ov_open_callbacks(stream.get(), file, NULL, 0, callbacks) == 0) {
+        if (track->requestedPosition > 0) {
+          VORBIS_SEEK(file, track->requestedPosition);
+        }
+        opened = true;
+      } else {
+        CSPOT_LOG(error, "Can't open next track ID=%s",
+                  track->identifier.c_str());
+      }
+    } catch (const std::exception& e) {
+      CSPOT_LOG(error, "Can't preload next track ID=%s: %s",
+                track->identifier.c_str(), e.what());
+    }
+
+    // Release a failed stream here, its teardown can wait for a fetch
+    if (!opened) {
+      stream = nullptr;
+    }
+
+    done = true;
+    finished->give();
+  }
+};
+
 TrackPlayer::TrackPlayer(std::shared_ptr<cspot::Context> ctx,
                          std::shared_ptr<cspot::TrackQueue> trackQueue,
                          EOFCallback eof, TrackLoadedCallback trackLoaded)
@@ -59,7 +138,7 @@ TrackPlayer::TrackPlayer(std::shared_ptr<cspot::Context> ctx,
   this->playbackSemaphore = std::make_unique<bell::WrappedSemaphore>(5);
 
   // Initialize vorbis callbacks
-  vorbisFile = {};
+  vorbisFiles[0] = vorbisFiles[1] = {};
   vorbisCallbacks = {
       (decltype(ov_callbacks::read_func))&vorbisReadCb,
       (decltype(ov_callbacks::seek_func))&vorbisSeekCb,
@@ -108,6 +187,58 @@ void TrackPlayer::seekMs(size_t ms) {
   this->pendingSeekPositionMs = ms;
 }
 
+bool TrackPlayer::preloadNextTrack(std::shared_ptr<QueuedTrack> track) {
+  int offset = 0;
+  auto next = trackQueue->consumeTrack(track, offset);
+
+  // Only prime a track that is already resolved, never wait for it here
+  if (next == nullptr || offset <= 0 ||
+      next->state != QueuedTrack::State::READY) {
+    return false;
+  }
+
+  preloadTask = std::make_unique<PreloadTask>(
+      next, &vorbisFiles[currentFile ^ 1], vorbisCallbacks);
+  if (!preloadTask->startTask()) {
+    CSPOT_LOG(error, "Can't start preload task");
+    preloadTask = nullptr;
+    return false;
+  }
+
+  return true;
+}
+
+bool TrackPlayer::finishPreload(bool wait) {
+  if (preloadTask == nullptr || (!wait && !preloadTask->done)) {
+    return false;
+  }
+
+  preloadTask->wait();
+
+  if (preloadTask->opened) {
+    CSPOT_LOG(info, "Preloaded next track ID=%s",
+              preloadTask->track->identifier.c_str());
+    nextTrack = preloadTask->track;
+    nextTrackStream = preloadTask->stream;
+  }
+
+  preloadTask = nullptr;
+  return true;
+}
+
+void TrackPlayer::dropNextTrack() {
+  finishPreload(true);
+  preloadAttempts = 0;
+
+  if (nextTrack == nullptr) {
+    return;
+  }
+
+  ov_clear(&vorbisFiles[currentFile ^ 1]);
+  nextTrack = nullptr;
+  nextTrackStream = nullptr;
+}
+
 void TrackPlayer::runTask() {
   std::scoped_lock lock(runningMutex);
 
@@ -130,13 +261,17 @@ void TrackPlayer::runTask() {
       track = nullptr;
       pendingReset = false;
       inFuture = false;
+      dropNextTrack();
     }
 
     endOfQueueReached = false;
 
     // Wait 800ms. If next reset is requested in meantime, restart the queue.
-    // Gets rid of excess actions during rapid queueing
-    BELL_SLEEP_MS(50);
+    // Gets rid of excess actions during rapid queueing. No need to when the
+    // next track has been primed, we want to splice it right away
+    if (nextTrack == nullptr || !eof) {
+      BELL_SLEEP_MS(50);
+    }
 
     if (pendingReset) {
       continue;
@@ -158,6 +293,15 @@ void TrackPlayer::runTask() {
 
     inFuture = trackOffset > 0;
 
+    // Track ended while the next one was being primed, let it finish
+    finishPreload(true);
+    preloadAttempts = 0;
+
+    // Queue has changed since the next track was primed
+    if (nextTrack != nullptr && nextTrack != track) {
+      dropNextTrack();
+    }
+
     if (track->state != QueuedTrack::State::READY) {
       track->loadedSemaphore->twait(5000);
 
@@ -175,29 +319,51 @@ void TrackPlayer::runTask() {
     {
       std::scoped_lock lock(playbackMutex);
 
-      currentTrackStream = track->getAudioFile();
+      if (nextTrack != nullptr && pendingSeekPositionMs == 0) {
+        // Stream is opened and decoder primed, just swap to it
+        currentFile ^= 1;
+        currentTrackStream = nextTrackStream;
+        nextTrack = nullptr;
+        nextTrackStream = nullptr;
 
-      // Open the stream
-      currentTrackStream->openStream();
+        CSPOT_LOG(info, "Splicing preloaded track");
+      } else {
+        dropNextTrack();
 
-      if (pendingReset || !currentSongPlaying) {
-        continue;
-      }
+        currentTrackStream = track->getAudioFile();
 
-      if (trackOffset == 0 && pendingSeekPositionMs == 0) {
-        this->trackLoaded(track, startPaused);
-        startPaused = false;
-      }
+        // Open the stream
+        currentTrackStream->openStream();
 
-      int32_t r =
-          ov_open_callbacks(this, &vorbisFile, NULL, 0, vorbisCallbacks);
+        if (pendingReset || !currentSongPlaying) {
+          continue;
+        }
+
+        if (trackOffset == 0 && pendingSeekPositionMs == 0) {
+          this->trackLoaded(track, startPaused);
+          startPaused = false;
+        }
 
-      if (pendingSeekPositionMs > 0) {
-        track->requestedPosition = pendingSeekPositionMs;
+        int32_t r = ov_open_callbacks(currentTrackStream.get(),
+                                      &vorbisFiles[currentFile], NULL, 0,
+                                      vorbisCallbacks);
+
+        if (pendingSeekPositionMs > 0) {
+          track->requestedPosition = pendingSeekPositionMs;
+        }
+
+        if (track->requestedPosition > 0) {
+          VORBIS_SEEK(&vorbisFiles[currentFile], track->requestedPosition);
+        }
       }
 
-      if (track->requestedPosition > 0) {
-        VORBIS_SEEK(&vorbisFile, track->requestedPosition);
+      OggVorbis_File* vorbisFile = &vorbisFiles[currentFile];
+
+      // Prime the next track when entering the last seconds of this one
+      uint32_t preloadAtMs = 0;
+      if (ctx->config.preloadMs > 0 &&
+          track->trackInfo.duration > ctx->config.preloadMs) {
+        preloadAtMs = track->trackInfo.duration - ctx->config.preloadMs;
       }
 
       eof = false;
@@ -214,10 +380,10 @@ void TrackPlayer::runTask() {
           pendingSeekPositionMs = 0;
 
           // Seek to the new position
-          VORBIS_SEEK(&vorbisFile, seekPosition);
+          VORBIS_SEEK(vorbisFile, seekPosition);
         }
 
-        long ret = VORBIS_READ(&vorbisFile, (char*)&pcmBuffer[0],
+        long ret = VORBIS_READ(vorbisFile, (char*)&pcmBuffer[0],
                                pcmBuffer.size(), &currentSection);
 
         if (ret == 0) {
@@ -248,9 +414,21 @@ void TrackPlayer::runTask() {
               toWrite -= written;
             }
           }
+
+          // Next track might not be resolved yet or fail to open, retry
+          // with an increasing delay and give up after a few attempts
+          if (finishPreload(false) && nextTrack == nullptr &&
+              ++preloadAttempts < PRELOAD_ATTEMPTS) {
+            preloadAtMs = VORBIS_TELL(vorbisFile) + 1000 * preloadAttempts;
+          }
+
+          if (preloadAtMs && nextTrack == nullptr && preloadTask == nullptr &&
+              !pendingReset && VORBIS_TELL(vorbisFile) >= preloadAtMs) {
+            preloadAtMs = preloadNextTrack(track) ? 0 : preloadAtMs + 1000;
+          }
         }
       }
-      ov_clear(&vorbisFile);
+      ov_clear(vorbisFile);
 
       CSPOT_LOG(info, "Playing done");
 
@@ -265,47 +443,12 @@ void TrackPlayer::runTask() {
       }
 
       this->eofCallback();
+    } else {
+      dropNextTrack();
     }
   }
-}
-
-size_t TrackPlayer::_vorbisRead(void* ptr, size_t size, size_t nmemb) {
-  if (this->currentTrackStream == nullptr) {
-    return 0;
-  }
-  return this->currentTrackStream->readBytes((uint8_t*)ptr, nmemb * size);
-}
 
-size_t TrackPlayer::_vorbisClose() {
-  return 0;
-}
-
-int TrackPlayer::_vorbisSeek(int64_t offset, int whence) {
-  if (this->currentTrackStream == nullptr) {
-    return 0;
-  }
-  switch (whence) {
-    case 0:
-      this->currentTrackStream->seek(offset);  // Spotify header offset
-      break;
-    case 1:
-      this->currentTrackStream->seek(this->currentTrackStream->getPosition() +
-                                     offset);
-      break;
-    case 2:
-      this->currentTrackStream->seek(this->currentTrackStream->getSize() +
-                                     offset);
-      break;
-  }
-
-  return 0;
-}
-
-long TrackPlayer::_vorbisTell() {
-  if (this->currentTrackStream == nullptr) {
-    return 0;
-  }
-  return this->currentTrackStream->getPosition();
+  dropNextTrack();
 }
 
 void TrackPlayer::setDataCallback(DataCallback callback) {
@@ -148,7 +148,8 @@ std::shared_ptr<cspot::CDNAudioFile> QueuedTrack::getAudioFile() {
     return nullptr;
   }
 
-  return std::make_shared<cspot::CDNAudioFile>(cdnUrl, audioKey);
+  return std::make_shared<cspot::CDNAudioFile>(cdnUrl, audioKey,
+                                               ctx->config.audioWindowSize);
 }
 
 void QueuedTrack::stepParseMetadata(Track* pbTrack, Episode* pbEpisode) {
@@ -28,6 +28,10 @@ static EXT_RAM_ATTR struct cspot_cb_s {
 static const char TAG[] = "cspot";
 static struct cspot_s *cspot;
 static cspot_cmd_vcb_t cmd_handler_chain;
+static EXT_RAM_ATTR struct {
+	char url[128];
+	uint32_t seq;
+} download;
 
 static void cspot_volume_up(bool pressed) {
 	if (!pressed) return;
@@ -90,15 +94,16 @@ const static actrls_t controls = {
 };
 
 /****************************************************************************************
- * Download callback
+ * Download callback, artwork is decoded while it is received
  */
-void got_artwork(uint8_t* data, size_t len, void *context) {
-	if (data) {
-		ESP_LOGI(TAG, "got artwork of %zu bytes", len);
-		displayer_artwork(data);
-		free(data);
-	} else {
-		ESP_LOGW(TAG, "artwork error or too large %zu", len);
+static void got_artwork(http_read_t read, void *handle, size_t len, void *context) {
+	// ignore a download that completes after next track has started
+	if (read && (uintptr_t) context == download.seq) {
+		ESP_LOGI(TAG, "receiving artwork of %zu bytes", len);
+		// too long URL are not cached
+		displayer_artwork_stream(*download.url ? download.url : NULL, read, handle);
+	} else if (!read) {
+		ESP_LOGW(TAG, "artwork error or too large");
 	}
 }
 
@@ -139,8 +144,17 @@ static bool cmd_handler(cspot_event_t event, ...) {
 		uint32_t duration = va_arg(args, int), offset = va_arg(args, int);
 		char *artist = va_arg(args, char*), *album = va_arg(args, char*), *title = va_arg(args, char*), *artwork = va_arg(args, char*);
 		if (artwork && displayer_can_artwork()) {
-			ESP_LOGI(TAG, "requesting artwork %s", artwork);
-			http_download(artwork, 128*1024, got_artwork, NULL);
+			// invalidate pending download
+			download.seq++;
+			// tracks of the same album share artwork
+			if (displayer_artwork_cached(artwork, NULL, 0)) {
+				ESP_LOGI(TAG, "artwork %s from cache", artwork);
+			} else {	
+				ESP_LOGI(TAG, "requesting artwork %s", artwork);
+				if (strlen(artwork) < sizeof(download.url)) strcpy(download.url, artwork);
+				else *download.url = '\0';
+				http_download_stream(artwork, 128*1024, got_artwork, (void*) (uintptr_t) download.seq);
+			}	
 		}	
 		displayer_metadata(artist, album, title);
 		displayer_timer(DISPLAYER_ELAPSED, offset, duration);
@@ -38,6 +38,8 @@
 #define BLOCK_SIZE (4096 * BYTES_PER_FRAME)
 #define MIN_READ    BLOCK_SIZE
 #define MIN_SPACE  (MIN_READ * 4)
+// largest compressed block we accept (8 channels of 4096 frames at 32 bits)
+#define MAX_BLOCK_SIZE	(4096 * 8 * 4 + 256)
 
 struct chunk_table {
 	u32_t sample, offset;
@@ -46,6 +48,8 @@ struct chunk_table {
 struct alac {
 	void *decoder;
 	u8_t *writebuf;
+	u8_t *readbuf;
+	size_t readbuf_size;
 	// following used for mp4 only
 	u32_t consume;
 	u32_t pos;
@@ -122,7 +126,7 @@ static int read_mp4_header(void) {
 			unsigned int block_size;
 			l->play = l->trak;						
 			l->decoder = alac_create_decoder(len - 36, ptr, &l->sample_size, &l->sample_rate, &l->channels, &block_size);
-			l->writebuf = malloc(block_size + 256);
+			l->writebuf = arena_alloc(block_size + 256, &l->writebuf);
 			LOG_INFO("allocated write buffer of %u bytes", block_size);
 			if (!l->writebuf) {
 				LOG_ERROR("allocation failed");
@@ -377,14 +381,26 @@ static decode_state alac_decode(void) {
 		return DECODE_RUNNING;
 	} else if (block_size != l->default_block_size) l->block_index++;
 
-	bytes = min(bytes, _buf_cont_read(streambuf));
-
-	// need to create a buffer with contiguous data
-	if (bytes < block_size) {
-		iptr = malloc(block_size);
-		memcpy(iptr, streambuf->readp, bytes);
-		memcpy(iptr + bytes, streambuf->buf, block_size - bytes);
-	} else iptr = streambuf->readp;
+	// need contiguous data, copy block to scratch zone when it wraps (stream thread owns writep)
+	if (_buf_cont_read(streambuf) < block_size) {
+		size_t cont = _buf_cont_read(streambuf);
+		if (block_size > l->readbuf_size) {
+			arena_release(l->readbuf);
+			l->readbuf_size = block_size <= MAX_BLOCK_SIZE ? block_size : 0;
+			l->readbuf = arena_alloc(l->readbuf_size, &l->readbuf);
+			if (!l->readbuf) {
+				LOG_ERROR("can't get %u bytes for wrapped block", block_size);
+				l->readbuf_size = 0;
+				UNLOCK_S;
+				return DECODE_ERROR;
+			}
+		}
+		memcpy(l->readbuf, streambuf->readp, cont);
+		memcpy(l->readbuf + cont, streambuf->buf, block_size - cont);
+		iptr = l->readbuf;
+	} else {
+		iptr = streambuf->readp;
+	}
 
 	if (!alac_to_pcm(l->decoder, iptr, l->writebuf, 2, &frames)) {
 		LOG_ERROR("decode error");
@@ -392,9 +408,6 @@ static decode_state alac_decode(void) {
 		return DECODE_ERROR;
 	}
 
-	// and free it
-	if (bytes < block_size) free(iptr);
-
 	LOG_SDEBUG("block of %u bytes (%u frames)", block_size, frames);
 
 	endstream = false;
@@ -519,7 +532,8 @@ static decode_state alac_decode(void) {
 
 static void alac_close(void) {
 	if (l->decoder) alac_delete_decoder(l->decoder);
-	if (l->writebuf) free(l->writebuf);	
+	if (l->writebuf) arena_release(l->writebuf);	
+	if (l->readbuf) arena_release(l->readbuf);
 	if (l->chunkinfo) free(l->chunkinfo);
 	if (l->block_size) free(l->block_size);
 	if (l->stsc) free(l->stsc);
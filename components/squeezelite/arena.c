@@ -0,0 +1,203 @@
+/* 
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+// boot-time arena for large buffers
+
+#include "squeezelite.h"
+
+/*
+The arena is allocated once (in external RAM when available) and is carved in
+a small table of contiguous slabs. Slabs are never returned to the system, a
+released slab stays tagged with its last owner so that the same user gets it
+back first when re-opening (codec scratch, buffers after a restart). Adjacent
+free slabs are only merged when nothing fits anymore. When the arena is not
+initialized or exhausted, allocations fall back to regular malloc.
+*/
+
+#define ARENA_SLABS		16
+#define ARENA_ALIGN		16
+#define ARENA_MIN_SPLIT	256
+
+static log_level loglevel;
+
+static struct {
+	u8_t *base;
+	size_t size;
+	int count;
+	struct {
+		const void *owner;
+		size_t offset, size;
+		bool used;
+	} slabs[ARENA_SLABS];
+	mutex_type mutex;
+} arena;
+
+#define LOCK_A   mutex_lock(arena.mutex)
+#define UNLOCK_A mutex_unlock(arena.mutex)
+
+// called with mutex locked
+static int _arena_find(void *ptr) {
+	if (!arena.base || (u8_t*) ptr < arena.base || (u8_t*) ptr >= arena.base + arena.size) return -1;
+	for (int i = 0; i < arena.count; i++) {
+		if (arena.base + arena.slabs[i].offset == (u8_t*) ptr) return i;
+	}
+	return -1;
+}
+
+// called with mutex locked, split slab so that it is size bytes if remainder is worth it
+static void _arena_split(int i, size_t size) {
+	if (arena.slabs[i].size - size < ARENA_MIN_SPLIT || arena.count == ARENA_SLABS) return;
+	memmove(arena.slabs + i + 2, arena.slabs + i + 1, (arena.count - i - 1) * sizeof(arena.slabs[0]));
+	arena.slabs[i + 1].owner = NULL;
+	arena.slabs[i + 1].used = false;
+	arena.slabs[i + 1].offset = arena.slabs[i].offset + size;
+	arena.slabs[i + 1].size = arena.slabs[i].size - size;
+	arena.slabs[i].size = size;
+	arena.count++;
+}
+
+// called with mutex locked, merge all adjacent free slabs
+static void _arena_coalesce(void) {
+	for (int i = 0; i < arena.count - 1;) {
+		if (!arena.slabs[i].used && !arena.slabs[i + 1].used) {
+			arena.slabs[i].size += arena.slabs[i + 1].size;
+			memmove(arena.slabs + i + 1, arena.slabs + i + 2, (arena.count - i - 2) * sizeof(arena.slabs[0]));
+			arena.count--;
+		} else i++;
+	}
+}
+
+// called with mutex locked, best fit with preference to what owner had before
+static int _arena_fit(size_t size, const void *owner) {
+	int best = -1, mine = -1;
+	for (int i = 0; i < arena.count; i++) {
+		if (arena.slabs[i].used || arena.slabs[i].size < size) continue;
+		if (owner && arena.slabs[i].owner == owner && (mine < 0 || arena.slabs[i].size < arena.slabs[mine].size)) mine = i;
+		if (best < 0 || arena.slabs[i].size < arena.slabs[best].size) best = i;
+	}
+	return mine >= 0 ? mine : best;
+}
+
+void arena_init(log_level level, size_t size) {
+	loglevel = level;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	// arena survives restarts, re-create only if it has to grow and is unused
+	if (arena.base) {
+		if (size <= arena.size) return;
+		LOCK_A;
+		_arena_coalesce();
+		if (arena.count > 1 || arena.slabs[0].used) {
+			UNLOCK_A;
+			LOG_WARN("arena in use, can't grow from %zu to %zu", arena.size, size);
+			return;
+		}
+		free(arena.base);
+		arena.base = NULL;
+		UNLOCK_A;
+	} else {
+		mutex_create(arena.mutex);
+	}
+
+	LOCK_A;
+	arena.base = ARENA_MALLOC(size);
+	if (arena.base) {
+		arena.size = size;
+		arena.count = 1;
+		arena.slabs[0].owner = NULL;
+		arena.slabs[0].offset = 0;
+		arena.slabs[0].size = size;
+		arena.slabs[0].used = false;
+		LOG_INFO("arena of %zu bytes", size);
+	} else {
+		arena.size = arena.count = 0;
+		LOG_WARN("unable to allocate arena of %zu bytes, using heap", size);
+	}
+	UNLOCK_A;
+}
+
+void *arena_alloc(size_t size, const void *owner) {
+	void *ptr = NULL;
+	int i;
+
+	if (!size) return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (arena.base) {
+		LOCK_A;
+		if ((i = _arena_fit(size, owner)) < 0) {
+			_arena_coalesce();
+			i = _arena_fit(size, owner);
+		}
+		if (i >= 0) {
+			_arena_split(i, size);
+			arena.slabs[i].used = true;
+			arena.slabs[i].owner = owner;
+			ptr = arena.base + arena.slabs[i].offset;
+		}
+		UNLOCK_A;
+		if (!ptr) LOG_WARN("arena can't fit %zu bytes, using heap", size);
+	}
+
+	return ptr ? ptr : malloc(size);
+}
+
+void arena_release(void *ptr) {
+	int i;
+
+	if (!ptr) return;
+
+	if (arena.base) {
+		LOCK_A;
+		if ((i = _arena_find(ptr)) >= 0) arena.slabs[i].used = false;
+		UNLOCK_A;
+		if (i >= 0) return;
+	}
+
+	free(ptr);
+}
+
+size_t arena_capacity(void *ptr) {
+	size_t size = 0;
+	int i;
+
+	if (!arena.base) return 0;
+
+	LOCK_A;
+	if ((i = _arena_find(ptr)) >= 0) size = arena.slabs[i].size;
+	UNLOCK_A;
+
+	return size;
+}
+
+bool arena_grow(void *ptr, size_t size) {
+	bool done = false;
+	int i;
+
+	if (!arena.base) return false;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	LOCK_A;
+	if ((i = _arena_find(ptr)) >= 0) {
+		size_t room = arena.slabs[i].size;
+		int n;
+
+		// only absorb following free slabs if that is enough
+		for (n = i + 1; room < size && n < arena.count && !arena.slabs[n].used; n++) room += arena.slabs[n].size;
+		if (room >= size) {
+			memmove(arena.slabs + i + 1, arena.slabs + n, (arena.count - n) * sizeof(arena.slabs[0]));
+			arena.count -= n - i - 1;
+			arena.slabs[i].size = room;
+			_arena_split(i, size);
+			done = true;
+		}
+	}
+	UNLOCK_A;
+
+	return done;
+}
@@ -0,0 +1,253 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "biquad.h"
+
+/*
+Cascade of stereo biquads (RBJ cookbook) in fixed point, Direct Form I. Samples
+are processed as 24 bits (16 bits are scaled up, 32 bits are scaled down) with
+coefficients in Q28 and a 64 bits accumulator, so there is headroom between
+sections and the result is only saturated once at the end of the cascade. When
+coefficients change at the same rate, they are moved linearly to their target
+by RAMP_STEPS steps of RAMP_FRAMES frames to avoid clicks. Bands that are an
+identity (0 dB peak or shelf) are skipped.
+*/
+
+#define COEF_BITS	28
+#define COEF_ONE	(1L << COEF_BITS)
+#define RAMP_STEPS	16
+#define RAMP_FRAMES	32
+
+struct section {
+	int32_t c[5], target[5], step[5];	// b0, b1, b2, a1, a2
+	int32_t x1[2], x2[2], y1[2], y2[2];
+};
+
+struct biquad_s {
+	int count, active;
+	uint32_t rate;
+	int ramp;
+	int *list;
+	struct section *section;
+};
+
+static const int32_t identity[5] = { COEF_ONE, 0, 0, 0, 0 };
+
+/****************************************************************************************
+ * Calculate normalized coefficients of one section
+ */
+static void coefficients(const struct biquad_band *band, uint32_t rate, int32_t *c) {
+	float b[3], a[3];
+
+	// can't do anything close to Nyquist, and some types are identity at 0 dB
+	if (band->freq <= 0 || band->freq >= rate * 0.45f ||
+	   (band->gain == 0 && band->type != BIQUAD_LOW_PASS && band->type != BIQUAD_HIGH_PASS)) {
+		memcpy(c, identity, sizeof(identity));
+		return;
+	}
+
+	float A = powf(10, band->gain / 40), w0 = 2 * M_PI * band->freq / rate;
+	float cosw0 = cosf(w0), alpha = sinf(w0) / (2 * (band->q > 0 ? band->q : 0.707f));
+
+	switch (band->type) {
+	case BIQUAD_LOW_SHELF: {
+		float k = 2 * sqrtf(A) * alpha;
+		b[0] = A * ((A + 1) - (A - 1) * cosw0 + k);
+		b[1] = 2 * A * ((A - 1) - (A + 1) * cosw0);
+		b[2] = A * ((A + 1) - (A - 1) * cosw0 - k);
+		a[0] = (A + 1) + (A - 1) * cosw0 + k;
+		a[1] = -2 * ((A - 1) + (A + 1) * cosw0);
+		a[2] = (A + 1) + (A - 1) * cosw0 - k;
+		break;
+	}
+	case BIQUAD_HIGH_SHELF: {
+		float k = 2 * sqrtf(A) * alpha;
+		b[0] = A * ((A + 1) + (A - 1) * cosw0 + k);
+		b[1] = -2 * A * ((A - 1) + (A + 1) * cosw0);
+		b[2] = A * ((A + 1) + (A - 1) * cosw0 - k);
+		a[0] = (A + 1) - (A - 1) * cosw0 + k;
+		a[1] = 2 * ((A - 1) - (A + 1) * cosw0);
+		a[2] = (A + 1) - (A - 1) * cosw0 - k;
+		break;
+	}
+	case BIQUAD_LOW_PASS:
+		b[0] = b[2] = (1 - cosw0) / 2;
+		b[1] = 1 - cosw0;
+		a[0] = 1 + alpha;
+		a[1] = -2 * cosw0;
+		a[2] = 1 - alpha;
+		break;
+	case BIQUAD_HIGH_PASS:
+		b[0] = b[2] = (1 + cosw0) / 2;
+		b[1] = -(1 + cosw0);
+		a[0] = 1 + alpha;
+		a[1] = -2 * cosw0;
+		a[2] = 1 - alpha;
+		break;
+	case BIQUAD_PEAK:
+	default:
+		b[0] = 1 + alpha * A;
+		b[1] = -2 * cosw0;
+		b[2] = 1 - alpha * A;
+		a[0] = 1 + alpha / A;
+		a[1] = -2 * cosw0;
+		a[2] = 1 - alpha / A;
+		break;
+	}
+
+	c[0] = lrintf(b[0] / a[0] * COEF_ONE);
+	c[1] = lrintf(b[1] / a[0] * COEF_ONE);
+	c[2] = lrintf(b[2] / a[0] * COEF_ONE);
+	c[3] = lrintf(a[1] / a[0] * COEF_ONE);
+	c[4] = lrintf(a[2] / a[0] * COEF_ONE);
+}
+
+/****************************************************************************************
+ * Build list of sections to process (skip identities)
+ */
+static void update_list(struct biquad_s *eq) {
+	eq->active = 0;
+	for (int i = 0; i < eq->count; i++) {
+		struct section *s = eq->section + i;
+		if (memcmp(s->c, identity, sizeof(identity)) || memcmp(s->target, identity, sizeof(identity))) {
+			eq->list[eq->active++] = i;
+		} else {
+			memset(s->x1, 0, sizeof(s->x1) * 4);
+		}
+	}
+}
+
+/****************************************************************************************
+ * Create a cascade of count sections
+ */
+struct biquad_s* biquad_create(int count) {
+	struct biquad_s *eq = calloc(1, sizeof(struct biquad_s));
+	if (!eq) return NULL;
+
+	eq->section = calloc(count, sizeof(struct section));
+	eq->list = calloc(count, sizeof(int));
+	if (!eq->section || !eq->list) {
+		biquad_destroy(eq);
+		return NULL;
+	}
+
+	eq->count = count;
+	for (int i = 0; i < count; i++) {
+		memcpy(eq->section[i].c, identity, sizeof(identity));
+		memcpy(eq->section[i].target, identity, sizeof(identity));
+	}
+
+	return eq;
+}
+
+/****************************************************************************************
+ * Destroy cascade
+ */
+void biquad_destroy(struct biquad_s *eq) {
+	if (!eq) return;
+	free(eq->section);
+	free(eq->list);
+	free(eq);
+}
+
+/****************************************************************************************
+ * Set bands (count as in create), returns false if cascade is an identity
+ */
+bool biquad_set(struct biquad_s *eq, const struct biquad_band *bands, uint32_t rate) {
+	bool smooth = eq->rate == rate;
+
+	for (int i = 0; i < eq->count; i++) {
+		struct section *s = eq->section + i;
+		coefficients(bands + i, rate, s->target);
+		for (int j = 0; j < 5; j++) {
+			if (smooth) {
+				s->step[j] = (s->target[j] - s->c[j]) / RAMP_STEPS;
+			} else {
+				s->c[j] = s->target[j];
+			}
+		}
+		if (!smooth) memset(s->x1, 0, sizeof(s->x1) * 4);
+	}
+
+	eq->ramp = smooth ? RAMP_STEPS : 0;
+	eq->rate = rate;
+	update_list(eq);
+
+	// all sections might still need to ramp down to identity
+	for (int i = 0; i < eq->count; i++) {
+		if (memcmp(eq->section[i].target, identity, sizeof(identity))) return true;
+	}
+
+	return eq->active != 0;
+}
+
+/****************************************************************************************
+ * Move coefficients one step closer to their target
+ */
+static void ramp(struct biquad_s *eq) {
+	if (--eq->ramp) {
+		for (int i = 0; i < eq->active; i++) {
+			struct section *s = eq->section + eq->list[i];
+			for (int j = 0; j < 5; j++) s->c[j] += s->step[j];
+		}
+	} else {
+		for (int i = 0; i < eq->active; i++) {
+			struct section *s = eq->section + eq->list[i];
+			memcpy(s->c, s->target, sizeof(s->c));
+		}
+		update_list(eq);
+	}
+}
+
+/****************************************************************************************
+ * Run the cascade on one channel of 24 bits samples
+ */
+static inline int32_t cascade(struct biquad_s *eq, int ch, int32_t x) {
+	for (int i = 0; i < eq->active; i++) {
+		struct section *s = eq->section + eq->list[i];
+		int64_t acc = (int64_t) 1 << (COEF_BITS - 1);
+		acc += (int64_t) s->c[0] * x + (int64_t) s->c[1] * s->x1[ch] + (int64_t) s->c[2] * s->x2[ch];
+		acc -= (int64_t) s->c[3] * s->y1[ch] + (int64_t) s->c[4] * s->y2[ch];
+		s->x2[ch] = s->x1[ch];
+		s->x1[ch] = x;
+		s->y2[ch] = s->y1[ch];
+		s->y1[ch] = x = acc >> COEF_BITS;
+	}
+	return x;
+}
+
+void biquad_process_s16(struct biquad_s *eq, int16_t *buf, size_t frames) {
+	while (frames && eq->active) {
+		size_t chunk = eq->ramp ? (frames < RAMP_FRAMES ? frames : RAMP_FRAMES) : frames;
+		frames -= chunk;
+		while (chunk--) {
+			for (int ch = 0; ch < 2; ch++, buf++) {
+				int32_t y = cascade(eq, ch, (int32_t) *buf << 8) >> 8;
+				*buf = y > INT16_MAX ? INT16_MAX : (y < INT16_MIN ? INT16_MIN : y);
+			}
+		}
+		if (eq->ramp) ramp(eq);
+	}
+}
+
+void biquad_process_s32(struct biquad_s *eq, int32_t *buf, size_t frames) {
+	while (frames && eq->active) {
+		size_t chunk = eq->ramp ? (frames < RAMP_FRAMES ? frames : RAMP_FRAMES) : frames;
+		frames -= chunk;
+		while (chunk--) {
+			for (int ch = 0; ch < 2; ch++, buf++) {
+				int32_t y = cascade(eq, ch, *buf >> 8);
+				*buf = y > (INT32_MAX >> 8) ? INT32_MAX & ~0xff : (y < (INT32_MIN >> 8) ? INT32_MIN : y << 8);
+			}
+		}
+		if (eq->ramp) ramp(eq);
+	}
+}
@@ -0,0 +1,28 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum { BIQUAD_PEAK = 0, BIQUAD_LOW_SHELF, BIQUAD_HIGH_SHELF, BIQUAD_LOW_PASS, BIQUAD_HIGH_PASS } biquad_type_t;
+
+struct biquad_band {
+	biquad_type_t type;
+	float freq, q, gain;	// gain in dB (not used by low/high pass)
+};
+
+struct biquad_s;
+
+struct biquad_s* biquad_create(int count);
+void biquad_destroy(struct biquad_s *eq);
+bool biquad_set(struct biquad_s *eq, const struct biquad_band *bands, uint32_t rate);
+void biquad_process_s16(struct biquad_s *eq, int16_t *buf, size_t frames);
+void biquad_process_s32(struct biquad_s *eq, int32_t *buf, size_t frames);
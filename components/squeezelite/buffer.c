@@ -27,76 +27,254 @@
 
 #include "squeezelite.h"
 
+/* 
+With BUF_LOCKFREE, readp is only moved by the consumer and writep only by the
+producer (flush, resize and limit still require the mutex) so that they can be
+read and updated atomically without mutex. This allows a thread to check fill
+level of a buffer it does not own without contending with the one working on it.
+Moving data in/out still requires the mutex, as it also protects states.
+*/
+#if BUF_LOCKFREE
+#define BUF_LOAD(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define BUF_STORE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#else
+#define BUF_LOAD(p)		(p)
+#define BUF_STORE(p, v)	(p) = (v)
+#endif
+
+/*
+A producer can reserve the free space (as two segments when it wraps), fill it
+without mutex and then commit what it has written. The consumer only moves readp
+forward so the reserved region remains valid, but anything that moves writep 
+(unwrap) must wait for the commit, and a flush, resize or limit cancels the 
+reservation so that the commit is discarded. Only the producer clears 'reserved'
+(on commit), so waiting for it to drop guarantees the producer is done.
+
+Symmetrically, the consumer can hold what it consumes, move readp under mutex 
+and read the data later without mutex. Held bytes are not counted as space until
+released, and a flush, resize or limit waits for the release.
+*/
+
+/*
+Instead of polling, a thread can block until a buffer has enough space or data.
+The waiter sets a threshold and the other side signals when it is reached while
+moving readp or writep. With BUF_LOCKFREE, pointers are moved without mutex so 
+a signal may fall between the check and the wait: waits always have a timeout
+so that this costs at most one timeout. Flushing or resizing wakes everybody.
+*/
+#if WIN
+#define BUF_SIGNAL(buf)
+#else
+#define BUF_SIGNAL(buf) pthread_cond_broadcast(&(buf)->cond)
+#endif
+
+#define UNWRAP_SCRATCH_SIZE (16 * 1024)
+
 // _* called with muxtex locked
 
 inline unsigned _buf_used(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->size - (buf->readp - buf->writep);
+	u8_t *readp = BUF_LOAD(buf->readp), *writep = BUF_LOAD(buf->writep);
+	return writep >= readp ? writep - readp : buf->size - (readp - writep);
 }
 
 unsigned _buf_space(struct buffer *buf) {
-	return buf->size - _buf_used(buf) - 1; // reduce by one as full same as empty otherwise
+	// used must be read before held (see _buf_hold) and reduce by one as full same as empty otherwise
+	int space = buf->size - _buf_used(buf) - BUF_LOAD(buf->held) - 1; 
+	return space > 0 ? space : 0;
 }
 
 unsigned _buf_cont_read(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->wrap - buf->readp;
+	u8_t *readp = BUF_LOAD(buf->readp), *writep = BUF_LOAD(buf->writep);
+	return writep >= readp ? writep - readp : buf->wrap - readp;
 }
 
 unsigned _buf_cont_write(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->wrap - buf->writep : buf->readp - buf->writep;
+	u8_t *readp = BUF_LOAD(buf->readp), *writep = BUF_LOAD(buf->writep);
+	return writep >= readp ? buf->wrap - writep : readp - writep;
 }
 
 void _buf_inc_readp(struct buffer *buf, unsigned by) {
-	buf->readp += by;
-	if (buf->readp >= buf->wrap) {
-		buf->readp -= buf->size;
+	u8_t *readp = buf->readp + by;
+	if (readp >= buf->wrap) {
+		readp -= buf->size;
+	}
+	BUF_STORE(buf->readp, readp);
+	// wake-up producer waiting for space
+	if (BUF_LOAD(buf->wait_space) && _buf_space(buf) >= buf->wait_space) {
+		BUF_STORE(buf->wait_space, 0);
+		BUF_SIGNAL(buf);
 	}
 }
 
 void _buf_inc_writep(struct buffer *buf, unsigned by) {
-	buf->writep += by;
-	if (buf->writep >= buf->wrap) {
-		buf->writep -= buf->size;
+	u8_t *writep = buf->writep + by;
+	if (writep >= buf->wrap) {
+		writep -= buf->size;
+	}
+	BUF_STORE(buf->writep, writep);
+	// wake-up consumer waiting for data
+	if (BUF_LOAD(buf->wait_data) && _buf_used(buf) >= buf->wait_data) {
+		BUF_STORE(buf->wait_data, 0);
+		BUF_SIGNAL(buf);
 	}
 }
 
+// consumer only, called with mutex locked before moving readp, data stays valid until released
+void _buf_hold(struct buffer *buf, unsigned by) {
+	BUF_STORE(buf->held, buf->held + by);
+}
+
+// consumer only, can be called without mutex, data held so far can be overwritten
+void buf_release(struct buffer *buf) {
+	BUF_STORE(buf->held, 0);
+	// wake-up whoever waits to move pointers
+	if (BUF_LOAD(buf->wait_held)) {
+		BUF_STORE(buf->wait_held, false);
+		BUF_SIGNAL(buf);
+	}
+	// wake-up producer waiting for space
+	if (BUF_LOAD(buf->wait_space) && _buf_space(buf) >= buf->wait_space) {
+		BUF_STORE(buf->wait_space, 0);
+		BUF_SIGNAL(buf);
+	}
+}
+
+// consumer might still be reading data behind readp, wait for release before moving pointers
+// (mutex is released while waiting, release is signalled without it so wake-up might be missed)
+static void _buf_wait_held(struct buffer *buf) {
+	while (BUF_LOAD(buf->held)) {
+		BUF_STORE(buf->wait_held, true);
+		_buf_wait(buf, 10);
+	}
+	BUF_STORE(buf->wait_held, false);
+}
+
 void buf_flush(struct buffer *buf) {
 	mutex_lock(buf->mutex);
+	_buf_wait_held(buf);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
+	_buf_wake(buf);
 	mutex_unlock(buf->mutex);
 }
 
 void _buf_flush(struct buffer *buf) {
+	_buf_wait_held(buf);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
+	_buf_wake(buf);
+}
+
+// producer only, called with mutex locked, get up to max bytes of free space as 1 or 2 segments
+unsigned _buf_reserve(struct buffer *buf, unsigned max, u8_t *seg[2], unsigned len[2]) {
+	unsigned space = min(_buf_space(buf), max);
+
+	seg[0] = buf->writep;
+	len[0] = min(space, _buf_cont_write(buf));
+	seg[1] = buf->buf;
+	len[1] = space - len[0];
+	buf->reserved = true;
+	buf->cancelled = false;
+
+	return space;
+}
+
+// called with mutex locked, publish what has been written in reserved space unless it has been cancelled
+bool _buf_commit(struct buffer *buf, unsigned by) {
+	bool valid = buf->reserved && !buf->cancelled;
+	
+	buf->reserved = false;
+	if (valid && by) _buf_inc_writep(buf, by);
+	
+	// someone might be waiting for the reservation to end
+	BUF_SIGNAL(buf);
+	return valid;
+}
+
+// wake-up whoever waits on that buffer, whatever the threshold (and cancel reservation)
+void _buf_wake(struct buffer *buf) {
+	buf->cancelled = true;
+	BUF_STORE(buf->wait_space, 0);
+	BUF_STORE(buf->wait_data, 0);
+	BUF_SIGNAL(buf);
+}
+
+// wait for a wake-up or timeout (ms), called with mutex locked
+void _buf_wait(struct buffer *buf, unsigned timeout) {
+#if WIN
+	mutex_unlock(buf->mutex);
+	Sleep(timeout);
+	mutex_lock(buf->mutex);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (timeout % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&buf->cond, &buf->mutex, &ts);
+#endif
+}
+
+// wait until there is at least space bytes free or timeout, called with mutex locked
+void _buf_wait_space(struct buffer *buf, unsigned space, unsigned timeout) {
+	if (space >= buf->size) space = buf->size - 1;
+	BUF_STORE(buf->wait_space, space);
+	if (_buf_space(buf) < space) _buf_wait(buf, timeout);
+	BUF_STORE(buf->wait_space, 0);
+}
+
+// wait until there is at least used bytes or timeout, called with mutex locked
+void _buf_wait_data(struct buffer *buf, unsigned used, unsigned timeout) {
+	if (used >= buf->size) used = buf->size - 1;
+	BUF_STORE(buf->wait_data, used);
+	if (_buf_used(buf) < used) _buf_wait(buf, timeout);
+	BUF_STORE(buf->wait_data, 0);
+}
+
+void buf_wait_space(struct buffer *buf, unsigned space, unsigned timeout) {
+	mutex_lock(buf->mutex);
+	_buf_wait_space(buf, space, timeout);
+	mutex_unlock(buf->mutex);
+}
+
+void buf_wait_data(struct buffer *buf, unsigned used, unsigned timeout) {
+	mutex_lock(buf->mutex);
+	_buf_wait_data(buf, used, timeout);
+	mutex_unlock(buf->mutex);
 }
 
 // adjust buffer to multiple of mod bytes so reading in multiple always wraps on frame boundary
 void buf_adjust(struct buffer *buf, size_t mod) {
 	mutex_lock(buf->mutex);
+	_buf_wait_held(buf);
 	buf->base_size = ((size_t)(buf->size / mod)) * mod;
 	buf->readp  = buf->writep = buf->buf;
 	buf->wrap   = buf->buf + buf->base_size;
 	buf->size   = buf->base_size;
+	_buf_wake(buf);
 	mutex_unlock(buf->mutex);
 }
 
-// called with mutex locked to resize, does not retain contents, reverts to original size if fails
+// called with mutex locked to resize, does not retain contents, stays at current size if fails
+// (buffer memory is never given back, it is re-partitioned within its arena slab)
 void _buf_resize(struct buffer *buf, size_t size) {
 	if (size == buf->size) return;
-	free(buf->buf);
-	buf->buf = malloc(size);
-	if (!buf->buf) {
-		size    = buf->size;
-		buf->buf = malloc(size);
-		if (!buf->buf) size = 0;
+	if (size > buf->true_size) {
+		if (arena_grow(buf->buf, size)) buf->true_size = arena_capacity(buf->buf);
+		else size = buf->size;
 	}
+	_buf_wait_held(buf);
 	buf->writep = buf->readp  = buf->buf;
 	buf->wrap   = buf->buf + size;
-	buf->true_size = buf->base_size = buf->size = size;
+	buf->base_size = buf->size = size;
+	_buf_wake(buf);
 }
 
 size_t _buf_limit(struct buffer *buf, size_t limit) {
+	_buf_wait_held(buf);
 	if (limit) {
 		buf->size = limit;
 		buf->readp = buf->writep = buf->buf;
@@ -104,13 +282,23 @@ size_t _buf_limit(struct buffer *buf, size_t limit) {
 		buf->size = buf->base_size;
 	}
 	buf->wrap = buf->buf + buf->size;
+	_buf_wake(buf);
 	return buf->base_size - buf->size;
 }
 
 void _buf_unwrap(struct buffer *buf, size_t cont) {
-	ssize_t len, by = cont - (buf->wrap - buf->readp);
-	size_t size;
-	u8_t *scratch;
+	static u8_t *scratch;
+	u8_t *readp = buf->readp;
+	size_t size = buf->size;
+	ssize_t len, by;
+
+	// producer is writing in free space, wait till it is done as we move writep
+	while (buf->reserved) _buf_wait(buf, 10);
+
+	// mutex was released while waiting, buffer might have been flushed or resized
+	if (buf->readp != readp || buf->size != size) return;
+	
+	by = cont - (buf->wrap - buf->readp);
 
 	// do nothing if we have enough space
 	if (by <= 0 || cont >= buf->size) return;
@@ -141,10 +329,11 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 		return;
 	}
 
-	scratch = malloc(size);
+	// only decoder thread unwraps so scratch zone can be shared
+	if (!scratch) scratch = arena_alloc(UNWRAP_SCRATCH_SIZE, &scratch);
 
 	// buffer is wrapped but not enough free room => use scratch zone
-	if (scratch) {
+	if (scratch && size <= UNWRAP_SCRATCH_SIZE) {
 		memcpy(scratch, buf->writep - size, size);
 		memmove(buf->readp - by, buf->readp, buf->wrap - buf->readp);
 		buf->readp -= by;
@@ -152,7 +341,6 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 		memmove(buf->buf, buf->buf + by, len - by - size);
 		buf->writep -= by;
 		memcpy(buf->writep - size, scratch, size);
-		free(scratch);
 	} else {
 		_buf_unwrap(buf, cont / 2);
         _buf_unwrap(buf, cont - cont / 2);
@@ -160,19 +348,29 @@ void _buf_unwrap(struct buffer *buf, size_t cont) {
 }
 
 void buf_init(struct buffer *buf, size_t size) {
-	buf->buf    = malloc(size);
+	buf->buf    = arena_alloc(size, buf);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	buf->wrap   = buf->buf + size;
-	buf->true_size = buf->base_size = buf->size = size;
+	buf->base_size = buf->size = size;
+	buf->true_size = arena_capacity(buf->buf);
+	if (buf->true_size < size) buf->true_size = size;
+	buf->wait_space = buf->wait_data = buf->held = 0;
+	buf->reserved = buf->cancelled = buf->wait_held = false;
 	mutex_create_p(buf->mutex);
+#if !WIN
+	pthread_cond_init(&buf->cond, NULL);
+#endif
 }
 
 void buf_destroy(struct buffer *buf) {
 	if (buf->buf) {
-		free(buf->buf);
+		arena_release(buf->buf);
 		buf->buf = NULL;
 		buf->size = buf->base_size = buf->true_size = 0;
 		mutex_destroy(buf->mutex);
+#if !WIN
+		pthread_cond_destroy(&buf->cond);
+#endif
 	}
 }
@@ -2,7 +2,7 @@
 # "main" pseudo-component makefile.
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
-CFLAGS += -O3 -DLINKALL -DLOOPBACK -DNO_FAAD -DRESAMPLE16 -DEMBEDDED -DTREMOR_ONLY -DBYTES_PER_FRAME=4 	\
+CFLAGS += -O3 -DLINKALL -DLOOPBACK -DNO_FAAD -DRESAMPLE16 -DEMBEDDED -DTREMOR_ONLY -DBUF_LOCKFREE -DBYTES_PER_FRAME=4 	\
 	-I$(COMPONENT_PATH)/../codecs/inc			\
 	-I$(COMPONENT_PATH)/../codecs/inc/mad 		\
 	-I$(COMPONENT_PATH)/../codecs/inc/alac		\
@@ -16,6 +16,7 @@ CFLAGS += -O3 -DLINKALL -DLOOPBACK -DNO_FAAD -DRESAMPLE16 -DEMBEDDED -DTREMOR_ON
 	-I$(COMPONENT_PATH)/../driver_bt			\
 	-I$(COMPONENT_PATH)/../raop					\
 	-I$(COMPONENT_PATH)/../services				\
+	-I$(COMPONENT_PATH)/../spotify/cspot/bell/main/io/include	\
 	-I$(COMPONENT_PATH)/../audio/inc
 
 #	-I$(COMPONENT_PATH)/../codecs/inc/faad2
@@ -23,6 +23,15 @@
 
 #include "squeezelite.h"
 
+#if EMBEDDED
+#include "esp_timer.h"
+#include "perf_counters.h"
+
+static struct {
+	perf_metric_t *time, *errors;
+} perf;
+#endif
+
 log_level loglevel;
 
 extern struct buffer *streambuf;
@@ -56,10 +65,19 @@ static bool running = true;
 static void *decode_thread() {
 	
 	while (running) {
-		size_t bytes, space, min_space;
+		size_t bytes, space, min_space = 0, min_read = 0;
 		bool toend;
 		bool ran = false;
 		
+#if BUF_LOCKFREE
+		// stream state needs the mutex, but as streambuf's consumer and outputbuf's producer, 
+		// levels do not (read state first so that all data is there when it says disconnected)
+		LOCK_S;
+		toend = (stream.state <= DISCONNECT);
+		UNLOCK_S;
+		bytes = _buf_used(streambuf);
+		space = _buf_space(outputbuf);
+#else
 		LOCK_S;
 		bytes = _buf_used(streambuf);
 		toend = (stream.state <= DISCONNECT);
@@ -67,6 +85,7 @@ static void *decode_thread() {
 		LOCK_O;
 		space = _buf_space(outputbuf);
 		UNLOCK_O;
+#endif
 
 		LOCK_D;
 		
@@ -80,10 +99,18 @@ static void *decode_thread() {
 			IF_PROCESS(
 				min_space = process.max_out_frames * BYTES_PER_FRAME;
 			);
+			min_read = codec->min_read_bytes;
 
 			if (space > min_space && (bytes > codec->min_read_bytes || toend)) {
 				
+#if EMBEDDED
+				int64_t start = esp_timer_get_time();
+				decode.state = codec->decode();
+				perf_set(perf.time, esp_timer_get_time() - start);
+				if (decode.state == DECODE_ERROR) perf_count(perf.errors, 1);
+#else
 				decode.state = codec->decode();
+#endif
 
 				IF_PROCESS(
 					if (process.in_frames) {
@@ -112,8 +139,10 @@ static void *decode_thread() {
 		
 		UNLOCK_D;
 
+		// block until output has room or enough new data is received (or not running) 
 		if (!ran) {
-			usleep(100000);
+			if (space <= min_space) buf_wait_space(outputbuf, min_space + 1, 100);
+			else buf_wait_data(streambuf, (bytes > min_read ? bytes : min_read) + 1, 100);
 		}
 	}
 	
@@ -152,6 +181,11 @@ void decode_init(log_level level, const char *include_codecs, const char *exclud
 
 	LOG_INFO("init decode");
 
+#if EMBEDDED
+	perf.time = perf_register("decode.time", PERF_HISTOGRAM, "us");
+	perf.errors = perf_register("decode.errors", PERF_COUNTER, "tracks");
+#endif
+
 	// register codecs
 	// dsf,dff,alc,wma,wmap,wmal,aac,spt,ogg,ogf,flc,aif,pcm,mp3
 	i = 0;
@@ -36,6 +36,7 @@ static bool enable_airplay;
 #define SYNC_WIN_SLOW	32
 #define SYNC_WIN_CHECK	8
 #define SYNC_WIN_FAST	2
+#define SYNC_PPM_PER_MS	50
 
 static raop_event_t	raop_state;
 
@@ -250,8 +251,15 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 			raop_sync.sum += error;
 			error = raop_sync.sum / min(raop_sync.count, raop_sync.win);
 
+			// in slow mode, steer playback rate for small errors (error > 0 means we are early)
+			if (output.adjust && raop_sync.win == SYNC_WIN_SLOW && abs(error) <= ADJUST_SLEW_MS) {
+				s32_t ppm = abs(error) > 1 ? -error * SYNC_PPM_PER_MS : 0;
+				if (ppm > ADJUST_DRIFT_PPM) ppm = ADJUST_DRIFT_PPM;
+				else if (ppm < -ADJUST_DRIFT_PPM) ppm = -ADJUST_DRIFT_PPM;
+				if (ppm != output.adjust_ppm) LOG_DEBUG("adjusting rate by %d ppm (delta:%d)", ppm, error);
+				output.adjust_ppm = ppm;
 			// wait till we have enough data or there is a strong deviation
-			if ((raop_sync.count >= raop_sync.win && abs(error) > 10) || (raop_sync.count >= SYNC_WIN_CHECK && abs(error) > 100)) {
+			} else if ((raop_sync.count >= raop_sync.win && abs(error) > 10) || (raop_sync.count >= SYNC_WIN_CHECK && abs(error) > 100)) {
 				if (error < 0) {
 					output.skip_frames = -(error * RAOP_SAMPLE_RATE) / 1000;
 					output.state = OUTPUT_SKIP_FRAMES;					
@@ -264,6 +272,7 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 				
 				raop_sync.sum = raop_sync.count = 0;
 				memset(raop_sync.errors, 0, sizeof(raop_sync.errors));
+				output.adjust_ppm = 0;
 			}	
 			
 			// move to normal mode if possible			
@@ -300,6 +309,7 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 			raop_sync.sum = raop_sync.count = 0;
 			memset(raop_sync.errors, 0, sizeof(raop_sync.errors));
 			raop_sync.enabled = !strcasestr(output.device, "BT");
+			_output_adjust_reset();
 			output.next_sample_rate = output.current_sample_rate = RAOP_SAMPLE_RATE;
 			break;
         case RAOP_STALLED:
@@ -313,6 +323,7 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 			if (output.state > OUTPUT_STOPPED) output.state = OUTPUT_STOPPED;
 			sink_state = SINK_ABORT;
 			output.frames_played = 0;
+			_output_adjust_reset();
 			output.stop_time = gettime_ms();
 			break;
 		case RAOP_PLAY: {
@@ -8,15 +8,18 @@
 
 #include <ctype.h>
 #include <math.h>
-#include "esp_dsp.h"
 #include "squeezelite.h"
 #include "slimproto.h"
+#include "platform_config.h"
+#include "spectrum.h"
 #include "display.h"
 #include "gds.h"
 #include "gds_text.h"
 #include "gds_draw.h"
 #include "gds_image.h"
 #include "led_vu.h"
+#include "esp_timer.h"
+#include "perf_counters.h"
 
 #pragma pack(push, 1)
 
@@ -133,6 +136,7 @@ static struct {
 	TaskHandle_t task;
 	int wake;
 	bool owned;	
+	perf_metric_t *perf_visu, *perf_refresh;
 	struct {
 		SemaphoreHandle_t mutex;		
 		int width, height;
@@ -146,8 +150,7 @@ static uint32_t *grayMap;
 #define SB_HEIGHT		32
 
 // lenght are number of frames, i.e. 2 channels of 16 bits
-#define	FFT_LEN_BIT	7		
-#define	FFT_LEN		(1 << FFT_LEN_BIT)
+#define	FFT_LEN		256
 #define RMS_LEN_BIT	6
 #define RMS_LEN		(1 << RMS_LEN_BIT)
 
@@ -210,7 +213,10 @@ static EXT_RAM_ATTR struct {
 static uint8_t* led_data;
 
 static EXT_RAM_ATTR struct {
-	float fft[FFT_LEN*2], samples[FFT_LEN*2], hanning[FFT_LEN];
+	struct spectrum_s *spectrum;
+	const float *power;
+	int len;
+	u32_t rate, next;
 	int levels[2];
 } meters;
 
@@ -365,9 +371,31 @@ bool sb_displayer_init(void) {
 	// inform LMS of our screen/led dimensions
 	sendSETD(GDS_GetWidth(display), GDS_GetHeight(display), led_visu.config);
 	
-	dsps_fft2r_init_fc32(meters.fft, FFT_LEN);
-	dsps_wind_hann_f32(meters.hanning, FFT_LEN);
+	// spectrum analyzer, real FFT of len points is a N/2 complex FFT
+	char *config = config_alloc_get_str("spectrum_config", NULL, ""), window[16] = "hann";
+	int len = FFT_LEN, overlap = 0, average = 0;
+	static const char *windows[] = { "hann", "hamming", "blackman", "rect" };
+	spectrum_window_t type = SPECTRUM_HANN;
+	
+	PARSE_PARAM(config, "len", '=', len);
+	PARSE_PARAM(config, "overlap", '=', overlap);
+	PARSE_PARAM(config, "average", '=', average);
+	PARSE_PARAM_STR(config, "window", '=', window, 15);
+	for (int i = 0; i < sizeof(windows) / sizeof(*windows); i++) if (!strncasecmp(window, windows[i], strlen(windows[i]))) type = i;
+	free(config);
+	
+	meters.spectrum = spectrum_create(len, type, overlap, average);
+	if (meters.spectrum) {
+		meters.len = spectrum_len(meters.spectrum);
+		meters.power = spectrum_reset(meters.spectrum);
+		LOG_INFO("spectrum of %d points, window %s, overlap %d%%, average %d%%", meters.len, windows[type], overlap, average);
+	} else {
+		LOG_ERROR("can't create spectrum analyzer");
+	}	
 		
+	displayer.perf_visu = perf_register("display.visu", PERF_HISTOGRAM, "us");
+	displayer.perf_refresh = perf_register("display.refresh", PERF_HISTOGRAM, "us");
+
 	// create displayer management task
 	displayer.mutex = xSemaphoreCreateMutex();
 	displayer.task = xTaskCreateStatic( (TaskFunction_t) displayer_task, "sb_displayer", SCROLL_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer);
@@ -677,8 +705,9 @@ void draw_VU(struct GDS_Device * display, int level, int x, int y, int width, bo
 	// restore base VU
 	memcpy(vu_bitmap + offset, vu_base + offset, sizeof(vu_arrow[level].data));
 	
-	// need to manually set dirty flag as DrawPixel does not do it
-	GDS_SetDirty(display);
+	// need to manually set dirty area as DrawPixel does not do it
+	if (rotate) GDS_SetDirtyArea(display, x, y, x + VU_HEIGHT - 1, y + width - 1);
+	else GDS_SetDirtyArea(display, x, y, x + width - 1, y + VU_HEIGHT - 1);
 }
 
 /****************************************************************************************
@@ -908,7 +937,7 @@ static void grfa_handler(u8_t *data, int len) {
 	if (artwork.size == length) {
 		GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
 		xSemaphoreTake(displayer.mutex, portMAX_DELAY);			
-		GDS_DrawJPEG(display, artwork.data, artwork.x, artwork.y, artwork.y < displayer.height ? (GDS_IMAGE_RIGHT | GDS_IMAGE_TOP) : GDS_IMAGE_CENTER);
+		GDS_DrawJPEGCached(display, NULL, artwork.data, length, artwork.x, artwork.y, artwork.y < displayer.height ? (GDS_IMAGE_RIGHT | GDS_IMAGE_TOP) : GDS_IMAGE_CENTER);
 		xSemaphoreGive(displayer.mutex);		
 		free(artwork.data);
 		artwork.data = NULL;
@@ -920,34 +949,38 @@ static void grfa_handler(u8_t *data, int len) {
 /****************************************************************************************
  * Fit spectrum into N bands and convert to dB
  */
-void spectrum_scale(int n, struct bar_s *bars, int max, float *samples) { 
+void spectrum_scale(int n, struct bar_s *bars, int max, const float *samples) { 
 	float rate = visu_export.rate;			
 	// now arrange the result with the number of bar and sampling rate (don't want DC)
-	for (int i = 0, j = 1; i < n && j < (FFT_LEN / 2); i++) {
+	int len = meters.len;
+	
+	if (!samples) return;
+	
+	for (int i = 0, j = 1; i < n && j < (len / 2); i++) {
 		float power, count;
 
 		// find the next point in FFT (this is real signal, so only half matters)
-		for (count = 0, power = 0; j * visu_export.rate < bars[i].limit * FFT_LEN && j < FFT_LEN / 2; j++, count += 1) {
-			power += samples[2*j] * samples[2*j] + samples[2*j+1] * samples[2*j+1];
+		for (count = 0, power = 0; j * visu_export.rate < bars[i].limit * len && j < len / 2; j++, count += 1) {
+			power += samples[j];
 		}
 		// due to sample rate, we have reached the end of the available spectrum
-		if (j >= (FFT_LEN / 2)) {
+		if (j >= (len / 2)) {
 			// normalize accumulated data
 			if (count) power /= count * 2.;
 		} else if (count) {
 			// how much of what remains do we need to add
-			float ratio = j - (bars[i].limit * FFT_LEN) / rate;
-			power += (samples[2*j] * samples[2*j] + samples[2*j+1] * samples[2*j+1]) * ratio;
+			float ratio = j - (bars[i].limit * len) / rate;
+			power += samples[j] * ratio;
 					
 			// normalize accumulated data
 			power /= (count + ratio) * 2;
 		} else {
 			// no data for that band (sampling rate too high), just assume same as previous one
-			power = (samples[2*j] * samples[2*j] + samples[2*j+1] * samples[2*j+1]) / 2.;
+			power = samples[j] / 2.;
 		}	
 			
 		// convert to dB and bars, same back-off
-		bars[i].current = max * (0.01667f*10*(log10f(0.0000001f + power) - log10f(FFT_LEN*(visu_export.gain == FIXED_ONE ? 256 : 2))) - 0.2543f);
+		bars[i].current = max * (0.01667f*10*(log10f(0.0000001f + power) - log10f(len*(visu_export.gain == FIXED_ONE ? 256 : 2))) - 0.2543f);
 		if (bars[i].current > max) bars[i].current = max;
 		else if (bars[i].current < 0) bars[i].current = 0;
 	}	
@@ -1034,16 +1067,24 @@ static void displayer_update(void) {
 	}	
 	
 	int mode = (visu.mode & ~VISU_ESP32) | led_visu.mode;
+	int used = 0;
+
+	// overlap history is only valid if frames follow the ones we used last time
+	if (meters.spectrum && visu_export.running && visu_export.frames != meters.next) spectrum_restart(meters.spectrum);
 				
 	// not enough frames
-	if (visu_export.level < (mode & VISU_SPECTRUM ? FFT_LEN : RMS_LEN) && visu_export.running) {
+	if (visu_export.level < (mode & VISU_SPECTRUM && meters.spectrum ? spectrum_need(meters.spectrum) : RMS_LEN) && visu_export.running) {
 		pthread_mutex_unlock(&visu_export.mutex);
 		return;
 	}
 	
 	// reset all levels no matter what
 	meters.levels[0] = meters.levels[1] = 0;
-	memset(meters.samples, 0, sizeof(meters.samples));	
+	if (meters.spectrum && (!visu_export.running || visu_export.rate != meters.rate)) {
+		// don't mix silence or sample rates in history
+		meters.power = spectrum_reset(meters.spectrum);
+		meters.rate = visu_export.rate;
+	}	
 	
 	if (visu_export.running) {
 		
@@ -1061,30 +1102,29 @@ static void displayer_update(void) {
 		}
 		
 		// calculate data for spectrum
-		if (mode & VISU_SPECTRUM) {
-			s16_t *iptr = (s16_t*) visu_export.buffer + (BYTES_PER_FRAME / 4) - 1;
+		if (mode & VISU_SPECTRUM && meters.spectrum) {
 			// on xtensa/esp32 the floating point FFT takes 1/2 cycles of the fixed point
-			for (int i = 0 ; i < FFT_LEN ; i++) {
-				// don't normalize here, but we are due INT16_MAX and FFT_LEN / 2 / 2
-				meters.samples[i * 2 + 0] = (float) (*iptr + *(iptr+BYTES_PER_FRAME/4)) * meters.hanning[i];
-				meters.samples[i * 2 + 1] = 0;
-				iptr += 2 * BYTES_PER_FRAME / 4;
-			}
-
-			// actual FFT that might be less cycle than all the crap below		
-			dsps_fft2r_fc32_ae32(meters.samples, FFT_LEN);
-			dsps_bit_rev_fc32_ansi(meters.samples, FFT_LEN);
+			s16_t *iptr = (s16_t*) visu_export.buffer + (BYTES_PER_FRAME / 4) - 1;
+			used = spectrum_need(meters.spectrum);
+			meters.power = spectrum_run(meters.spectrum, iptr, 2 * BYTES_PER_FRAME / 4);
+			meters.next = visu_export.frames + used;
 		}	
 		
 	} 
 		
-	// we took what we want, we can release the buffer
-	visu_export.level = 0;
+	// we took what we want, keep what follows so that next spectrum run has contiguous frames
+	if (used && used < visu_export.level) {
+		visu_export.level -= used;
+		visu_export.frames += used;
+		memmove(visu_export.buffer, (u8_t*) visu_export.buffer + used * BYTES_PER_FRAME, visu_export.level * BYTES_PER_FRAME);
+	} else {
+		visu_export.level = 0;
+	}	
 	pthread_mutex_unlock(&visu_export.mutex);
 
 	// actualize the display
 	if (visu.mode && !artwork.full) {
-		if (visu.mode & VISU_SPECTRUM) spectrum_scale(visu.n, visu.bars, visu.max, meters.samples);
+		if (visu.mode & VISU_SPECTRUM) spectrum_scale(visu.n, visu.bars, visu.max, meters.power);
 		else for (int i = 2; --i >= 0;) vu_scale(visu.bars, visu.max, meters.levels);
 		visu_draw();
 	}	
@@ -1096,7 +1136,7 @@ static void displayer_update(void) {
 			vu_scale(led_visu.bars, led_visu.gain, meters.levels);
 			led_vu_display(led_visu.bars[0].current, led_visu.bars[1].current, led_visu.max, led_visu.style);
 		} else if (led_visu.mode == VISU_SPECTRUM) { 
-			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.samples);
+			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.power);
 			uint8_t* p = (uint8_t*) led_data;
 			for (int i = 0; i < led_visu.n; i++) {
 				*p = led_visu.bars[i].current;
@@ -1104,7 +1144,7 @@ static void displayer_update(void) {
 			}
 			led_vu_spectrum(led_data, led_visu.max, led_visu.n, led_visu.style);
 		} else if (led_visu.mode == VISU_WAVEFORM) {
-			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.samples);
+			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.power);
 			led_vu_spin_dial(
 				led_visu.bars[led_visu.n-2].current,
 				led_visu.bars[(led_visu.n/2)+1].current * 50 / led_visu.max,
@@ -1387,13 +1427,18 @@ static void displayer_task(void *args) {
 
 		// update visu if active
 		if ((visu.mode || led_visu.mode) && displayer.wake <= 0 && displayer.owned) {
+			int64_t start = esp_timer_get_time();
 			displayer_update();
+			perf_set(displayer.perf_visu, esp_timer_get_time() - start);
 			displayer.wake = 100;
 		}
 		
 		// need to make sure we own display
-		if (display && displayer.owned) GDS_Update(display);
-		else if (!led_display) displayer.wake = LONG_WAKE;
+		if (display && displayer.owned) {
+			int64_t start = esp_timer_get_time();
+			GDS_Update(display);
+			perf_set(displayer.perf_refresh, esp_timer_get_time() - start);
+		} else if (!led_display) displayer.wake = LONG_WAKE;
 	
 		// release semaphore and sleep what's needed
 		xSemaphoreGive(displayer.mutex);
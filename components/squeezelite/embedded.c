@@ -16,6 +16,7 @@
 #include "esp_timer.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "monitor.h"
 #include "platform_config.h"
 #include "messaging.h"
@@ -61,16 +62,29 @@ _sig_func_ptr signal(int sig, _sig_func_ptr func) {
 void em_logprint(const char *fmt, ...) {
     va_list args;
 	va_start(args, fmt);
+#if LOG_DEFERRED
+	// go through the ring to stay in order with what is still there
+	log_ring_vprint(NULL, 0, fmt, args);
+	log_ring_wake();
+#else
 	vfprintf(stderr, fmt, args);    
+	fflush(stderr);
+#endif
+	va_end(args);
+	va_start(args, fmt);
     vmessaging_post_message(MESSAGING_ERROR, MESSAGING_CLASS_SYSTEM, fmt, args); 
 	va_end(args);
-	fflush(stderr);
 }
 
 void *audio_calloc(size_t nmemb, size_t size) {
 	return calloc(nmemb, size);
 }
 
+void *malloc_ext(size_t size) {
+	void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	return ptr ? ptr : malloc(size);
+}
+
 int	pthread_create_name(pthread_t *thread, _CONST pthread_attr_t  *attr, 
 				   void *(*start_routine)( void * ), void *arg, char *name) {
 	esp_pthread_cfg_t cfg = esp_pthread_get_default_config(); 
@@ -15,6 +15,7 @@
 		- gettime_ms
 		- BASE_CAP
 		- EXT_BSS 		
+		- ARENA_MALLOC
 	recommended to add platform specific include(s) here
 */	
 
@@ -51,6 +52,10 @@ extern u8_t custom_player_id;
 // to force some special buffer attribute
 #define EXT_BSS __attribute__((section(".ext_ram.bss"))) 
 
+// arena must be in external RAM
+void*		malloc_ext(size_t size);
+#define ARENA_MALLOC malloc_ext
+
 // otherwise just leave it empty
 void em_logprint(const char *fmt, ...);
 #define LOG_ERROR(fmt, ...) em_logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__); 
@@ -92,6 +97,7 @@ void set_name(char *name);		// can be defined as an empty macro
 extern struct visu_export_s {
 	pthread_mutex_t mutex;
 	u32_t level, size, rate, gain;
+	u32_t frames;		// output position of buffer's first frame, to detect gaps
 	void *buffer;
 	bool running;
 } visu_export;
@@ -12,23 +12,30 @@
 #include "platform_config.h"
 #include "squeezelite.h"
 #include "equalizer.h"
-#include "esp_equalizer.h"
+#include "biquad.h"
 
-#define EQ_BANDS 10
+#define EQ_BANDS 		10
+#define EQ_MAX_BANDS	16
 
 static log_level loglevel = lINFO;
 
+static const float default_freqs[EQ_BANDS] = { 31, 62, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+
 static EXT_RAM_ATTR struct {
-	void *handle;
-    float loudness, volume;
-    uint32_t samplerate;
+	struct biquad_s *handle;
+	float loudness, volume;
+	uint32_t samplerate;
+	int count;
+	struct biquad_band bands[EQ_MAX_BANDS];
+	float offset[EQ_MAX_BANDS];
 	int8_t gain[EQ_BANDS];
-	float loudness_gain[EQ_BANDS];
+	float loudness_gain[EQ_MAX_BANDS];
 	bool update;
 } equalizer;
 
 #define POLYNOME_COUNT 6
 
+// loudness envelopes are for default_freqs, other frequencies are interpolated
 static const float loudness_envelope_coefficients[EQ_BANDS][POLYNOME_COUNT] = {
  {5.5169301499257067e+001, 6.3671410796029004e-001,
   -4.2663226432095233e-002, 8.1063072336581246e-004,
@@ -65,26 +72,85 @@ static const float loudness_envelope_coefficients[EQ_BANDS][POLYNOME_COUNT] = {
  * calculate loudness gains
  */
 static void calculate_loudness(void) {
-    char trace[EQ_BANDS * 5 + 1];
-    size_t n = 0;
+	char trace[EQ_MAX_BANDS * 10 + 1];
+	float envelope[EQ_BANDS];
+	size_t n = 0;
+
+	// Horner's evaluation of each envelope for current volume
 	for (int i = 0; i < EQ_BANDS; i++) {
-		for (int j = 0; j < POLYNOME_COUNT && equalizer.loudness != 0; j++) {
-			equalizer.loudness_gain[i] +=
-				loudness_envelope_coefficients[i][j] * pow(equalizer.volume, j);
+		envelope[i] = 0;
+		for (int j = POLYNOME_COUNT - 1; j >= 0; j--) {
+			envelope[i] = envelope[i] * equalizer.volume + loudness_envelope_coefficients[i][j];
+		}
+	}
+
+	for (int i = 0; i < equalizer.count; i++) {
+		float freq = equalizer.bands[i].freq;
+		int k;
+
+		// bands are not necessarily the default ones, interpolate on a log scale
+		for (k = 0; k < EQ_BANDS - 2 && freq > default_freqs[k + 1]; k++);
+		float x = log2f(freq / default_freqs[k]) / log2f(default_freqs[k + 1] / default_freqs[k]);
+		x = x < 0 ? 0 : (x > 1 ? 1 : x);
+
+		equalizer.loudness_gain[i] = (envelope[k] + (envelope[k + 1] - envelope[k]) * x) * equalizer.loudness / 2;
+		n += sprintf(trace + n, "%.2g%c", equalizer.loudness_gain[i], i < equalizer.count - 1 ? ',' : '\0');
+	}
+
+	LOG_INFO("loudness %s", trace);
+}
+
+/****************************************************************************************
+ * parse optional custom bands as <freq>[:<q>[:<type>[:<gain>]]],...
+ */
+static void parse_bands(char *config) {
+	static const char *types[] = { "peak", "lowshelf", "highshelf", "lowpass", "highpass" };
+	char *band, *save;
+
+	equalizer.count = 0;
+
+	for (band = config ? strtok_r(config, ",", &save) : NULL; band && equalizer.count < EQ_MAX_BANDS; band = strtok_r(NULL, ",", &save)) {
+		struct biquad_band *p = equalizer.bands + equalizer.count;
+		char *item = strchr(band, ':');
+
+		p->freq = atof(band);
+		p->q = 1.41;
+		p->type = BIQUAD_PEAK;
+		equalizer.offset[equalizer.count] = 0;
+
+		if (item) {
+			p->q = atof(++item);
+			if ((item = strchr(item, ':')) != NULL) {
+				item++;
+				for (int i = 0; i < sizeof(types) / sizeof(*types); i++) {
+					if (!strncasecmp(item, types[i], strlen(types[i]))) p->type = i;
+				}
+				if ((item = strchr(item, ':')) != NULL) equalizer.offset[equalizer.count] = atof(++item);
+			}
+		}
+
+		if (p->freq > 0) equalizer.count++;
+	}
+
+	// no (valid) custom bands, use LMS's ones
+	if (!equalizer.count) {
+		for (int i = 0; i < EQ_BANDS; i++) {
+			equalizer.bands[i] = (struct biquad_band) { .type = BIQUAD_PEAK, .freq = default_freqs[i], .q = 1.41 };
+			equalizer.offset[i] = 0;
 		}
-		equalizer.loudness_gain[i] *= equalizer.loudness / 2;
-        n += sprintf(trace + n, "%.2g%c", equalizer.loudness_gain[i], i < EQ_BANDS ? ',' : '\0');
+		equalizer.count = EQ_BANDS;
 	}
-    LOG_INFO("loudness %s", trace);    
+
+	LOG_INFO("equalizer with %d bands", equalizer.count);
 }
 
 /****************************************************************************************
  * initialize equalizer
  */
 void equalizer_init(void) {
-    // handle equalizer
+	// handle equalizer
 	char *config = config_alloc_get(NVS_TYPE_STR, "equalizer");
-	char *p = strtok(config, ", !");
+	char *p = config ? strtok(config, ", !") : NULL;
 
 	for (int i = 0; p && i < EQ_BANDS; i++) {
 		equalizer.gain[i] = atoi(p);
@@ -93,11 +159,17 @@ void equalizer_init(void) {
 
 	free(config);
 
-    // handle loudness
-    config = config_alloc_get(NVS_TYPE_STR, "loudness");
-    equalizer.loudness = atof(config) / 10.0;
+	// handle custom bands
+	config = config_alloc_get(NVS_TYPE_STR, "eq_bands");
+	parse_bands(config);
+	free(config);
 
+	// handle loudness
+	config = config_alloc_get(NVS_TYPE_STR, "loudness");
+	equalizer.loudness = config ? atof(config) / 10.0 : 0;
 	free(config);
+
+	if (equalizer.loudness) calculate_loudness();
 }
 
 /****************************************************************************************
@@ -105,125 +177,112 @@ void equalizer_init(void) {
  */
 void equalizer_close(void) {
 	if (equalizer.handle) {
-		esp_equalizer_uninit(equalizer.handle);
+		biquad_destroy(equalizer.handle);
 		equalizer.handle = NULL;
 	}
+	// re-create on next use, even if sample rate does not change
+	equalizer.update = true;
 }
 
 /****************************************************************************************
  * change sample rate
  */
 void equalizer_set_samplerate(uint32_t samplerate) {
-#if BYTES_PER_FRAME == 4
-    if (equalizer.samplerate != samplerate) equalizer_close();
-    equalizer.samplerate = samplerate;
-    equalizer.update = true;
-
-    LOG_INFO("equalizer sample rate %u", samplerate);
-#else
-    LOG_INFO("no equalizer with 32 bits samples");
-#endif
+	if (equalizer.samplerate != samplerate) {
+		equalizer.samplerate = samplerate;
+		equalizer.update = true;
+		LOG_INFO("equalizer sample rate %u", samplerate);
+	}
 }
 
 /****************************************************************************************
  * get volume update and recalculate loudness according to
  */
 void equalizer_set_volume(unsigned left, unsigned right) {
-#if BYTES_PER_FRAME == 4
-    float volume = (left + right) / 2;
-    // do classic dB conversion and scale it 0..100
+	float volume = (left + right) / 2;
+	// do classic dB conversion and scale it 0..100
 	if (volume) volume = log2(volume);
 	volume = volume / 16.0 * 100.0;
-    
-    // LMS has the bad habit to send multiple volume commands
-    if (volume != equalizer.volume && equalizer.loudness) {
-        equalizer.volume = volume;
-        calculate_loudness();
-        equalizer.update = true;
-    }
-#endif
+
+	// LMS has the bad habit to send multiple volume commands
+	if (volume != equalizer.volume) {
+		equalizer.volume = volume;
+		if (equalizer.loudness) {
+			calculate_loudness();
+			equalizer.update = true;
+		}
+	}
 }
 
 /****************************************************************************************
  * change gains from LMS
  */
 void equalizer_set_gain(int8_t *gain) {
-#if BYTES_PER_FRAME == 4
-    char config[EQ_BANDS * 4 + 1] = { };
+	char config[EQ_BANDS * 4 + 1] = { };
 	int n = 0;
-    
-    if (memcmp(equalizer.gain, gain, EQ_BANDS) != 0) equalizer.update = true;
-    
-    for (int i = 0; i < EQ_BANDS; i++) {
+
+	if (memcmp(equalizer.gain, gain, EQ_BANDS) != 0) equalizer.update = true;
+
+	for (int i = 0; i < EQ_BANDS; i++) {
 		equalizer.gain[i] = gain[i];
 		n += sprintf(config + n, "%d,", gain[i]);
 	}
 
 	config[n-1] = '\0';
 	config_set_value(NVS_TYPE_STR, "equalizer", config);
-    
-    LOG_INFO("equalizer gain %s", config);
-#else
-    LOG_INFO("no equalizer with 32 bits samples");
-#endif
+
+	LOG_INFO("equalizer gain %s", config);
 }
 
 /****************************************************************************************
  * change loudness from LMS
  */
 void equalizer_set_loudness(uint8_t loudness) {
-#if BYTES_PER_FRAME == 4
-    char p[4];
-    itoa(loudness, p, 10);
-    config_set_value(NVS_TYPE_STR, "loudness", p);
-    
-    // update loudness gains as a factor of loudness and volume
-    if (equalizer.loudness != loudness / 10.0) {
-        equalizer.loudness = loudness / 10.0;
-        calculate_loudness();
-        equalizer.update = true;
-    }
-
-    LOG_INFO("loudness %u", (unsigned) loudness);
-#else
-    LOG_INFO("no equalizer with 32 bits samples");
-#endif
+	char p[4];
+	itoa(loudness, p, 10);
+	config_set_value(NVS_TYPE_STR, "loudness", p);
+
+	// update loudness gains as a factor of loudness and volume
+	if (equalizer.loudness != loudness / 10.0) {
+		equalizer.loudness = loudness / 10.0;
+		if (equalizer.loudness) calculate_loudness();
+		else memset(equalizer.loudness_gain, 0, sizeof(equalizer.loudness_gain));
+		equalizer.update = true;
+	}
+
+	LOG_INFO("loudness %u", (unsigned) loudness);
 }
 
 /****************************************************************************************
  * process equalizer
  */
 void equalizer_process(uint8_t *buf, uint32_t bytes) {
-#if BYTES_PER_FRAME == 4    
 	// don't want to process with output locked, so take the small risk to miss one parametric update
 	if (equalizer.update) {
-        equalizer.update = false;
-
-        if (equalizer.samplerate != 11025 && equalizer.samplerate != 22050 && equalizer.samplerate != 44100 && equalizer.samplerate != 48000) {
-            LOG_WARN("equalizer only supports 11025, 22050, 44100 and 48000 sample rates, not %u", equalizer.samplerate);
-            return;
-        }
+		struct biquad_band bands[EQ_MAX_BANDS];
+		equalizer.update = false;
 
-        if (!equalizer.handle && ((equalizer.handle = esp_equalizer_init(2, equalizer.samplerate, EQ_BANDS, 0)) == NULL)) {
-            LOG_WARN("can't init equalizer");
-            return;
-        }
+		if (!equalizer.handle && ((equalizer.handle = biquad_create(equalizer.count)) == NULL)) {
+			LOG_WARN("can't init equalizer");
+			return;
+		}
 
-		bool active = false;
-		for (int i = 0; i < EQ_BANDS; i++) {
-            float gain = equalizer.gain[i] + equalizer.loudness_gain[i];
-			esp_equalizer_set_band_value(equalizer.handle, gain, i, 0);
-			esp_equalizer_set_band_value(equalizer.handle, gain, i, 1);
-			active |= gain != 0;
+		// LMS gains go to the first bands, custom offsets on top
+		for (int i = 0; i < equalizer.count; i++) {
+			bands[i] = equalizer.bands[i];
+			bands[i].gain = (i < EQ_BANDS ? equalizer.gain[i] : 0) + equalizer.offset[i] + equalizer.loudness_gain[i];
 		}
 
-		// at the end do not activate equalizer if all gain are 0
-		if (!active) equalizer_close();
+		// cascade keeps running while it ramps down to flat, it only stops once all sections are identity
+		bool active = biquad_set(equalizer.handle, bands, equalizer.samplerate);
 		LOG_INFO("equalizer %s", active ? "actived" : "deactivated");
 	}
 
 	if (equalizer.handle) {
-		esp_equalizer_process(equalizer.handle, buf, bytes, equalizer.samplerate, 2);
+#if BYTES_PER_FRAME == 4
+		biquad_process_s16(equalizer.handle, (int16_t*) buf, bytes / BYTES_PER_FRAME);
+#else
+		biquad_process_s32(equalizer.handle, (int32_t*) buf, bytes / BYTES_PER_FRAME);
+#endif
 	}
-#endif    
-}
\ No newline at end of file
+}
@@ -614,8 +614,8 @@ static void helixaac_open(u8_t size, u8_t rate, u8_t chan, u8_t endianness) {
 		// always free decoder as flush only works when no parameter has changed
 		HAAC(a, FreeDecoder, a->hAac);			
 	} else {
-		a->write_buf = malloc(FRAME_BUF * 4);
-		a->wrap_buf = malloc(WRAPBUF_LEN);
+		a->write_buf = arena_alloc(FRAME_BUF * 4, &a->write_buf);
+		a->wrap_buf = arena_alloc(WRAPBUF_LEN, &a->wrap_buf);
 	}
 	
 	a->hAac = HAAC(a, InitDecoder);	
@@ -632,8 +632,9 @@ static void helixaac_close(void) {
 		free(a->stsc);
 		a->stsc = NULL;
 	}
-	free(a->write_buf);
-	free(a->wrap_buf);
+	arena_release(a->write_buf);
+	arena_release(a->wrap_buf);
+	a->write_buf = a->wrap_buf = NULL;
 }
 
 static bool load_helixaac() {
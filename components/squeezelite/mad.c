@@ -339,7 +339,7 @@ static decode_state mad_decode(void) {
 
 static void mad_open(u8_t size, u8_t rate, u8_t chan, u8_t endianness) {
 	if (!m->readbuf) {
-		m->readbuf = malloc(READBUF_SIZE + MAD_BUFFER_GUARD);
+		m->readbuf = arena_alloc(READBUF_SIZE + MAD_BUFFER_GUARD, &m->readbuf);
 	}
 	m->checktags = 1;
 	m->consume = 0;
@@ -356,7 +356,7 @@ static void mad_close(void) {
 	mad_synth_finish(&m->synth); // macro only in current version
 	MAD(m, frame_finish, &m->frame);
 	MAD(m, stream_finish, &m->stream);
-	free(m->readbuf);
+	arena_release(m->readbuf);
 	m->readbuf = NULL;
 }
 
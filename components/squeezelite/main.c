@@ -764,6 +764,10 @@ int squeezelite_main(int argc, char **argv) {
 	winsock_init();
 #endif
 
+	// all large buffers are carved from an arena allocated once
+	arena_init(log_stream, stream_buf_size + MAX_HEADER + ARENA_SCRATCH_SIZE +
+			   (output_buf_size == OUTPUTBUF_SIZE ? OUTPUTBUF_SIZE_CROSSFADE : output_buf_size));
+
 	stream_init(log_stream, stream_buf_size);
 
 #if EMBEDDED
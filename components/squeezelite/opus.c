@@ -369,7 +369,7 @@ static void opus_open(u8_t size, u8_t rate, u8_t chan, u8_t endianness) {
     if (u->decoder) OP(&gu, decoder_destroy, u->decoder);         
     u->decoder = NULL;
     
-	if (!u->overbuf) u->overbuf = malloc(MAX_OPUS_FRAMES * BYTES_PER_FRAME);
+	if (!u->overbuf) u->overbuf = arena_alloc(MAX_OPUS_FRAMES * BYTES_PER_FRAME, &u->overbuf);
     
     u->status = OGG_ID_HEADER;
 	u->overframes = 0;
@@ -383,7 +383,7 @@ static void opus_close(void) {
 	if (u->decoder) OP(&gu, decoder_destroy, u->decoder);
     u->decoder = NULL;
     
-	free(u->overbuf);
+	arena_release(u->overbuf);
     u->overbuf = NULL;
     
     OG(&go, stream_clear, &u->state);
@@ -149,6 +149,7 @@ frames_t _output_frames(frames_t avail) {
 				}
 				LOG_INFO("track start sample rate: %u replay_gain: %u", output.next_sample_rate, output.next_replay_gain);
 				output.frames_played = 0;
+				output.adjust_reported = 0;
 				output.track_started = true;
 				output.track_start_time = gettime_ms();
 				output.current_sample_rate = output.next_sample_rate;
@@ -356,11 +357,13 @@ void output_init_common(log_level level, const char *device, unsigned output_buf
 	output_buf_size = output_buf_size - (output_buf_size % BYTES_PER_FRAME);
 	LOG_DEBUG("outputbuf size: %u", output_buf_size);
 
-	buf_init(outputbuf, output_buf_size);
+	// with default size, reserve room so that crossfade resize can be done in place
+	buf_init(outputbuf, output_buf_size == OUTPUTBUF_SIZE ? OUTPUTBUF_SIZE_CROSSFADE : output_buf_size);
 	if (!outputbuf->buf) {
 		LOG_ERROR("unable to malloc output buffer");
 		exit(2);
 	}
+	_buf_resize(outputbuf, output_buf_size);
 
 	silencebuf = malloc(MAX_SILENCE_FRAMES * BYTES_PER_FRAME);
 	if (!silencebuf) {
@@ -455,6 +458,7 @@ void output_flush(void) {
 		output.delay_active = false;
 	}
 	output.frames_played = 0;
+	_output_adjust_reset();
 	UNLOCK;
 }
 
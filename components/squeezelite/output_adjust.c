@@ -0,0 +1,180 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+// Fine-grained playback rate adjustment
+
+#include "squeezelite.h"
+
+/*
+Instead of skipping or inserting silence to follow a master clock, the output
+device can slightly change the rate at which it consumes outputbuf. Blocks are
+resampled by a 4 points cubic (Catmull-Rom) Farrow interpolator whose step is
+1 + ppm: above 1, more frames are consumed than produced. Three frames of
+history are kept so blocks are continuous, which also means that the last
+two frames of a block are only played with the next one while adjusting.
+
+When there is nothing to adjust, blocks are passed through untouched. When
+adjustment stops, the fractional position is rounded to the nearest frame,
+which is not audible.
+
+Two sources drive the rate, a number of frames to absorb (from LMS's pause and
+skip commands) that is done at ADJUST_SLEW_PPM and a continuous correction in
+ppm (from AirPlay's timing) limited to ADJUST_DRIFT_PPM. Only errors up to
+ADJUST_SLEW_MS are slewed (it takes 20s at 500 ppm), larger ones are still
+skipped or padded with silence.
+*/
+
+#define HISTORY	3
+
+extern struct outputstate output;
+
+static struct {
+	bool active;
+	float pos;
+	ISAMPLE_T history[HISTORY * 2];
+} adjust;
+
+#if BYTES_PER_FRAME == 8
+#define SAMPLE_MAX 2147483520.0f
+#define SAMPLE_MIN -2147483648.0f
+#else
+#define SAMPLE_MAX 32767.0f
+#define SAMPLE_MIN -32768.0f
+#endif
+
+static inline ISAMPLE_T interpolate(float x0, float x1, float x2, float x3, float mu) {
+	float c1 = 0.5f * (x2 - x0);
+	float c2 = x0 - 2.5f * x1 + 2.0f * x2 - 0.5f * x3;
+	float c3 = 0.5f * (x3 - x0) + 1.5f * (x1 - x2);
+	float y = ((c3 * mu + c2) * mu + c1) * mu + x1;
+
+	if (y > SAMPLE_MAX) y = SAMPLE_MAX;
+	else if (y < SAMPLE_MIN) y = SAMPLE_MIN;
+	return (ISAMPLE_T) y;
+}
+
+// frame n of history followed by block
+static inline ISAMPLE_T *frame(ISAMPLE_T *in, int n) {
+	return n < HISTORY ? adjust.history + n * 2 : in + (n - HISTORY) * 2;
+}
+
+static void save_history(ISAMPLE_T *in, frames_t frames) {
+	if (frames >= HISTORY) {
+		memcpy(adjust.history, in + (frames - HISTORY) * 2, HISTORY * BYTES_PER_FRAME);
+	} else {
+		memmove(adjust.history, adjust.history + frames * 2, (HISTORY - frames) * BYTES_PER_FRAME);
+		memcpy(adjust.history + (HISTORY - frames) * 2, in, frames * BYTES_PER_FRAME);
+	}
+}
+
+/****************************************************************************************
+ * Current rate correction in ppm, >0 to consume outputbuf faster
+ */
+static s32_t adjust_ppm(void) {
+	if (!output.adjust || output.state != OUTPUT_RUNNING) return 0;
+	if (output.adjust_frames > 0) return ADJUST_SLEW_PPM;
+	if (output.adjust_frames < 0) return -ADJUST_SLEW_PPM;
+	return output.adjust_ppm;
+}
+
+/****************************************************************************************
+ * Adjust a block of frames, called without mutex. On return buf points either to the
+ * original block or to out (which must have room for ADJUST_MARGIN more frames)
+ */
+frames_t output_adjust(ISAMPLE_T **buf, frames_t frames, ISAMPLE_T *out) {
+	ISAMPLE_T *in = *buf, *optr = out;
+	s32_t ppm = adjust_ppm();
+	int last = HISTORY + frames;
+
+	if (!adjust.active && !ppm) {
+		save_history(in, frames);
+		return frames;
+	}
+
+	if (!adjust.active) {
+		// first frame of block is the next one to play
+		adjust.active = true;
+		adjust.pos = HISTORY;
+	}
+
+	if (ppm) {
+		float step = 1.0f + ppm * 1E-6f;
+
+		while ((int) adjust.pos + 2 < last) {
+			int n = (int) adjust.pos;
+			float mu = adjust.pos - n;
+			ISAMPLE_T *x0 = frame(in, n - 1), *x1 = frame(in, n), *x2 = frame(in, n + 1), *x3 = frame(in, n + 2);
+
+			*optr++ = interpolate(x0[0], x1[0], x2[0], x3[0], mu);
+			*optr++ = interpolate(x0[1], x1[1], x2[1], x3[1], mu);
+			adjust.pos += step;
+		}
+
+		adjust.pos -= frames;
+	} else {
+		// done, snap to nearest frame and flush what is left
+		for (int n = (int) (adjust.pos + 0.5f); n < last; n++) {
+			ISAMPLE_T *x = frame(in, n);
+			*optr++ = x[0];
+			*optr++ = x[1];
+		}
+
+		adjust.active = false;
+	}
+
+	save_history(in, frames);
+	*buf = out;
+
+	return (optr - out) / 2;
+}
+
+/****************************************************************************************
+ * Account for frames consumed minus frames played by output_adjust, with mutex locked
+ */
+void _output_adjusted(s32_t delta) {
+	s32_t part = 0, reported = 0;
+
+	if (!output.adjust_frames) return;
+
+	if (output.adjust_frames > 0 && delta > 0) part = min(delta, output.adjust_frames);
+	else if (output.adjust_frames < 0 && delta < 0) part = -min(-delta, -output.adjust_frames);
+
+	output.adjust_frames -= part;
+
+	// that part of the correction has already been counted in frames_played
+	if (output.adjust_reported > 0 && part > 0) reported = min(part, output.adjust_reported);
+	else if (output.adjust_reported < 0 && part < 0) reported = -min(-part, -output.adjust_reported);
+
+	output.adjust_reported -= reported;
+	output.frames_played -= reported;
+}
+
+/****************************************************************************************
+ * Absorb a skip (>0) or a pause (<0) by adjusting rate, with mutex locked. The correction
+ * is reported at once in frames_played, as if it was immediately done
+ */
+bool _output_slew(s32_t frames) {
+	if (!output.adjust || output.state != OUTPUT_RUNNING ||
+		abs(output.adjust_frames + frames) > ADJUST_SLEW_MS * (s32_t) output.current_sample_rate / 1000) {
+		return false;
+	}
+
+	output.adjust_frames += frames;
+	if (frames < 0 && (unsigned) -frames > output.frames_played) frames = -output.frames_played;
+	output.frames_played += frames;
+	output.adjust_reported += frames;
+
+	return true;
+}
+
+/****************************************************************************************
+ * Stop any adjustment, with mutex locked
+ */
+void _output_adjust_reset(void) {
+	output.adjust_frames = output.adjust_reported = output.adjust_ppm = 0;
+}
@@ -46,23 +46,10 @@ static uint32_t bt_idle_since;
 static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 								
-#define DECLARE_ALL_MIN_MAX \
-	DECLARE_MIN_MAX(req);\
-	DECLARE_MIN_MAX(rec);\
-	DECLARE_MIN_MAX(bt);\
-	DECLARE_MIN_MAX(under);\
-	DECLARE_MIN_MAX(stream_buf);\
-	DECLARE_MIN_MAX_DURATION(lock_out_time)								
-	
-#define RESET_ALL_MIN_MAX \
-	RESET_MIN_MAX(bt);	\
-	RESET_MIN_MAX(req);  \
-	RESET_MIN_MAX(rec);  \
-	RESET_MIN_MAX(under);  \
-	RESET_MIN_MAX(stream_buf); \
-	RESET_MIN_MAX_DURATION(lock_out_time)
-	
-DECLARE_ALL_MIN_MAX;	
+static struct {
+	perf_metric_t *req, *rec, *bt, *under, *stream_buf, *lock_out_time;
+} perf;
+
 
 /****************************************************************************************
  * Get inactivity callback
@@ -84,6 +71,13 @@ void output_init_bt(log_level level, char *device, unsigned output_buf_size, cha
     // even BT has a right to use led :-)
     led_blink(LED_GREEN, 200, 1000);
 
+	perf.req = perf_register("bt.requested", PERF_GAUGE, "bytes");
+	perf.rec = perf_register("bt.missing", PERF_GAUGE, "bytes");
+	perf.bt = perf_register("output.buffer", PERF_GAUGE, "bytes");
+	perf.under = perf_register("bt.underrun", PERF_GAUGE, "bytes");
+	perf.stream_buf = perf_register("stream.buffer", PERF_GAUGE, "bytes");
+	perf.lock_out_time = perf_register("output.buffering", PERF_HISTOGRAM, "us");
+
 	running = true;    
 	output.write_cb = &_write_frames;
 	hal_bluetooth_init(device);
@@ -118,11 +112,10 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
 		}
 
-		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-
 #if BYTES_PER_FRAME == 4
-		memcpy(btout + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		_apply_gain_to(outputbuf, btout + oframes * BYTES_PER_FRAME, out_frames, gainL, gainR, flags);
 #else
+		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
 	{
 		frames_t count = out_frames;
 		s32_t *_iptr = (s32_t*) outputbuf->readp;
@@ -165,11 +158,11 @@ int32_t output_bt_data(uint8_t *data, int32_t len) {
 
 	// This is how the BTC layer calculates the number of bytes to
 	// for us to send. (BTC_SBC_DEC_PCM_DATA_LEN * sizeof(OI_INT16) - availPcmBytes
-	SET_MIN_MAX(len,req);
+	perf_set(perf.req, len);
 	TIME_MEASUREMENT_START(start_timer);
 	
 	LOCK;	
-	SET_MIN_MAX_SIZED(_buf_used(outputbuf),bt,outputbuf->size);
+	perf_set_sized(perf.bt, _buf_used(outputbuf), outputbuf->size);
 	output.device_frames = 0; 
 	output.updated = gettime_ms();
 	output.frames_played_dmp = output.frames_played;
@@ -179,8 +172,8 @@ int32_t output_bt_data(uint8_t *data, int32_t len) {
 	
 	equalizer_process(data, oframes * BYTES_PER_FRAME);
 
-	SET_MIN_MAX(TIME_MEASUREMENT_GET(start_timer),lock_out_time);
-	SET_MIN_MAX((len-oframes*BYTES_PER_FRAME), rec);
+	perf_set(perf.lock_out_time, TIME_MEASUREMENT_GET(start_timer));
+	perf_set(perf.rec, len - oframes * BYTES_PER_FRAME);
 	TIME_MEASUREMENT_START(start_timer);
 
 	return oframes * BYTES_PER_FRAME;
@@ -195,13 +188,24 @@ void output_bt_tick(void) {
 	if (!running) return;
 	
 	LOCK_S;
-    SET_MIN_MAX_SIZED(_buf_used(streambuf), stream_buf, streambuf->size);
+    perf_set_sized(perf.stream_buf, _buf_used(streambuf), streambuf->size);
     UNLOCK_S;
 	
 	if (stats && lastTime <= gettime_ms() )
 	{
+		static perf_snapshot_t previous[6];
+		perf_snapshot_t stream_buf, bt, req, rec, under, lock_out_time;
+		
+		// don't reset, other users (perf command, status.json) expect cumulated metrics
+		perf_snapshot_delta(perf.stream_buf, &stream_buf, previous + 0);
+		perf_snapshot_delta(perf.bt, &bt, previous + 1);
+		perf_snapshot_delta(perf.req, &req, previous + 2);
+		perf_snapshot_delta(perf.rec, &rec, previous + 3);
+		perf_snapshot_delta(perf.under, &under, previous + 4);
+		perf_snapshot_delta(perf.lock_out_time, &lock_out_time, previous + 5);
+		
 		lastTime = gettime_ms() + STATS_REPORT_DELAY_MS;
-		LOG_INFO("Statistics over %u secs. " , STATS_REPORT_DELAY_MS/1000);
+		LOG_INFO("Statistics over %u secs (min/max since reset). " , STATS_REPORT_DELAY_MS/1000);
 		LOG_INFO("              +==========+==========+================+=====+================+");
 		LOG_INFO("              |      max |      min |        average | avg |          count |");
 		LOG_INFO("              |  (bytes) |  (bytes) |        (bytes) | pct |                |");
@@ -218,7 +222,6 @@ void output_bt_tick(void) {
 		LOG_INFO("              ==========+==========+===========+===========+  ");
 		LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("Out Buf Lock",lock_out_time));
 		LOG_INFO("              ==========+==========+===========+===========+");
-		RESET_ALL_MIN_MAX;
 	}	
 }	
 
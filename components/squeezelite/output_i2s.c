@@ -10,24 +10,23 @@
  */
  
 /* 
-Synchronisation is a bit of a hack with i2s. The esp32 driver is always
-full when it starts, so there is a delay of the total length of buffers.
-In other words, i2s_write blocks at first call, until at least one buffer
-has been written (it uses a queue with produce / consume).
-
-The first hack is to consume that length at the beginning of tracks when
-synchronization is active. It's about ~180ms @ 44.1kHz
-
-The second hack is that we never know exactly the number of frames in the 
-DMA buffers when we update the output.frames_played_dmp. We assume that
-after i2s_write, these buffers are always full so by measuring the gap
-between time after i2s_write and update of frames_played_dmp, we have a
-good idea of the error. 
-
-The third hack is when sample rate changes, buffers are reset and we also
-do the change too early, but can't do that exaclty at the right time. So 
-there might be a pop and a de-sync when sampling rate change happens. Not
-sure that using rate_delay would fix that
+Synchronisation with i2s. The esp32 driver is always full when it starts, 
+so there is a delay of the total length of buffers. In other words, i2s_write 
+blocks at first call, until at least one buffer has been written (it uses a 
+queue with produce / consume).
+
+We consume that length at the beginning of tracks when synchronization is 
+active. It's about ~180ms @ 44.1kHz
+
+To know how many frames are in the DMA buffers when we update the 
+output.frames_played_dmp, the driver posts an event every time a DMA buffer
+has been sent. A high priority task timestamps these events, so with the 
+count of frames written, we know exactly what is pending at a given time 
+(device_frames) within the few us of interrupt latency.
+
+When sample rate changes, buffers are reset, so we wait for frames at the 
+previous rate to be played before changing it. There might still be a pop
+and when synchronized, we discard the silence added by the reset.
 */
 
 #include "squeezelite.h"
@@ -48,12 +47,14 @@ sure that using rate_delay would fix that
 #include "accessors.h"
 #include "equalizer.h"
 #include "globdefs.h"
+#include "esp_timer.h"
 
 #define LOCK   mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
 
 #define FRAME_BLOCK MAX_SILENCE_FRAMES
-#define SPDIF_BLOCK	256
+// in SPDIF, each frame is 16 bytes so 450 frames are exactly 2 DMA buffers of 3600 bytes
+#define SPDIF_BLOCK	DMA_BUF_FRAMES_SPDIF
 
 /* we produce FRAME_BLOCK (2048) per loop of the i2s thread so it's better if they fit
  * inside a set of DMA buffer nicely, i.e. DMA_BUF_FRAMES * DMA_BUF_COUNT is a multiple 
@@ -72,20 +73,6 @@ sure that using rate_delay would fix that
 #define DMA_BUF_FRAMES_SPDIF	450
 #define DMA_BUF_COUNT_SPDIF     7
 
-#define DECLARE_ALL_MIN_MAX 	\
-	DECLARE_MIN_MAX(o); 		\
-	DECLARE_MIN_MAX(s); 		\
-	DECLARE_MIN_MAX(rec); 		\
-	DECLARE_MIN_MAX(i2s_time); 	\
-	DECLARE_MIN_MAX(buffering);
-
-#define RESET_ALL_MIN_MAX 		\
-	RESET_MIN_MAX(o); 			\
-	RESET_MIN_MAX(s); 			\
-	RESET_MIN_MAX(rec);	\
-	RESET_MIN_MAX(i2s_time);	\
-	RESET_MIN_MAX(buffering);
-	
 #define STATS_PERIOD_MS 5000
 static void (*pseudo_idle_chain)(uint32_t now);
 
@@ -109,27 +96,56 @@ static bool (*slimp_handler_chain)(u8_t *data, int len);
 static bool jack_mutes_amp;
 static bool running, isI2SStarted, ended;
 static i2s_config_t i2s_config;
-static u8_t *obuf;
+static u8_t *obuf, *abuf;
 static frames_t oframes;
+#if BUF_LOCKFREE
+// blocks of outputbuf held by _i2s_write_frames, copied once mutex is released
+#define MAX_COPIES	8
+static struct copy_s {
+	u8_t *src;
+	frames_t offset, frames;
+	s32_t gainL, gainR;
+	u8_t flags;
+	bool visu;
+	u32_t rate;
+} copies[MAX_COPIES];
+static int n_copies;
+#endif
 static struct {
 	bool enabled;
 	u8_t *buf;
+	u8_t frame, vu;
+	u16_t vucp[192];
 } spdif;
 static size_t dma_buf_frames;
+static struct {
+	QueueHandle_t queue;
+	TaskHandle_t task;
+	portMUX_TYPE mux;
+	u32_t block, rate;
+	s32_t pending;		// frames written and not played at stamp
+	int64_t stamp;		// time of last DMA buffer sent (us)
+} dma_clock = { .mux = portMUX_INITIALIZER_UNLOCKED };
 static TaskHandle_t output_i2s_task;
 static struct {
 	int gpio, active;
 } amp_control = { CONFIG_AMP_GPIO, CONFIG_AMP_GPIO_LEVEL },
   mute_control = { CONFIG_MUTE_GPIO, CONFIG_MUTE_GPIO_LEVEL };
 
-DECLARE_ALL_MIN_MAX;
+static struct {
+	perf_metric_t *o, *s, *rec, *i2s_time, *buffering;
+} perf;
 
 static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 static void output_thread_i2s(void *arg);
+static void dma_clock_task(void *arg);
+static void dma_clock_reset(u32_t rate);
+static s32_t dma_clock_pending(void);
 static void i2s_stats(uint32_t now);
 
 static void spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst);
+static void spdif_status(u32_t sample_rate);
 static void (*jack_handler_chain)(bool inserted);
 
 #define I2C_PORT	0
@@ -267,10 +283,14 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 	output.write_cb = &_i2s_write_frames;
 	
 	obuf = malloc(FRAME_BLOCK * BYTES_PER_FRAME);
-	if (!obuf) {
+	abuf = malloc((FRAME_BLOCK + ADJUST_MARGIN) * BYTES_PER_FRAME);
+	if (!obuf || !abuf) {
 		LOG_ERROR("Cannot allocate i2s buffer");
 		return;
 	}
+	
+	// we can follow a master clock by steering playback rate
+	output.adjust = true;
 		
 	running = true;
 
@@ -332,7 +352,7 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		// silence DAC output if sharing the same ws/bck
 		if (i2s_dac_pin.ws_io_num == i2s_spdif_pin.ws_io_num && i2s_dac_pin.bck_io_num == i2s_spdif_pin.bck_io_num)	silent_do = i2s_dac_pin.data_out_num;		
 		
-		res = i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, 0, NULL);
+		res = i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, DMA_BUF_COUNT_SPDIF, &dma_clock.queue);
 		res |= i2s_set_pin(CONFIG_I2S_NUM, &i2s_spdif_pin);
 		LOG_INFO("SPDIF using I2S bck:%d, ws:%d, do:%d", i2s_spdif_pin.bck_io_num, i2s_spdif_pin.ws_io_num, i2s_spdif_pin.data_out_num);
 	} else {
@@ -382,7 +402,7 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
         LOG_INFO("configuring MCLK on GPIO %d", i2s_dac_pin.mck_io_num);
 #endif    
        
-		res |= i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, 0, NULL);
+		res |= i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, DMA_BUF_COUNT, &dma_clock.queue);
 		res |= i2s_set_pin(CONFIG_I2S_NUM, &i2s_dac_pin);
         	
 		if (res == ESP_OK && mute_control.gpio >= 0) {
@@ -417,8 +437,13 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 	i2s_stop(CONFIG_I2S_NUM);
 	i2s_zero_dma_buffer(CONFIG_I2S_NUM);
 	isI2SStarted=false;
+	
+	// frames (not bytes) per DMA buffer
+	dma_clock.block = dma_buf_frames / i2s_config.dma_buf_count;
+	xTaskCreatePinnedToCore(dma_clock_task, "i2s_clock", 2048, NULL, CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 12, &dma_clock.task, 0);
     
     equalizer_set_samplerate(output.current_sample_rate);
+	if (spdif.enabled) spdif_status(output.current_sample_rate);
 	
 	adac->power(ADAC_STANDBY);
 
@@ -441,6 +466,13 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 	
 	adac->headset(jack_inserted_svc());	
     
+    // stats are always collected, but only printed on request (they are reset by perf -r)
+	perf.o = perf_register("output.buffer", PERF_GAUGE, "bytes");
+	perf.s = perf_register("stream.buffer", PERF_GAUGE, "bytes");
+	perf.rec = perf_register("output.frames", PERF_GAUGE, "frames");
+	perf.buffering = perf_register("output.buffering", PERF_HISTOGRAM, "us");
+	perf.i2s_time = perf_register("output.i2s_write", PERF_HISTOGRAM, "us");
+	
     // do we want stats
 	p = config_alloc_get_default(NVS_TYPE_STR, "stats", "n", 0);
 	if (p && (*p == '1' || *p == 'Y' || *p == 'y')) {
@@ -472,8 +504,12 @@ void output_close_i2s(void) {
 	
 	while (!ended) vTaskDelay(20 / portTICK_PERIOD_MS);
 	
+	// the clock task waits on driver's queue
+	if (dma_clock.task) vTaskDelete(dma_clock.task);
+	dma_clock.task = NULL;
 	i2s_driver_uninstall(CONFIG_I2S_NUM);
 	free(obuf);
+	free(abuf);
 	
 	equalizer_close();
 	
@@ -493,19 +529,39 @@ bool output_volume_i2s(unsigned left, unsigned right) {
  */
 static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
+	// don't update visu if we don't have enough data in buffer (500 ms)
+	bool visu = silence || _buf_used(outputbuf) >  BYTES_PER_FRAME * output.current_sample_rate / 2;
+
 	if (!silence) {
 		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
 			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
 		}
+
+#if BUF_LOCKFREE
+		// we are the only consumer, so hold that block and copy it once mutex is released
+		if (n_copies < MAX_COPIES) {
+			struct copy_s *copy = copies + n_copies++;
+			copy->src = outputbuf->readp;
+			copy->offset = oframes;
+			copy->frames = out_frames;
+			copy->gainL = gainL;
+			copy->gainR = gainR;
+			copy->flags = flags;
+			copy->visu = visu;
+			copy->rate = output.current_sample_rate;
+			_buf_hold(outputbuf, out_frames * BYTES_PER_FRAME);
+			oframes += out_frames;
+			return out_frames;
+		}
+#endif
 		
-		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-		memcpy(obuf + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		// gain is applied while copying to obuf, outputbuf is only read once
+		_apply_gain_to(outputbuf, obuf + oframes * BYTES_PER_FRAME, out_frames, gainL, gainR, flags);
 	} else {
 		memcpy(obuf + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
 	}
 
-	// don't update visu if we don't have enough data in buffer (500 ms)
-	if (silence || _buf_used(outputbuf) >  BYTES_PER_FRAME * output.current_sample_rate / 2) {
+	if (visu) {
 		output_visu_export(obuf + oframes * BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
 	}
 		
@@ -514,6 +570,24 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 	return out_frames;
 }
 
+#if BUF_LOCKFREE
+/****************************************************************************************
+ * Copy blocks held in outputbuf to obuf, without mutex
+ */
+static void _i2s_copy_frames(bool discard) {
+	for (int i = 0; i < n_copies && !discard; i++) {
+		u8_t *dst = obuf + copies[i].offset * BYTES_PER_FRAME;
+		apply_gain_copy(dst, copies[i].src, copies[i].frames, copies[i].gainL, copies[i].gainR, copies[i].flags);
+		if (copies[i].visu) {
+			output_visu_export(dst, copies[i].frames, copies[i].rate, false, (copies[i].gainL + copies[i].gainR) / 2);
+		}
+	}
+	
+	if (n_copies) buf_release(outputbuf);
+	n_copies = 0;
+}
+#endif
+
 /****************************************************************************************
  * Main output thread
  */
@@ -522,7 +596,8 @@ static void output_thread_i2s(void *arg) {
 	frames_t iframes = FRAME_BLOCK;
 	uint32_t timer_start = 0;
 	int discard = 0;
-	uint32_t fullness = gettime_ms();
+	s32_t adjusted = 0;
+	u32_t rate = output.current_sample_rate;
 	bool synced;
 	output_state state = OUTPUT_OFF - 1;
         
@@ -566,20 +641,25 @@ static void output_thread_i2s(void *arg) {
 			synced = false;
 		}
 					
+		_output_adjusted(adjusted);
+		adjusted = 0;
+		
 		oframes = 0;
 		output.updated = gettime_ms();
 		output.frames_played_dmp = output.frames_played;
-		// try to estimate how much we have consumed from the DMA buffer (calculation is incorrect at the very beginning ...)
-		output.device_frames = dma_buf_frames - ((output.updated - fullness) * output.current_sample_rate) / 1000;
+		// what is still in the DMA buffers at that time (includes silence)
+		output.device_frames = isI2SStarted ? dma_clock_pending() : 0;
+		// frames we are about to get are at that rate, even if a new track starts in this block
+		rate = output.current_sample_rate;
         // we'll try to produce iframes if we have any, but we might return less if outpuf does not have enough
 		_output_frames( iframes );
 		// oframes must be a global updated by the write callback
 		output.frames_in_process = oframes;
               						
-		SET_MIN_MAX_SIZED(oframes,rec,iframes);
-		SET_MIN_MAX_SIZED(_buf_used(outputbuf),o,outputbuf->size);
-		SET_MIN_MAX_SIZED(_buf_used(streambuf),s,streambuf->size);
-		SET_MIN_MAX( TIME_MEASUREMENT_GET(timer_start),buffering);
+		perf_set_sized(perf.rec, oframes, iframes);
+		perf_set_sized(perf.o, _buf_used(outputbuf), outputbuf->size);
+		perf_set_sized(perf.s, _buf_used(streambuf), streambuf->size);
+		perf_set(perf.buffering, TIME_MEASUREMENT_GET(timer_start));
 		
 		/* must skip first whatever is in the pipe (but not when resuming). 
 		This test is incorrect when we pause a track that has just started, 
@@ -591,10 +671,23 @@ static void output_thread_i2s(void *arg) {
             discard -= min(oframes, discard);
             iframes = discard ? min(FRAME_BLOCK, discard) : FRAME_BLOCK;
 			UNLOCK;
+#if BUF_LOCKFREE
+			_i2s_copy_frames(true);
+#endif
 			continue;
 		}
 
 		UNLOCK;
+
+#if BUF_LOCKFREE
+		// gain and copy to obuf while decoder can write in outputbuf
+		_i2s_copy_frames(false);
+#endif
+		
+		// steer playback rate when synchronizing, this might change the number of frames
+		u8_t *wbuf = obuf;
+		frames_t wframes = output_adjust((ISAMPLE_T**) &wbuf, oframes, (ISAMPLE_T*) abuf);
+		adjusted = (s32_t) oframes - (s32_t) wframes;
 				
 		// now send all the data
 		TIME_MEASUREMENT_START(timer_start);
@@ -604,57 +697,60 @@ static void output_thread_i2s(void *arg) {
 			LOG_INFO("Restarting I2S.");
 			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
 			i2s_start(CONFIG_I2S_NUM);
+			dma_clock_reset(i2s_config.sample_rate);
 			adac->power(ADAC_ON);	
             if (spdif.enabled) spdif_convert(NULL, 0, NULL);
 		} 
 
-		// this does not work well as set_sample_rates resets the fifos (and it's too early)
-		if (i2s_config.sample_rate != output.current_sample_rate) {
-			LOG_INFO("changing sampling rate %u to %u", i2s_config.sample_rate, output.current_sample_rate);
-			if (synced) {
-			/* 				
-				//  can sleep for a buffer_queue - 1 and then eat a buffer (discard) if we are synced
-				usleep(((DMA_BUF_COUNT - 1) * DMA_BUF_LEN * BYTES_PER_FRAME * 1000) / 44100 * 1000);
-				discard = DMA_BUF_COUNT * DMA_BUF_LEN * BYTES_PER_FRAME;
-			*/		
-			}	
-			i2s_config.sample_rate = output.current_sample_rate;
+		// set_sample_rates resets the fifos, so let frames at previous rate be played first
+		if (i2s_config.sample_rate != rate) {
+			s32_t pending = dma_clock_pending();
+			LOG_INFO("changing sampling rate %u to %u (pending %d)", i2s_config.sample_rate, rate, pending);
+			if (pending) usleep((u64_t) pending * 1000000 / i2s_config.sample_rate);
+			i2s_config.sample_rate = rate;
 			i2s_set_sample_rates(CONFIG_I2S_NUM, spdif.enabled ? i2s_config.sample_rate * 2 : i2s_config.sample_rate);
 			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
+			dma_clock_reset(i2s_config.sample_rate);
+			// buffers are full of silence now, eat that amount of frames to stay in sync
+			if (synced) discard = dma_buf_frames;
 
-            equalizer_set_samplerate(output.current_sample_rate);
+            equalizer_set_samplerate(rate);
+			if (spdif.enabled) spdif_status(rate);
 		}
 		
 		// run equalizer
-		equalizer_process(obuf, oframes * BYTES_PER_FRAME);
+		equalizer_process(wbuf, wframes * BYTES_PER_FRAME);
 
 		// we assume that here we have been able to entirely fill the DMA buffers
 		if (spdif.enabled) {
 			size_t obytes, count = 0;
 			bytes = 0;
-			// need IRAM for speed but can't allocate a FRAME_BLOCK * 16, so process by smaller chunks
-			while (count < oframes) {
-				size_t chunk = min(SPDIF_BLOCK, oframes - count);
-                spdif_convert((ISAMPLE_T*) obuf + count * 2, chunk, (u32_t*) spdif.buf);              
+			// need IRAM for speed but can't allocate a FRAME_BLOCK * 16, so process by chunks of DMA buffers
+			while (count < wframes) {
+				size_t chunk = min(SPDIF_BLOCK, wframes - count);
+                spdif_convert((ISAMPLE_T*) wbuf + count * 2, chunk, (u32_t*) spdif.buf);              
 				i2s_write(CONFIG_I2S_NUM, spdif.buf, chunk * 16, &obytes, portMAX_DELAY);
 				bytes += obytes / (16 / BYTES_PER_FRAME);
 				count += chunk;
 			}
 #if BYTES_PER_FRAME == 4		
 		} else if (i2s_config.bits_per_sample == 32) {  
-			i2s_write_expand(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, 16, 32, &bytes, portMAX_DELAY);
+			i2s_write_expand(CONFIG_I2S_NUM, wbuf, wframes * BYTES_PER_FRAME, 16, 32, &bytes, portMAX_DELAY);
 #endif			
 		} else {
-			i2s_write(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, &bytes, portMAX_DELAY);
+			i2s_write(CONFIG_I2S_NUM, wbuf, wframes * BYTES_PER_FRAME, &bytes, portMAX_DELAY);
 		}
 
-		fullness = gettime_ms();
+		// count audio frames (in SPDIF, bytes have already been scaled back from DMA's 16 bytes per frame)
+		portENTER_CRITICAL(&dma_clock.mux);
+		dma_clock.pending += bytes / BYTES_PER_FRAME;
+		portEXIT_CRITICAL(&dma_clock.mux);
 
-		if (bytes != oframes * BYTES_PER_FRAME) {
-			LOG_WARN("I2S DMA Overflow! available bytes: %d, I2S wrote %d bytes", oframes * BYTES_PER_FRAME, bytes);
+		if (bytes != wframes * BYTES_PER_FRAME) {
+			LOG_WARN("I2S DMA Overflow! available bytes: %d, I2S wrote %d bytes", wframes * BYTES_PER_FRAME, bytes);
 		}
 		
-		SET_MIN_MAX( TIME_MEASUREMENT_GET(timer_start),i2s_time);
+		perf_set(perf.i2s_time, TIME_MEASUREMENT_GET(timer_start));
 		
 	}
 
@@ -664,11 +760,56 @@ static void output_thread_i2s(void *arg) {
 	vTaskDelete(NULL);	
 }
 
+/****************************************************************************************
+ * DMA clock task, timestamps DMA buffers when they have been sent
+ */
+static void dma_clock_task(void *arg) {
+	i2s_event_t event;
+
+	while (1) {
+		if (xQueueReceive(dma_clock.queue, &event, portMAX_DELAY) != pdTRUE || event.type != I2S_EVENT_TX_DONE) continue;
+		int64_t now = esp_timer_get_time();
+		portENTER_CRITICAL(&dma_clock.mux);
+		// when we don't write fast enough, DMA sends silence
+		dma_clock.pending = dma_clock.pending > dma_clock.block ? dma_clock.pending - dma_clock.block : 0;
+		dma_clock.stamp = now;
+		portEXIT_CRITICAL(&dma_clock.mux);
+	}
+}
+
+/****************************************************************************************
+ * Reset DMA clock when buffers have been zeroed and DMA (re)started
+ */
+static void dma_clock_reset(u32_t rate) {
+	xQueueReset(dma_clock.queue);
+	portENTER_CRITICAL(&dma_clock.mux);
+	dma_clock.pending = dma_buf_frames;
+	dma_clock.rate = rate;
+	dma_clock.stamp = esp_timer_get_time();
+	portEXIT_CRITICAL(&dma_clock.mux);
+}
+
+/****************************************************************************************
+ * Frames written in DMA buffers and not played yet
+ */
+static s32_t dma_clock_pending(void) {
+	portENTER_CRITICAL(&dma_clock.mux);
+	s32_t pending = dma_clock.pending;
+	int64_t elapsed = esp_timer_get_time() - dma_clock.stamp;
+	portEXIT_CRITICAL(&dma_clock.mux);
+
+	// we can't have played more than one buffer since it was timestamped
+	elapsed = min(elapsed * dma_clock.rate / 1000000, dma_clock.block);
+	return pending > elapsed ? pending - elapsed : 0;
+}
+
 /****************************************************************************************
  * stats output callback
  */
 static void i2s_stats(uint32_t now) {
     static uint32_t last;
+	static perf_snapshot_t previous[5];
+	perf_snapshot_t o, s, rec, i2s_time, buffering;
     
     // first chain to next handler
     if (pseudo_idle_chain) pseudo_idle_chain(now);
@@ -677,6 +818,13 @@ static void i2s_stats(uint32_t now) {
     if (output.state <= OUTPUT_STOPPED || now < last + STATS_PERIOD_MS) return;  
     last = now;
 
+	// don't reset, other users (perf command, status.json) expect cumulated metrics
+	perf_snapshot_delta(perf.o, &o, previous + 0);
+	perf_snapshot_delta(perf.s, &s, previous + 1);
+	perf_snapshot_delta(perf.rec, &rec, previous + 2);
+	perf_snapshot_delta(perf.i2s_time, &i2s_time, previous + 3);
+	perf_snapshot_delta(perf.buffering, &buffering, previous + 4);
+
 	LOG_INFO( "Output State: %d, current sample rate: %d, bytes per frame: %d", output.state, output.current_sample_rate, BYTES_PER_FRAME);
 	LOG_INFO( LINE_MIN_MAX_FORMAT_HEAD1);
 	LOG_INFO( LINE_MIN_MAX_FORMAT_HEAD2);
@@ -694,7 +842,6 @@ static void i2s_stats(uint32_t now) {
 	LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("Buffering(us)",buffering));
 	LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("i2s tfr(us)",i2s_time));
 	LOG_INFO("              ----------+----------+-----------+-----------+");
-	RESET_ALL_MIN_MAX;
 }
 
 /****************************************************************************************
@@ -704,8 +851,6 @@ static void i2s_stats(uint32_t now) {
 #define PREAMBLE_M  (0xE2) //11100010
 #define PREAMBLE_W  (0xE4) //11100100
 
-static const u8_t VUCP24[2] = { 0xCC, 0x32 };
-
 static const u16_t spdif_bmclookup[256] = {
 	0xcccc, 0xb333, 0xd333, 0xaccc, 0xcb33, 0xb4cc, 0xd4cc, 0xab33, 
 	0xcd33, 0xb2cc, 0xd2cc, 0xad33, 0xcacc, 0xb533, 0xd533, 0xaacc, 
@@ -747,76 +892,102 @@ static const u16_t spdif_bmclookup[256] = {
     BLFMRF MLFWRF MLFWRF BLFMRF (B,M,W=preamble-4, L/R=left/Right-24, F=Flags-4)
     each xLF pattern is 32 bits 
 	PPPP AAAA  SSSS SSSS  SSSS SSSS  SSSS VUCP (P=preamble, A=auxiliary, S=sample-20bits, V=valid, U=user data, C=channel status, P=parity)
- After BMC encoding, each bit becomes 2 hence this becomes a 64 bits word. The parity
- is fixed by changing AAAA bits so that VUPC does not change. Then then trick is to 
- start not with a PPPP sequence but with an VUCP sequence to that the 16 bits samples
- are aligned with a BMC word boundary. Input buffer is left first => LRLR...
+ After BMC encoding, each bit becomes 2 hence this becomes a 64 bits word. The trick
+ is to start not with a PPPP sequence but with an VUCP sequence to that the 16 bits 
+ samples are aligned with a BMC word boundary. Input buffer is left first => LRLR...
  The I2S interface must output first the B/M/W preamble which means that second
  32 bits words must be first and so must be marked right channel. 
+ Each 16 bits half of a sample is encoded into one 32 bits word. The BMC table
+ assumes previous level was low, so a word is inverted if what precedes ended high.
+ Because each BMC cell starts with a transition, level at the end of the sample 
+ is the parity of its ones, so VUCP (incl. P) is just a function of C and that 
+ level. These are precomputed for the 192 frames of the channel status block.
 */
-static void IRAM_ATTR spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst) {
-    static u8_t vu, count;    
-	register u16_t hi, lo;
-#if BYTES_PER_FRAME == 8
-	register u16_t aux;
-#endif
-    
-    // we assume frame == 0 as well...
-    if (!src) {
-        count = 0;
-        vu = VUCP24[0];
-    }
-    
-	while (frames--) {
-		// start with left channel
-#if BYTES_PER_FRAME == 4		
-		hi = spdif_bmclookup[(u8_t)(*src >> 8)];
-		lo = spdif_bmclookup[(u8_t)*src++];
-		if (lo & 1) hi = ~hi;
 
-        if (!count--) {            
-			*dst++ = (vu << 24) | (PREAMBLE_B << 16) | 0xCCCC;
-			count = 191;
-		} else {
-			*dst++ = (vu << 24) | (PREAMBLE_M << 16) | 0xCCCC;
-		}
+// BMC of VUCP indexed by C bit and by level before VUCP 
+static const u8_t VUCP24[2][2] = { { 0xCC, 0x32 }, { 0xCA, 0x34 } };
+
+/****************************************************************************************
+ * Build the 192 bits consumer channel status block (IEC 60958-3)
+ */
+static void spdif_status(u32_t sample_rate) {
+	u8_t status[192 / 8] = { 0 };
+
+	// byte 0 (consumer, PCM, emphasis none) with copy permitted
+	status[0] = 0x04;
+	// byte 3: sample rate on bits 24..27 (bit 24 first)
+	switch (sample_rate) {
+	case 22050: status[3] = 0x04; break;
+	case 24000: status[3] = 0x06; break;
+	case 32000: status[3] = 0x03; break;
+	case 48000: status[3] = 0x02; break;
+	case 88200: status[3] = 0x08; break;
+	case 96000: status[3] = 0x0a; break;
+	case 176400: status[3] = 0x0c; break;
+	case 192000: status[3] = 0x0e; break;
+	case 44100: default: status[3] = 0x00; break;
+	}	
+	// byte 4: word length, 16 bits (max 20) or 24 bits (max 24)
+#if BYTES_PER_FRAME == 4
+	status[4] = 0x02;
 #else
-		hi = spdif_bmclookup[(u8_t)(*src >> 24)];
-		lo = spdif_bmclookup[(u8_t)(*src >> 16)];
-		aux = spdif_bmclookup[(u8_t)(*src++ >> 8)];
-		if (aux & 1) lo = ~lo;
-		if (lo & 1) hi = ~hi;
+	status[4] = 0x0b;
+#endif
 
+	for (int i = 0; i < 192; i++) {
+		u8_t c = (status[i / 8] >> (i % 8)) & 0x01;
+		spdif.vucp[i] = VUCP24[c][0] | (VUCP24[c][1] << 8);
+	}
 
-        if (!count--) {
-			*dst++ = (vu << 24) | (PREAMBLE_B << 16) | aux;
-			count = 191;
-		} else {
-			*dst++ = (vu << 24) | (PREAMBLE_M << 16) | aux;
-		}
+	LOG_INFO("SPDIF channel status for %u Hz", sample_rate);
+}
+
+static inline u32_t IRAM_ATTR spdif_bmc16(u16_t sample, u32_t level) {
+	u32_t lo = spdif_bmclookup[(u8_t) sample] ^ (-level & 0xffff);
+	u32_t hi = spdif_bmclookup[sample >> 8] ^ (-(lo & 1) & 0xffff);
+	return (lo << 16) | hi;
+}
+
+static void IRAM_ATTR spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst) {
+	u32_t frame = spdif.frame, vu = spdif.vu, word;
+#if BYTES_PER_FRAME == 8
+	u32_t aux;
 #endif
 
-        vu = VUCP24[hi & 1];
-		*dst++ = ((u32_t)lo << 16) | hi;
+	// reset at start of block, previous VUCP is frame 191 with level low
+	if (!src) {
+		spdif.frame = 0;
+		spdif.vu = (u8_t) spdif.vucp[191];
+		return;
+	}
+    
+	while (frames--) {
+		u32_t vucp = spdif.vucp[frame];
+		u32_t preamble = frame ? PREAMBLE_M : PREAMBLE_B;
+		if (++frame == 192) frame = 0;
 
-		// then do right channel, no need to check PREAMBLE_B
+		// left channel then right one (no B preamble) 
 #if BYTES_PER_FRAME == 4		
-		hi = spdif_bmclookup[(u8_t)(*src >> 8)];
-		lo = spdif_bmclookup[(u8_t)*src++];
-		if (lo & 1) hi = ~hi;
+		*dst++ = (vu << 24) | (preamble << 16) | 0xCCCC;
+		*dst++ = word = spdif_bmc16(*src++, 0);
+		vu = (u8_t) (vucp >> ((word & 1) << 3));
 
 		*dst++ = (vu << 24) | (PREAMBLE_W << 16) | 0xCCCC;
+		*dst++ = word = spdif_bmc16(*src++, 0);
+		vu = (u8_t) (vucp >> ((word & 1) << 3));
 #else
-		hi = spdif_bmclookup[(u8_t)(*src >> 24)];
-		lo = spdif_bmclookup[(u8_t)(*src >> 16)];
-		aux = spdif_bmclookup[(u8_t)(*src++ >> 8)];
-		if (aux & 1) lo = ~lo;
-		if (lo & 1) hi = ~hi;
+		aux = spdif_bmclookup[(u8_t)(*src >> 8)];
+		*dst++ = (vu << 24) | (preamble << 16) | aux;
+		*dst++ = word = spdif_bmc16(*src++ >> 16, aux & 1);
+		vu = (u8_t) (vucp >> ((word & 1) << 3));
 
+		aux = spdif_bmclookup[(u8_t)(*src >> 8)];
 		*dst++ = (vu << 24) | (PREAMBLE_W << 16) | aux;
+		*dst++ = word = spdif_bmc16(*src++ >> 16, aux & 1);
+		vu = (u8_t) (vucp >> ((word & 1) << 3));
 #endif
-
-        vu = VUCP24[hi & 1];
-		*dst++ = ((u32_t)lo << 16) | hi;
 	}
+
+	spdif.frame = frame;
+	spdif.vu = vu;
 }
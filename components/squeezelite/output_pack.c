@@ -23,6 +23,14 @@
 
 #include "squeezelite.h"
 
+#if EMBEDDED && BYTES_PER_FRAME == 4
+#include "sdkconfig.h"
+#if CONFIG_DSP_OPTIMIZED
+#include "esp_dsp.h"
+#define NATIVE_PACK 1
+#endif
+#endif
+
 #define MAX_SCALESAMPLE 0x7fffffffffffLL
 #define MIN_SCALESAMPLE -MAX_SCALESAMPLE
 
@@ -43,6 +51,130 @@ s32_t to_gain(float f) {
 	return (s32_t)(f * 65536.0F);
 }
 
+/*
+Block kernels on interleaved stereo ISAMPLE_T, called on runs that never cross
+the buffer wrap. Gain and mono kernels read src and write dst, which can be the
+same so they work in place or fuse gain with the copy to the output device.
+Gain is Q16 and can be above FIXED_ONE (replay gain) or negative (polarity
+inversion), but in the common case -FIXED_ONE < gain <= FIXED_ONE the product
+can't overflow so saturation is decided once per block, not per sample.
+Reference kernels use gain() per sample and are kept to validate the others.
+*/
+
+#define GAIN_SAFE(g)	((g) > -FIXED_ONE && (g) <= FIXED_ONE)
+#define MUL16(g, s)		((s32_t)(g) * (s) >> 16)
+#define MUL32(g, s)		((s32_t)(((s64_t)(g) * (s)) >> 16))
+
+static inline s16_t sat16(s32_t v) {
+	return v > 0x7fff ? 0x7fff : (v < -0x8000 ? -0x8000 : v);
+}
+
+static void gain_s32(s32_t *dst, s32_t *src, frames_t frames, s32_t gainL, s32_t gainR) {
+	if (GAIN_SAFE(gainL) && GAIN_SAFE(gainR)) {
+		while (frames--) {
+			*dst++ = MUL32(gainL, *src); src++;
+			*dst++ = MUL32(gainR, *src); src++;
+		}
+	} else {
+		while (frames--) {
+			*dst++ = gain(gainL, *src); src++;
+			*dst++ = gain(gainR, *src); src++;
+		}
+	}
+}
+
+#if BYTES_PER_FRAME == 4
+#define MUL(g, s)	MUL16(g, s)
+#define SAT(v)		sat16(v)
+#define AVG(a, b)	(((a) + (b)) / 2)
+
+static void gain_portable(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR) {
+	if (GAIN_SAFE(gainL) && GAIN_SAFE(gainR)) {
+		while (frames--) {
+			*dst++ = MUL16(gainL, *src); src++;
+			*dst++ = MUL16(gainR, *src); src++;
+		}
+	} else {
+		while (frames--) {
+			*dst++ = sat16(gain(gainL, *src)); src++;
+			*dst++ = sat16(gain(gainR, *src)); src++;
+		}
+	}
+}
+#else
+#define MUL(g, s)	MUL32(g, s)
+#define SAT(v)		(v)
+#define AVG(a, b)	((s32_t)(((s64_t)(a) + (b)) / 2))
+#define gain_portable gain_s32
+#endif
+
+static void gain_reference(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR) {
+	while (frames--) {
+		*dst++ = SAT(gain(gainL, *src)); src++;
+		*dst++ = SAT(gain(gainR, *src)); src++;
+	}
+}
+
+static void mono_reference(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR, u8_t flags) {
+	if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+		for (; frames--; dst += 2, src += 2) dst[0] = dst[1] = SAT(AVG(gain(gainL, src[0]), gain(gainR, src[1])));
+	} else if (flags & MONO_RIGHT) {
+		for (; frames--; dst += 2, src += 2) dst[0] = dst[1] = SAT(gain(gainR, src[1]));
+	} else {
+		for (; frames--; dst += 2, src += 2) dst[0] = dst[1] = SAT(gain(gainL, src[0]));
+	}
+}
+
+static void mono_portable(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR, u8_t flags) {
+	if (!GAIN_SAFE(gainL) || !GAIN_SAFE(gainR)) {
+		mono_reference(dst, src, frames, gainL, gainR, flags);
+	} else if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
+		for (; frames--; dst += 2, src += 2) dst[0] = dst[1] = AVG(MUL(gainL, src[0]), MUL(gainR, src[1]));
+	} else if (flags & MONO_RIGHT) {
+		for (; frames--; dst += 2, src += 2) dst[0] = dst[1] = MUL(gainR, src[1]);
+	} else {
+		for (; frames--; dst += 2, src += 2) dst[0] = dst[1] = MUL(gainL, src[0]);
+	}
+}
+
+static void cross_reference(ISAMPLE_T *ptr, ISAMPLE_T *in, frames_t frames, s32_t gain_out, s32_t gain_in) {
+	for (frames *= 2; frames--; ptr++, in++) *ptr = SAT(gain(gain_out, *ptr) + gain(gain_in, *in));
+}
+
+static void cross_portable(ISAMPLE_T *ptr, ISAMPLE_T *in, frames_t frames, s32_t gain_out, s32_t gain_in) {
+	if (GAIN_SAFE(gain_out) && GAIN_SAFE(gain_in)) {
+		for (frames *= 2; frames--; ptr++, in++) *ptr = SAT(MUL(gain_out, *ptr) + MUL(gain_in, *in));
+	} else {
+		cross_reference(ptr, in, frames, gain_out, gain_in);
+	}
+}
+
+#if NATIVE_PACK
+// esp-dsp multiply by constant is (s * C) >> 15 with C in s16, so it can't do unity
+static void gain_native(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR) {
+	if (gainL > -FIXED_ONE && gainL < FIXED_ONE && gainR > -FIXED_ONE && gainR < FIXED_ONE) {
+		dsps_mulc_s16(src, dst, frames, gainL >> 1, 2, 2);
+		dsps_mulc_s16(src + 1, dst + 1, frames, gainR >> 1, 2, 2);
+	} else {
+		gain_portable(dst, src, frames, gainL, gainR);
+	}
+}
+#endif
+
+static const struct pack_kernel {
+	void (*gain)(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR);
+	void (*mono)(ISAMPLE_T *dst, ISAMPLE_T *src, frames_t frames, s32_t gainL, s32_t gainR, u8_t flags);
+	void (*cross)(ISAMPLE_T *ptr, ISAMPLE_T *in, frames_t frames, s32_t gain_out, s32_t gain_in);
+} kernels[] = {
+	[PACK_REFERENCE] = { gain_reference, mono_reference, cross_reference },
+	[PACK_PORTABLE] = { gain_portable, mono_portable, cross_portable },
+#if NATIVE_PACK
+	[PACK_NATIVE] = { gain_native, mono_portable, cross_portable },
+#else
+	[PACK_NATIVE] = { gain_portable, mono_portable, cross_portable },
+#endif
+}, *kernel = &kernels[PACK_NATIVE];
+
 void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format) {
 	// in-place copy input samples if mono/combined is used (never happens with DSD active)
 	if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
@@ -69,6 +201,9 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		}
 	}	
 	
+	// apply gain by block first, so that packing only has to deal with unity gain
+	if (gainL != FIXED_ONE || gainR != FIXED_ONE) gain_s32(inputptr, inputptr, cnt, gainL, gainR);
+
 	switch(format) {
 #if DSD
 	case U32_LE:
@@ -168,34 +303,17 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		{
 			u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				while (cnt--) {
-					*(optr++) = (*(inputptr) >> 16 & 0x0000ffff) | (*(inputptr + 1) & 0xffff0000);
-					inputptr += 2;
-				}
-			} else {
-				while (cnt--) {
-					*(optr++) =  (gain(gainL, *(inputptr)) >> 16 & 0x0000ffff) | (gain(gainR, *(inputptr+1)) & 0xffff0000);
-					inputptr += 2;
-				}
+			while (cnt--) {
+				*(optr++) = (*(inputptr) >> 16 & 0x0000ffff) | (*(inputptr + 1) & 0xffff0000);
+				inputptr += 2;
 			}
 #else
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				while (cnt--) {
-					s32_t lsample = *(inputptr++);
-					s32_t rsample = *(inputptr++);
-					*(optr++) = 
-						(lsample & 0x00ff0000) << 8 | (lsample & 0xff000000) >> 8 |
-						(rsample & 0x00ff0000) >> 8 | (rsample & 0xff000000) >> 24;
-				}
-			} else {
-				while (cnt--) {
-					s32_t lsample = gain(gainL, *(inputptr++));
-					s32_t rsample = gain(gainR, *(inputptr++));
-					*(optr++) = 
-						(lsample & 0x00ff0000) << 8 | (lsample & 0xff000000) >> 8 |
-						(rsample & 0x00ff0000) >> 8 | (rsample & 0xff000000) >> 24;
-				}
+			while (cnt--) {
+				s32_t lsample = *(inputptr++);
+				s32_t rsample = *(inputptr++);
+				*(optr++) = 
+					(lsample & 0x00ff0000) << 8 | (lsample & 0xff000000) >> 8 |
+					(rsample & 0x00ff0000) >> 8 | (rsample & 0xff000000) >> 24;
 			}
 #endif
 		}
@@ -204,36 +322,18 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 		{
 			u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				while (cnt--) {
-					*(optr++) = *(inputptr++) >> 8;
-					*(optr++) = *(inputptr++) >> 8;
-				}
-			} else {
-				while (cnt--) {
-					*(optr++) = gain(gainL, *(inputptr++)) >> 8;
-					*(optr++) = gain(gainR, *(inputptr++)) >> 8;
-				}
+			while (cnt--) {
+				*(optr++) = *(inputptr++) >> 8;
+				*(optr++) = *(inputptr++) >> 8;
 			}
 #else
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				while (cnt--) {
-					s32_t lsample = *(inputptr++);
-					s32_t rsample = *(inputptr++);
-					*(optr++) = 
-						(lsample & 0xff000000) >> 16 | (lsample & 0x00ff0000) | (lsample & 0x0000ff00 << 16);
-					*(optr++) = 
-						(rsample & 0xff000000) >> 16 | (rsample & 0x00ff0000) | (rsample & 0x0000ff00 << 16);
-				}
-			} else {
-				while (cnt--) {
-					s32_t lsample = gain(gainL, *(inputptr++));
-					s32_t rsample = gain(gainR, *(inputptr++));
-					*(optr++) = 
-						(lsample & 0xff000000) >> 16 | (lsample & 0x00ff0000) | (lsample & 0x0000ff00 << 16);
-					*(optr++) = 
-						(rsample & 0xff000000) >> 16 | (rsample & 0x00ff0000) | (rsample & 0x0000ff00 << 16);
-				}
+			while (cnt--) {
+				s32_t lsample = *(inputptr++);
+				s32_t rsample = *(inputptr++);
+				*(optr++) = 
+					(lsample & 0xff000000) >> 16 | (lsample & 0x00ff0000) | (lsample & 0x0000ff00 << 16);
+				*(optr++) = 
+					(rsample & 0xff000000) >> 16 | (rsample & 0x00ff0000) | (rsample & 0x0000ff00 << 16);
 			}
 #endif
 		}
@@ -241,116 +341,58 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 	case S24_3LE:
 		{
 			u8_t *optr = (u8_t *)(void *)outputptr;
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				while (cnt) {
-					// attempt to do 32 bit memory accesses - move 2 frames at once: 16 bytes -> 12 bytes
-					// falls through to exception case when not aligned or if less than 2 frames to move
-					if (((uintptr_t)optr & 0x3) == 0 && cnt >= 2) {
-						u32_t *o_ptr = (u32_t *)(void *)optr;
-						while (cnt >= 2) {
-							s32_t l1 = *(inputptr++); s32_t r1 = *(inputptr++);
-							s32_t l2 = *(inputptr++); s32_t r2 = *(inputptr++);
+			while (cnt) {
+				// attempt to do 32 bit memory accesses - move 2 frames at once: 16 bytes -> 12 bytes
+				// falls through to exception case when not aligned or if less than 2 frames to move
+				if (((uintptr_t)optr & 0x3) == 0 && cnt >= 2) {
+					u32_t *o_ptr = (u32_t *)(void *)optr;
+					while (cnt >= 2) {
+						s32_t l1 = *(inputptr++); s32_t r1 = *(inputptr++);
+						s32_t l2 = *(inputptr++); s32_t r2 = *(inputptr++);
 #if SL_LITTLE_ENDIAN
-							*(o_ptr++) = (l1 & 0xffffff00) >>  8 | (r1 & 0x0000ff00) << 16;
-							*(o_ptr++) = (r1 & 0xffff0000) >> 16 | (l2 & 0x00ffff00) <<  8;
-							*(o_ptr++) = (l2 & 0xff000000) >> 24 | (r2 & 0xffffff00);
+						*(o_ptr++) = (l1 & 0xffffff00) >>  8 | (r1 & 0x0000ff00) << 16;
+						*(o_ptr++) = (r1 & 0xffff0000) >> 16 | (l2 & 0x00ffff00) <<  8;
+						*(o_ptr++) = (l2 & 0xff000000) >> 24 | (r2 & 0xffffff00);
 #else
-							*(o_ptr++) = (l1 & 0x0000ff00) << 16 | (l1 & 0x00ff0000) | (l1 & 0xff000000) >> 16 |
-								(r1 & 0x0000ff00) >> 8; 
-							*(o_ptr++) = (r1 & 0x00ff0000) <<  8 | (r1 & 0xff000000) >> 8 | (l2 & 0x0000ff00) |
-								(l2 & 0x00ff0000) >> 16;
-							*(o_ptr++) = (l2 & 0xff000000) | (r2 & 0x0000ff00) << 8 | (r2 & 0x00ff0000) >> 8 |
-								(r2 & 0xff000000) >> 24;
+						*(o_ptr++) = (l1 & 0x0000ff00) << 16 | (l1 & 0x00ff0000) | (l1 & 0xff000000) >> 16 |
+							(r1 & 0x0000ff00) >> 8; 
+						*(o_ptr++) = (r1 & 0x00ff0000) <<  8 | (r1 & 0xff000000) >> 8 | (l2 & 0x0000ff00) |
+							(l2 & 0x00ff0000) >> 16;
+						*(o_ptr++) = (l2 & 0xff000000) | (r2 & 0x0000ff00) << 8 | (r2 & 0x00ff0000) >> 8 |
+							(r2 & 0xff000000) >> 24;
 #endif
-							optr += 12;
-							cnt  -=  2;
-						}
-					} else {
-						s32_t lsample = *(inputptr++);
-						s32_t rsample = *(inputptr++);
-						*(optr++) = (lsample & 0x0000ff00) >>  8;
-						*(optr++) = (lsample & 0x00ff0000) >> 16;
-						*(optr++) = (lsample & 0xff000000) >> 24;
-						*(optr++) = (rsample & 0x0000ff00) >>  8;
-						*(optr++) = (rsample & 0x00ff0000) >> 16;
-						*(optr++) = (rsample & 0xff000000) >> 24;
-						cnt--;
-					}
-				}
-			} else {
-				while (cnt) {
-					// attempt to do 32 bit memory accesses - move 2 frames at once: 16 bytes -> 12 bytes
-					// falls through to exception case when not aligned or if less than 2 frames to move
-					if (((uintptr_t)optr & 0x3) == 0 && cnt >= 2) {
-						u32_t *o_ptr = (u32_t *)(void *)optr;
-						while (cnt >= 2) {
-							s32_t l1 = gain(gainL, *(inputptr++)); s32_t r1 = gain(gainR, *(inputptr++));
-							s32_t l2 = gain(gainL, *(inputptr++)); s32_t r2 = gain(gainR, *(inputptr++));
-#if SL_LITTLE_ENDIAN
-							*(o_ptr++) = (l1 & 0xffffff00) >>  8 | (r1 & 0x0000ff00) << 16;
-							*(o_ptr++) = (r1 & 0xffff0000) >> 16 | (l2 & 0x00ffff00) <<  8;
-							*(o_ptr++) = (l2 & 0xff000000) >> 24 | (r2 & 0xffffff00);
-#else
-							*(o_ptr++) = (l1 & 0x0000ff00) << 16 | (l1 & 0x00ff0000) | (l1 & 0xff000000) >> 16 |
-								(r1 & 0x0000ff00) >> 8; 
-							*(o_ptr++) = (r1 & 0x00ff0000) <<  8 | (r1 & 0xff000000) >> 8 | (l2 & 0x0000ff00) |
-								(l2 & 0x00ff0000) >> 16;
-							*(o_ptr++) = (l2 & 0xff000000) | (r2 & 0x0000ff00) << 8 | (r2 & 0x00ff0000) >> 8 |
-								(r2 & 0xff000000) >> 24;
-#endif
-							optr += 12;
-							cnt  -=  2;
-						}
-					} else {
-						s32_t lsample = gain(gainL, *(inputptr++));
-						s32_t rsample = gain(gainR, *(inputptr++));
-						*(optr++) = (lsample & 0x0000ff00) >>  8;
-						*(optr++) = (lsample & 0x00ff0000) >> 16;
-						*(optr++) = (lsample & 0xff000000) >> 24;
-						*(optr++) = (rsample & 0x0000ff00) >>  8;
-						*(optr++) = (rsample & 0x00ff0000) >> 16;
-						*(optr++) = (rsample & 0xff000000) >> 24;
-						cnt--;
+						optr += 12;
+						cnt  -=  2;
 					}
+				} else {
+					s32_t lsample = *(inputptr++);
+					s32_t rsample = *(inputptr++);
+					*(optr++) = (lsample & 0x0000ff00) >>  8;
+					*(optr++) = (lsample & 0x00ff0000) >> 16;
+					*(optr++) = (lsample & 0xff000000) >> 24;
+					*(optr++) = (rsample & 0x0000ff00) >>  8;
+					*(optr++) = (rsample & 0x00ff0000) >> 16;
+					*(optr++) = (rsample & 0xff000000) >> 24;
+					cnt--;
 				}
 			}
 		}
 		break;
 	case S32_LE:
 		{
-			u32_t *optr = (u32_t *)(void *)outputptr;
 #if SL_LITTLE_ENDIAN
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				memcpy(outputptr, inputptr, cnt * BYTES_PER_FRAME);
-			} else {
-				while (cnt--) {
-					*(optr++) = gain(gainL, *(inputptr++));
-					*(optr++) = gain(gainR, *(inputptr++));
-				}
-			}
+			memcpy(outputptr, inputptr, cnt * BYTES_PER_FRAME);
 #else
-			if (gainL == FIXED_ONE && gainR == FIXED_ONE) {
-				while (cnt--) {
-					s32_t lsample = *(inputptr++);
-					s32_t rsample = *(inputptr++);
-					*(optr++) = 
-						(lsample & 0xff000000) >> 24 | (lsample & 0x00ff0000) >> 8 |
-						(lsample & 0x0000ff00) << 8  | (lsample & 0x000000ff) << 24;
-					*(optr++) = 
-						(rsample & 0xff000000) >> 24 | (rsample & 0x00ff0000) >> 8 |
-						(rsample & 0x0000ff00) << 8  | (rsample & 0x000000ff) << 24;
-				}
-			} else {
-				while (cnt--) {
-					s32_t lsample = gain(gainL, *(inputptr++));
-					s32_t rsample = gain(gainR, *(inputptr++));
-					*(optr++) = 
-						(lsample & 0xff000000) >> 24 | (lsample & 0x00ff0000) >> 8 |
-						(lsample & 0x0000ff00) << 8  | (lsample & 0x000000ff) << 24;
-					*(optr++) = 
-						(rsample & 0xff000000) >> 24 | (rsample & 0x00ff0000) >> 8 |
-						(rsample & 0x0000ff00) << 8  | (rsample & 0x000000ff) << 24;
-				}
+			u32_t *optr = (u32_t *)(void *)outputptr;
+			while (cnt--) {
+				s32_t lsample = *(inputptr++);
+				s32_t rsample = *(inputptr++);
+				*(optr++) = 
+					(lsample & 0xff000000) >> 24 | (lsample & 0x00ff0000) >> 8 |
+					(lsample & 0x0000ff00) << 8  | (lsample & 0x000000ff) << 24;
+				*(optr++) = 
+					(rsample & 0xff000000) >> 24 | (rsample & 0x00ff0000) >> 8 |
+					(rsample & 0x0000ff00) << 8  | (rsample & 0x000000ff) << 24;
 			}
 #endif
 		}
@@ -360,57 +402,43 @@ void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_
 	}
 }
 
-#if !WIN
-inline 
-#endif
+void output_pack_kernel(pack_kernel_t type) {
+	kernel = &kernels[type];
+}
+
 void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
 	ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp;
-	frames_t count = out_frames * 2;
-	while (count--) {
-		if (*cross_ptr > (ISAMPLE_T *)outputbuf->wrap) {
+
+	// cross_ptr is the only one that can wrap, so process by runs up to it
+	while (out_frames) {
+		frames_t frames;
+		if (*cross_ptr >= (ISAMPLE_T *)outputbuf->wrap) {
 			*cross_ptr -= outputbuf->size / BYTES_PER_FRAME * 2;
 		}
-		*ptr = gain(cross_gain_out, *ptr) + gain(cross_gain_in, **cross_ptr);
-		ptr++; (*cross_ptr)++;
+		frames = min(out_frames, ((ISAMPLE_T *)outputbuf->wrap - *cross_ptr) / 2);
+		kernel->cross(ptr, *cross_ptr, frames, cross_gain_out, cross_gain_in);
+		ptr += frames * 2; *cross_ptr += frames * 2;
+		out_frames -= frames;
 	}
 }
 
+void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
+	if (gainL == FIXED_ONE && gainR == FIXED_ONE && !(flags & (MONO_LEFT | MONO_RIGHT))) return;
+	_apply_gain_to(outputbuf, outputbuf->readp, count, gainL, gainR, flags);
+}
 
+// apply gain while copying from outputbuf to dst, so that samples are read and written only once
+void _apply_gain_to(struct buffer *outputbuf, u8_t *dst, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
+	apply_gain_copy(dst, outputbuf->readp, count, gainL, gainR, flags);
+}
 
-#if !WIN
-inline 
-#endif
-void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
+// same from any source (e.g. data held in outputbuf), does not need mutex
+void apply_gain_copy(u8_t *dst, u8_t *src, frames_t count, s32_t gainL, s32_t gainR, u8_t flags) {
 	if (gainL == FIXED_ONE && gainR == FIXED_ONE && !(flags & (MONO_LEFT | MONO_RIGHT))) {
-		return;
-	} else if ((flags & MONO_LEFT) && (flags & MONO_RIGHT)) {
-		ISAMPLE_T *ptrL = (ISAMPLE_T *)(void *)outputbuf->readp;
-		ISAMPLE_T *ptrR = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
-		while (count--) {
-			*ptrL = *ptrR = (gain(gainL, *ptrL) + gain(gainR, *ptrR)) / 2;
-			ptrL += 2; ptrR += 2;
-		}
-
-	} else if (flags & MONO_RIGHT) {
-		ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
-		while (count--) {
-			*(ptr - 1) = *ptr = gain(gainR, *ptr);
-			ptr += 2;
-		}
-	} else if (flags & MONO_LEFT) {
-		ISAMPLE_T *ptr = (ISAMPLE_T *)(void *)outputbuf->readp;
-		while (count--) {
-			*(ptr + 1) = *ptr = gain(gainL, *ptr);
-			ptr += 2;
-		}
+		if (dst != src) memcpy(dst, src, count * BYTES_PER_FRAME);
+	} else if (flags & (MONO_LEFT | MONO_RIGHT)) {
+		kernel->mono((ISAMPLE_T *)(void *)dst, (ISAMPLE_T *)(void *)src, count, gainL, gainR, flags);
 	} else {
-	   	ISAMPLE_T *ptrL = (ISAMPLE_T *)(void *)outputbuf->readp;
-		ISAMPLE_T *ptrR = (ISAMPLE_T *)(void *)outputbuf->readp + 1;
-		while (count--) {
-			*ptrL = gain(gainL, *ptrL);
-			*ptrR = gain(gainR, *ptrR);
-			ptrL += 2; ptrR += 2;
-		}
+		kernel->gain((ISAMPLE_T *)(void *)dst, (ISAMPLE_T *)(void *)src, count, gainL, gainR);
 	}
 }
-
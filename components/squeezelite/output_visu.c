@@ -22,7 +22,7 @@
 
 #include "squeezelite.h"
 
-#define VISUEXPORT_SIZE	512
+#define VISUEXPORT_SIZE	1024		// must hold the largest spectrum (see spectrum.h)
 
 EXT_BSS struct visu_export_s visu_export;
 static struct visu_export_s *visu = &visu_export;
@@ -30,6 +30,10 @@ static struct visu_export_s *visu = &visu_export;
 static log_level loglevel = lINFO;
 
 void output_visu_export(void *frames, frames_t out_frames, u32_t rate, bool silence, u32_t gain) {
+	static u32_t played;
+	u32_t position = played;
+
+	played += out_frames;
 	
 	// no data to process
 	if (silence) {
@@ -39,13 +43,14 @@ void output_visu_export(void *frames, frames_t out_frames, u32_t rate, bool sile
 	
 	// do not block, try to stuff data but wait for consumer to have used them
 	if (!pthread_mutex_trylock(&visu->mutex)) {
-		// don't mix sample rates
-		if (visu->rate != rate) visu->level = 0;
+		// don't mix sample rates and only append frames that follow what we have
+		if (visu->rate != rate || (visu->level < visu->size && visu->frames + visu->level != position)) visu->level = 0;
+		if (!visu->level) visu->frames = position;
 		
 		// stuff buffer up and wait for consumer to read it (should reset level)
 		if (visu->level < visu->size) {
 			u32_t space = min(visu->size - visu->level, out_frames) * BYTES_PER_FRAME;
-			memcpy(visu->buffer + visu->level, frames, space);
+			memcpy((u8_t*) visu->buffer + visu->level * BYTES_PER_FRAME, frames, space);
 			
 			visu->level += space / BYTES_PER_FRAME;
 			visu->running = true;
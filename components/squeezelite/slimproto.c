@@ -328,7 +328,9 @@ static void process_strm(u8_t *pkt, int len) {
 			unsigned interval = unpackN(&strm->replay_gain);
 			LOCK_O;
 			output.pause_frames = interval * status.current_sample_rate / 1000;
-			if (interval) {
+			if (interval && _output_slew(-output.pause_frames)) {
+				LOG_DEBUG("pause absorbed by rate adjustment");
+			} else if (interval) {
 				output.state = OUTPUT_PAUSE_FRAMES;
 			} else if (output.state != OUTPUT_OFF) {
 				output.state = OUTPUT_STOPPED;
@@ -344,7 +346,8 @@ static void process_strm(u8_t *pkt, int len) {
 			unsigned interval = unpackN(&strm->replay_gain);
 			LOCK_O;
 			output.skip_frames = interval * status.current_sample_rate / 1000;
-			output.state = OUTPUT_SKIP_FRAMES;				
+			// small corrections are done by adjusting rate, not by skipping
+			if (!_output_slew(output.skip_frames)) output.state = OUTPUT_SKIP_FRAMES;				
 			UNLOCK_O;
 			LOG_DEBUG("skip ahead interval: %u", interval);
 		}
@@ -435,7 +438,10 @@ static void process_cont(u8_t *pkt, int len) {
 		LOCK_S;
 		if (stream.state == STREAMING_WAIT) {
 			stream.state = STREAMING_BUFFERING;
-			stream.meta_interval = stream.meta_next = cont->metaint;
+			// body received along with headers is part of first interval
+			stream.meta_interval = cont->metaint;
+			stream.meta_next = cont->metaint > stream.bytes ? cont->metaint - stream.bytes : 0;
+			_buf_wake(streambuf);
 		}
 		UNLOCK_S;
 		wake_controller();
@@ -574,16 +580,16 @@ static void process(u8_t *pack, int len) {
 		LOG_DEBUG("%s", h->opcode);
 		h->handler(pack, len);
 	} else if (!slimp_handler || !(*slimp_handler)(pack, len)) {
-		pack[4] = '\0';
-		LOG_WARN("unhandled %s", (char *)pack);
+		// packet is in receive buffer, followed by next one, so don't terminate opcode
+		LOG_WARN("unhandled %.4s", (char *)pack);
 	}
 }
 
 static bool running;
 
 static void slimproto_run() {
-	static u8_t EXT_BSS buffer[MAXBUF];
-	int  expect = 0;
+	// a packet (and its length) always fits after what is left of previous read
+	static u8_t EXT_BSS buffer[2 * MAXBUF];
 	int  got    = 0;
 	u32_t now;
 	static u32_t last = 0;
@@ -600,45 +606,31 @@ static void slimproto_run() {
 		if ((ev = wait_readwake(ehandles, 1000)) != EVENT_TIMEOUT) {
 	
 			if (ev == EVENT_READ) {
-
-				if (expect > 0) {
-					int n = recv(sock, buffer + got, expect, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
-						return;
-					}
-					expect -= n;
-					got += n;
-					if (expect == 0) {
-						process(buffer, got);
-						got = 0;
+				// read as much as we can and process all complete packets in place
+				int n = recv(sock, buffer + got, sizeof(buffer) - got, 0), used = 0;
+				if (n <= 0) {
+					if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
+						continue;
 					}
-				} else if (expect == 0) {
-					int n = recv(sock, buffer + got, 2 - got, 0);
-					if (n <= 0) {
-						if (n < 0 && last_error() == ERROR_WOULDBLOCK) {
-							continue;
-						}
-						LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
+					LOG_INFO("error reading from socket: %s", n ? strerror(last_error()) : "closed");
+					return;
+				}
+				got += n;
+
+				while (got - used >= 2 && running && !new_server) {
+					int len = buffer[used] << 8 | buffer[used + 1]; // length pack 'n'
+					if (len > MAXBUF) {
+						LOG_ERROR("FATAL: slimproto packet too big: %d > %d", len, MAXBUF);
 						return;
 					}
-					got += n;
-					if (got == 2) {
-						expect = buffer[0] << 8 | buffer[1]; // length pack 'n'
-						got = 0;
-						if (expect > MAXBUF) {
-							LOG_ERROR("FATAL: slimproto packet too big: %d > %d", expect, MAXBUF);
-							return;
-						}
-					}
-				} else {
-					LOG_ERROR("FATAL: negative expect");
-					return;
+					if (got - used - 2 < len) break;
+					if (len) process(buffer + used + 2, len);
+					used += len + 2;
 				}
 
+				// move partial packet to the beginning
+				got -= used;
+				if (got && used) memmove(buffer, buffer + used, got);
 			}
 
 			if (ev == EVENT_WAKE) {
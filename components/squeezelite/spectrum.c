@@ -0,0 +1,200 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "spectrum.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_dsp.h"
+#endif
+
+/*
+Power spectrum of the mono downmix of real samples. A real FFT of N points is
+done as a complex FFT of N/2 points where even samples are the real part and
+odd samples the imaginary part, then the two interleaved half-spectra are
+separated with one twiddle per bin. Windows are scaled to the same power gain
+as Hann so that bars calibration does not depend on the window. With overlap,
+each run only needs N * (100 - overlap) / 100 new frames and re-uses the end
+of previous ones, so caller must restart when frames are not contiguous. Power can be averaged across runs (exponential, in %).
+*/
+
+struct spectrum_s {
+	int len, hop, fill;
+	float average;
+	float *window, *history, *work, *twiddle, *power;
+};
+
+#ifndef ESP_PLATFORM
+/****************************************************************************************
+ * Portable in-place radix-2 complex FFT, output in natural order
+ */
+static void fft_c(float *data, int n) {
+	// bit reversal first
+	for (int i = 1, j = 0; i < n; i++) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			float re = data[2*i], im = data[2*i+1];
+			data[2*i] = data[2*j]; data[2*i+1] = data[2*j+1];
+			data[2*j] = re; data[2*j+1] = im;
+		}
+	}
+
+	for (int size = 2; size <= n; size <<= 1) {
+		float step = -2 * M_PI / size;
+		for (int k = 0; k < size / 2; k++) {
+			float wr = cosf(step * k), wi = sinf(step * k);
+			for (int i = k; i < n; i += size) {
+				float *a = data + 2*i, *b = data + 2*(i + size/2);
+				float re = b[0] * wr - b[1] * wi, im = b[0] * wi + b[1] * wr;
+				b[0] = a[0] - re; b[1] = a[1] - im;
+				a[0] += re; a[1] += im;
+			}
+		}
+	}
+}
+#else
+static void fft_c(float *data, int n) {
+	dsps_fft2r_fc32(data, n);
+	dsps_bit_rev_fc32(data, n);
+}
+#endif
+
+/****************************************************************************************
+ * Create analyzer, len is rounded to a power of 2 within limits
+ */
+struct spectrum_s* spectrum_create(int len, spectrum_window_t window, int overlap, int average) {
+	struct spectrum_s *spectrum;
+	float power = 0;
+	int bits;
+
+	for (bits = 0; (1 << bits) < len && (1 << bits) < SPECTRUM_MAX_LEN; bits++);
+	len = 1 << bits;
+	if (len < SPECTRUM_MIN_LEN) len = SPECTRUM_MIN_LEN;
+
+#ifdef ESP_PLATFORM
+	// table is global to esp-dsp, so size it once for the largest FFT (N/2 complex)
+	static bool init;
+	if (!init && dsps_fft2r_init_fc32(NULL, SPECTRUM_MAX_LEN / 2) != ESP_OK) return NULL;
+	init = true;
+#endif
+
+	if ((spectrum = calloc(1, sizeof(struct spectrum_s))) == NULL) return NULL;
+
+	spectrum->len = len;
+	spectrum->hop = len - len * (overlap < 0 ? 0 : overlap > 75 ? 75 : overlap) / 100;
+	spectrum->average = (average < 0 ? 0 : average > 95 ? 95 : average) / 100.0;
+	spectrum->window = malloc(len * sizeof(float));
+	spectrum->history = calloc(len, sizeof(float));
+	spectrum->work = malloc(len * sizeof(float));
+	spectrum->twiddle = malloc(len * sizeof(float));
+	spectrum->power = calloc(len / 2, sizeof(float));
+
+	if (!spectrum->window || !spectrum->history || !spectrum->work || !spectrum->twiddle || !spectrum->power) {
+		spectrum_destroy(spectrum);
+		return NULL;
+	}
+
+	for (int i = 0; i < len; i++) {
+		float x = 2 * M_PI * i / (len - 1);
+		switch (window) {
+		case SPECTRUM_HAMMING: spectrum->window[i] = 0.54f - 0.46f * cosf(x); break;
+		case SPECTRUM_BLACKMAN: spectrum->window[i] = 0.42f - 0.5f * cosf(x) + 0.08f * cosf(2 * x); break;
+		case SPECTRUM_RECTANGLE: spectrum->window[i] = 1; break;
+		case SPECTRUM_HANN:
+		default: spectrum->window[i] = 0.5f - 0.5f * cosf(x); break;
+		}
+		power += spectrum->window[i] * spectrum->window[i];
+	}
+
+	// same power gain as Hann (3/8)
+	power = sqrtf(0.375f * len / power);
+	for (int i = 0; i < len; i++) spectrum->window[i] *= power;
+
+	// twiddles to split the N/2 complex FFT
+	for (int k = 0; k < len / 2; k++) {
+		spectrum->twiddle[2*k] = cosf(2 * M_PI * k / len);
+		spectrum->twiddle[2*k+1] = -sinf(2 * M_PI * k / len);
+	}
+
+	return spectrum;
+}
+
+/****************************************************************************************
+ * Destroy analyzer
+ */
+void spectrum_destroy(struct spectrum_s *spectrum) {
+	if (!spectrum) return;
+	free(spectrum->window);
+	free(spectrum->history);
+	free(spectrum->work);
+	free(spectrum->twiddle);
+	free(spectrum->power);
+	free(spectrum);
+}
+
+int spectrum_len(struct spectrum_s *spectrum) {
+	return spectrum->len;
+}
+
+/****************************************************************************************
+ * Number of frames for next run (full length when history is not filled)
+ */
+int spectrum_need(struct spectrum_s *spectrum) {
+	return spectrum->fill < spectrum->len ? spectrum->len - spectrum->fill : spectrum->hop;
+}
+
+/****************************************************************************************
+ * Forget history and power (silence, rate change)
+ */
+const float* spectrum_reset(struct spectrum_s *spectrum) {
+	spectrum->fill = 0;
+	memset(spectrum->power, 0, spectrum->len / 2 * sizeof(float));
+	return spectrum->power;
+}
+
+/****************************************************************************************
+ * Forget history but keep averaged power (next frames do not follow previous ones)
+ */
+void spectrum_restart(struct spectrum_s *spectrum) {
+	spectrum->fill = 0;
+}
+
+/****************************************************************************************
+ * Run with spectrum_need() frames of 16 bits samples (left at samples[0], right at
+ * samples[stride/2]). Returns len/2 power bins, not normalized
+ */
+const float* spectrum_run(struct spectrum_s *spectrum, const int16_t *samples, int stride) {
+	int len = spectrum->len, half = len / 2, count = spectrum_need(spectrum);
+	float *x = spectrum->history, *z = spectrum->work;
+
+	// slide history and add new frames as mono downmix
+	memmove(x, x + count, (len - count) * sizeof(float));
+	for (int i = len - count; i < len; i++, samples += stride) x[i] = samples[0] + samples[stride / 2];
+	spectrum->fill = len;
+
+	// even samples are real, odd samples are imaginary
+	for (int i = 0; i < len; i++) z[i] = x[i] * spectrum->window[i];
+	fft_c(z, half);
+
+	// split: X[k] = (Z[k] + Z*[N/2-k]) / 2 - i.W^k.(Z[k] - Z*[N/2-k]) / 2
+	for (int k = 0; k < half; k++) {
+		int m = k ? half - k : 0;
+		float er = (z[2*k] + z[2*m]) / 2, ei = (z[2*k+1] - z[2*m+1]) / 2;
+		float or = (z[2*k+1] + z[2*m+1]) / 2, oi = (z[2*m] - z[2*k]) / 2;
+		float wr = spectrum->twiddle[2*k], wi = spectrum->twiddle[2*k+1];
+		float re = er + or * wr - oi * wi, im = ei + or * wi + oi * wr;
+		float power = re * re + im * im;
+		spectrum->power[k] = spectrum->average * spectrum->power[k] + (1 - spectrum->average) * power;
+	}
+
+	return spectrum->power;
+}
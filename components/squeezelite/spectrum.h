@@ -0,0 +1,27 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPECTRUM_MIN_LEN	64
+#define SPECTRUM_MAX_LEN	1024
+
+typedef enum { SPECTRUM_HANN = 0, SPECTRUM_HAMMING, SPECTRUM_BLACKMAN, SPECTRUM_RECTANGLE } spectrum_window_t;
+
+struct spectrum_s;
+
+struct spectrum_s* spectrum_create(int len, spectrum_window_t window, int overlap, int average);
+void spectrum_destroy(struct spectrum_s *spectrum);
+int spectrum_len(struct spectrum_s *spectrum);
+int spectrum_need(struct spectrum_s *spectrum);
+const float* spectrum_reset(struct spectrum_s *spectrum);
+void spectrum_restart(struct spectrum_s *spectrum);
+const float* spectrum_run(struct spectrum_s *spectrum, const int16_t *samples, int stride);
@@ -22,7 +22,7 @@
  *   -Launch script on power status change from LMS
  */
 
-// make may define: PORTAUDIO, SELFPIPE, RESAMPLE, RESAMPLE_MP, VISEXPORT, GPIO, IR, DSD, LINKALL to influence build
+// make may define: PORTAUDIO, SELFPIPE, RESAMPLE, RESAMPLE_MP, VISEXPORT, GPIO, IR, DSD, LINKALL, BUF_LOCKFREE to influence build
 
 #define MAJOR_VERSION "1"
 #define MINOR_VERSION "0"
@@ -173,6 +173,13 @@
 #define LINKALL   0
 #endif
 
+#if defined(BUF_LOCKFREE)
+#undef BUF_LOCKFREE
+#define BUF_LOCKFREE 1 // single producer/consumer buffers with atomic read/write pointers
+#else
+#define BUF_LOCKFREE 0
+#endif
+
 #if defined (USE_SSL)
 #undef USE_SSL
 #define USE_SSL 1
@@ -262,6 +269,9 @@
 
 #define MAX_HEADER 4096 // do not reduce as icy-meta max is 4080
 
+// room in arena for codecs scratch buffers and buffer unwrap
+#define ARENA_SCRATCH_SIZE (96 * 1024)
+
 #if ALSA
 #define ALSA_BUFFER_TIME  40
 #define ALSA_PERIOD_COUNT 4
@@ -394,9 +404,17 @@ const char *logtime(void);
 void logprint(const char *fmt, ...);
 
 #define LOG_WARN(fmt, ...)  if (loglevel >= lWARN)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#if LOG_DEFERRED
+// info and debug are formatted later, out of the audio path (see log_ring.h)
+#include "log_ring.h"
+#define LOG_INFO(fmt, ...)  if (loglevel >= lINFO)  log_ring_print(__FUNCTION__, __LINE__, fmt "\n", ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) if (loglevel >= lDEBUG) log_ring_print(__FUNCTION__, __LINE__, fmt "\n", ##__VA_ARGS__)
+#define LOG_SDEBUG(fmt, ...) if (loglevel >= lSDEBUG) log_ring_print(__FUNCTION__, __LINE__, fmt "\n", ##__VA_ARGS__)
+#else
 #define LOG_INFO(fmt, ...)  if (loglevel >= lINFO)  logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_DEBUG(fmt, ...) if (loglevel >= lDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
 #define LOG_SDEBUG(fmt, ...) if (loglevel >= lSDEBUG) logprint("%s %s:%d " fmt "\n", logtime(), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#endif
 	
 typedef uint32_t frames_t;
 typedef int sockfd;
@@ -461,6 +479,10 @@ void _wake_create(event_event*);
 #define EXT_BSS
 #endif
 
+#ifndef ARENA_MALLOC
+#define ARENA_MALLOC malloc
+#endif
+
 // printf/scanf formats for u64_t
 #if (LINUX && __WORDSIZE == 64) || (FREEBSD && __LP64__)
 #define FMT_u64 "%lu"
@@ -527,6 +549,13 @@ int poll(struct pollfd *fds, unsigned long numfds, int timeout);
 void touch_memory(u8_t *buf, size_t size);
 #endif
 
+// arena.c
+void arena_init(log_level level, size_t size);
+void *arena_alloc(size_t size, const void *owner);
+void arena_release(void *ptr);
+size_t arena_capacity(void *ptr);
+bool arena_grow(void *ptr, size_t size);
+
 // buffer.c
 struct buffer {
 	u8_t *buf;
@@ -537,9 +566,15 @@ struct buffer {
 	size_t base_size;
 	size_t true_size;
 	mutex_type mutex;
+	unsigned wait_space, wait_data, held;
+	bool reserved, cancelled, wait_held;
+#if !WIN
+	pthread_cond_t cond;
+#endif
 };
 
 // _* called with mutex locked
+// (with BUF_LOCKFREE, _buf_used/_buf_space only need to be called from producer or consumer)
 unsigned _buf_used(struct buffer *buf);
 unsigned _buf_space(struct buffer *buf);
 unsigned _buf_cont_read(struct buffer *buf);
@@ -549,6 +584,16 @@ void _buf_inc_writep(struct buffer *buf, unsigned by);
 void buf_flush(struct buffer *buf);
 void _buf_flush(struct buffer *buf);
 void _buf_unwrap(struct buffer *buf, size_t cont);
+void _buf_wait(struct buffer *buf, unsigned timeout);
+void _buf_wait_space(struct buffer *buf, unsigned space, unsigned timeout);
+void _buf_wait_data(struct buffer *buf, unsigned used, unsigned timeout);
+void _buf_wake(struct buffer *buf);
+unsigned _buf_reserve(struct buffer *buf, unsigned max, u8_t *seg[2], unsigned len[2]);
+bool _buf_commit(struct buffer *buf, unsigned by);
+void _buf_hold(struct buffer *buf, unsigned by);
+void buf_release(struct buffer *buf);
+void buf_wait_space(struct buffer *buf, unsigned space, unsigned timeout);
+void buf_wait_data(struct buffer *buf, unsigned used, unsigned timeout);
 void buf_adjust(struct buffer *buf, size_t mod);
 void _buf_resize(struct buffer *buf, size_t size);
 size_t _buf_limit(struct buffer *buf, size_t limit);
@@ -716,6 +761,10 @@ struct outputstate {
 	bool delay_active;
 	u32_t stop_time;
 	u32_t idle_to;
+	bool  adjust;              // set by device if it uses output_adjust
+	s32_t adjust_frames;       // frames to absorb by rate adjustment, >0 to skip and <0 to pause
+	s32_t adjust_reported;     // part of adjust_frames already counted in frames_played
+	s32_t adjust_ppm;          // continuous rate correction, set by sync
 #if DSD
 	dsd_format next_fmt;       // set in decode thread
 	dsd_format outfmt;
@@ -765,12 +814,26 @@ void output_close_stdout(void);
 #endif
 
 // output_pack.c
+typedef enum { PACK_REFERENCE = 0, PACK_PORTABLE, PACK_NATIVE } pack_kernel_t;
+void output_pack_kernel(pack_kernel_t type);
 void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format);
 void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags);
+void _apply_gain_to(struct buffer *outputbuf, u8_t *dst, frames_t count, s32_t gainL, s32_t gainR, u8_t flags);
+void apply_gain_copy(u8_t *dst, u8_t *src, frames_t count, s32_t gainL, s32_t gainR, u8_t flags);
 s32_t gain(s32_t gain, s32_t sample);
 s32_t to_gain(float f);
 
+// output_adjust.c
+#define ADJUST_MARGIN		16
+#define ADJUST_SLEW_PPM		500
+#define ADJUST_SLEW_MS		10
+#define ADJUST_DRIFT_PPM	500
+frames_t output_adjust(ISAMPLE_T **buf, frames_t frames, ISAMPLE_T *out);
+void _output_adjusted(s32_t delta);
+bool _output_slew(s32_t frames);
+void _output_adjust_reset(void);
+
 // output_vis.c
 #if VISEXPORT
 void _vis_export(struct buffer *outputbuf, struct outputstate *output, frames_t out_frames, bool silence);
@@ -26,6 +26,8 @@
 #endif
 
 #include "squeezelite.h"
+#include "picohttpparser.h"
+#include "perf_counters.h"
 
 #include <fcntl.h>
 
@@ -45,6 +47,13 @@ struct buffer *streambuf = &buf;
 #define LOCK     mutex_lock(streambuf->mutex)
 #define UNLOCK   mutex_unlock(streambuf->mutex)
 
+// when streambuf is full, wait for that much room before receiving again
+#define STREAM_WAKE_SPACE	(4 * 1024)
+
+// HTTP response headers are read by chunks, surplus is body
+#define HEADER_CHUNK		512
+#define HEADER_MAX_LINES	48		// parsed at once, there can be more
+
 /* 
 When LMS sends a close/open sequence very quickly, the stream thread might
 still be waiting in the poll() on the closed socket. It is never recommended
@@ -57,6 +66,7 @@ A simple variable that forces stream_sock() to wait until we are out of poll()
 is enough and much faster than a mutex 
 */
 static bool polling;
+static perf_metric_t *perf_bytes;
 static sockfd fd;
 
 struct EXT_RAM_ATTR streamstate stream;
@@ -130,6 +140,37 @@ static int _poll(SSL *ssl, struct pollfd *pollinfo, int timeout) {
 }
 #endif
 
+/*
+Receive into the (up to) two segments of free space reserved in streambuf, 
+without mutex. Plain sockets do a single vectored read but SSL can only read
+one segment after the other.
+*/
+static int _recv_segments(int fd, u8_t *seg[2], unsigned len[2]) {
+	int n;
+#if USE_SSL
+	if (ssl) {
+		n = _recv(ssl, fd, seg[0], len[0], 0);
+		if (n == len[0] && len[1] && SSL_pending(ssl)) {
+			int more = _recv(ssl, fd, seg[1], len[1], 0);
+			if (more > 0) n += more;
+		}
+		return n;
+	}
+#endif
+#if WIN
+	n = recv(fd, seg[0], len[0], 0);
+	if (n == len[0] && len[1]) {
+		int more = recv(fd, seg[1], len[1], 0);
+		if (more > 0) n += more;
+	}
+#else
+	struct iovec iov[2] = { { seg[0], len[0] }, { seg[1], len[1] } };
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = len[1] ? 2 : 1 };
+	n = recvmsg(fd, &msg, 0);
+#endif
+	return n;
+}
+
 static bool send_header(void) {
 	char *ptr = stream.header;
 	int len = stream.header_len;
@@ -188,9 +229,8 @@ static size_t memfind(const u8_t* haystack, size_t n, const char* needle, size_t
  * https://xiph.org/flac/ogg_mapping.html
  * https://xiph.org/vorbis/doc/Vorbis_I_spec.html#x1-610004.2 */
  
-static void stream_ogg(size_t n) {
+static void stream_ogg(u8_t *p, size_t n) {
 	if (ogg.state == OGG_OFF) return;
-	u8_t* p = streambuf->writep;
 
 	while (n) {
 		size_t consumed = min(ogg.miss, n);
@@ -255,6 +295,9 @@ static void stream_ogg(size_t n) {
 			}
 			break;
 		case OGG_PAGE: {
+			// metadata would overwrite HTTP headers not sent yet, come back later (lose sync, not the page)
+			if (!stream.sent_headers) return;
+			
 			char** tag = (char* []){ "\x3vorbis", "OpusTags", NULL };
 			size_t ofs = 0;
 
@@ -323,8 +366,10 @@ static void *stream_thread() {
 		space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
 
 		if (fd < 0 || !space || stream.state <= STREAMING_WAIT) {
+			// wait for decoder to make room or for a new stream, both will wake us up
+			if (space) _buf_wait(streambuf, 100);
+			else _buf_wait_space(streambuf, STREAM_WAKE_SPACE, 100);
 			UNLOCK;
-			usleep(space ? 100000 : 25000);
 			continue;
 		}
 
@@ -338,6 +383,7 @@ static void *stream_thread() {
 			if (n > 0) {
 				_buf_inc_writep(streambuf, n);
 				stream.bytes += n;
+				perf_count(perf_bytes, n);
 				LOG_SDEBUG("streambuf read %d bytes", n);
 			}
 			if (n < 0) {
@@ -366,8 +412,8 @@ static void *stream_thread() {
 			polling = false;
 			LOCK;
 
-			// check socket has not been closed while in poll
-			if (fd < 0) {
+			// check socket has not been closed or stream stopped while in poll
+			if (fd < 0 || stream.state <= STREAMING_WAIT) {
 				UNLOCK;
 				continue;
 			}
@@ -383,12 +429,13 @@ static void *stream_thread() {
 
 				// get response headers
 				if (stream.state == RECV_HEADERS) {
+					static struct phr_header headers[HEADER_MAX_LINES];
+					size_t lines = HEADER_MAX_LINES;
+					char *body;
+					int len = -2;
 
-					// read one byte at a time to catch end of header
-					char c;
-					static int endtok;
-
-					int n = _recv(ssl, fd, &c, 1, 0);
+					// read by chunks and parse what we have so far
+					int n = _recv(ssl, fd, stream.header + stream.header_len, min(HEADER_CHUNK, MAX_HEADER - 1 - stream.header_len), 0);
 					if (n <= 0) {
 						if (n < 0 && _last_error() == ERROR_WOULDBLOCK) {
 							UNLOCK;
@@ -400,24 +447,49 @@ static void *stream_thread() {
 						continue;
 					}
 
-					*(stream.header + stream.header_len) = c;
-					stream.header_len++;
-
-					if (stream.header_len > MAX_HEADER - 1) {
-						LOG_ERROR("received headers too long: %u", stream.header_len);
-						_disconnect(DISCONNECT, LOCAL_DISCONNECT);
+					stream.header_len += n;
+
+					// skip status line, it can be HTTP/1.x or ICY
+					if ((body = memchr(stream.header, '\n', stream.header_len)) != NULL) {
+						char *end = stream.header + stream.header_len;
+						body++;
+						// lines are not used, so when array is full just resume after the last one (its EOL has been parsed)
+						while ((len = phr_parse_headers(body, end - body, headers, &lines, 0)) == -1 && lines == HEADER_MAX_LINES) {
+							char *last = (char*) headers[lines - 1].value + headers[lines - 1].value_len;
+							body = (char*) memchr(last, '\n', end - last) + 1;
+							lines = HEADER_MAX_LINES;
+						}
+						if (len >= 0) body += len;
 					}
 
-					if (stream.header_len > 1 && (c == '\r' || c == '\n')) {
-						endtok++;
-						if (endtok == 4) {
-							*(stream.header + stream.header_len) = '\0';
-							LOG_INFO("headers: len: %d\n%s", stream.header_len, stream.header);
-							stream.state = stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
-							wake_controller();
+					if (len == -1 || (len == -2 && stream.header_len >= MAX_HEADER - 1)) {
+						LOG_ERROR("received headers invalid or too long: %u", stream.header_len);
+						_disconnect(DISCONNECT, LOCAL_DISCONNECT);
+					} else if (len >= 0) {
+						// what we have read beyond headers is body (streambuf is empty)
+						size_t surplus = stream.header + stream.header_len - body;
+						if (surplus) {
+							size_t cont = min(surplus, _buf_cont_write(streambuf));
+							memcpy(streambuf->writep, body, cont);
+							memcpy(streambuf->buf, body + cont, surplus - cont);
+							stream.bytes += surplus;
+							perf_count(perf_bytes, surplus);
 						}
-					} else {
-						endtok = 0;
+						
+						stream.header_len -= surplus;
+						*(stream.header + stream.header_len) = '\0';
+						LOG_INFO("headers: len: %d (body %zu)\n%s", stream.header_len, surplus, stream.header);
+						stream.state = stream.cont_wait ? STREAMING_WAIT : STREAMING_BUFFERING;
+						
+						// headers are in place, now we can scan body for Ogg and make it available 
+						if (surplus) {
+							size_t cont = min(surplus, _buf_cont_write(streambuf));
+							stream_ogg(streambuf->writep, cont);
+							stream_ogg(streambuf->buf, surplus - cont);
+							_buf_inc_writep(streambuf, surplus);
+						}
+						
+						wake_controller();
 					}
 				
 					UNLOCK;
@@ -476,14 +548,24 @@ static void *stream_thread() {
 
 				// stream body into streambuf
 				} else {
+					u8_t *seg[2];
+					unsigned len[2];
 					int n;
 
-					space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
-					if (stream.meta_interval) {
-						space = min(space, stream.meta_next);
+					// reserve free space (might wrap) and receive without holding mutex, with icy 
+					// metadata, try to get the length byte that follows body in the same read
+					_buf_reserve(streambuf, stream.meta_interval ? stream.meta_next + 1 : UINT_MAX, seg, len);
+					UNLOCK;
+					n = _recv_segments(fd, seg, len);
+					LOCK;
+					
+					// buffer has been flushed while we were receiving, this is a new stream
+					if (streambuf->cancelled) {
+						_buf_commit(streambuf, 0);
+						UNLOCK;
+						continue;
 					}
 
-					n = _recv(ssl, fd, streambuf->writep, space, 0);
 					if (n == 0) {
 						LOG_INFO("end of stream (%u bytes)", stream.bytes);
 						_disconnect(DISCONNECT, DISCONNECT_OK);
@@ -493,14 +575,27 @@ static void *stream_thread() {
 						_disconnect(DISCONNECT, REMOTE_DISCONNECT);
 					}
 					
+					// we have the icy metadata length byte, don't leave it in streambuf
+					if (n > 0 && stream.meta_interval && n > stream.meta_next) {
+						u8_t c = stream.meta_next < len[0] ? seg[0][stream.meta_next] : seg[1][stream.meta_next - len[0]];
+						n = stream.meta_next;
+						stream.meta_left = 16 * c;
+						stream.header_len = 0;
+						// no metadata this time, we can directly go for next interval
+						if (!c) stream.meta_next += stream.meta_interval;
+					}
+
 					if (n > 0) {
-                        stream_ogg(n);
-						_buf_inc_writep(streambuf, n);
+						stream_ogg(seg[0], min(n, len[0]));
+						if (n > len[0]) stream_ogg(seg[1], n - len[0]);
+						_buf_commit(streambuf, n);
 						stream.bytes += n;
+						perf_count(perf_bytes, n);
 						if (stream.meta_interval) {
 							stream.meta_next -= n;
 						}
 					} else {
+						_buf_commit(streambuf, 0);
 						UNLOCK;
 						continue;
 					}
@@ -539,6 +634,8 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 	LOG_INFO("init stream");
 	LOG_DEBUG("streambuf size: %u", stream_buf_size);
 
+	perf_bytes = perf_register("stream.received", PERF_COUNTER, "bytes");
+
 	buf_init(streambuf, stream_buf_size);
 	if (streambuf->buf == NULL) {
 		LOG_ERROR("unable to malloc buffer");
@@ -566,7 +663,7 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 	signal(SIGPIPE, SIG_IGN);	/* Force sockets to return -1 with EPIPE on pipe signal */
 #endif
 	stream.state = STOPPED;
-	stream.header = malloc(MAX_HEADER);
+	stream.header = arena_alloc(MAX_HEADER, &stream.header);
 	*stream.header = '\0';
 
 	fd = -1;
@@ -597,7 +694,7 @@ void stream_close(void) {
 #if LINUX || OSX || FREEBSD || EMBEDDED
 	pthread_join(thread, NULL);
 #endif
-	free(stream.header);
+	arena_release(stream.header);
 	buf_destroy(streambuf);
 }
 
@@ -624,6 +721,7 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 		stream.state = DISCONNECT;
 	}
 	wake_controller();
+	_buf_wake(streambuf);
 	
 	stream.cont_wait = false;
 	stream.meta_interval = 0;
@@ -742,12 +840,19 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *h
     ogg.flac = false;
     ogg.serial = ULLONG_MAX;
 
+	// stream thread might be waiting for a socket
+	_buf_wake(streambuf);
 	UNLOCK;
 }
 
 bool stream_disconnect(void) {
 	bool disc = false;
 	LOCK;
+	// stream thread might be receiving without mutex, stop it from reserving again and
+	// wait for its commit before freeing what it uses (only the stream thread clears this)
+	stream.state = STOPPED;
+	streambuf->cancelled = true;
+	while (streambuf->reserved) _buf_wait(streambuf, 10);
 #if USE_SSL
 	if (ssl) {
 		SSL_shutdown(ssl);
@@ -760,7 +865,6 @@ bool stream_disconnect(void) {
 		fd = -1;
 		disc = true;
 	}
-	stream.state = STOPPED;
     if (ogg.state == OGG_PAGE && ogg.data) free(ogg.data);
     ogg.data = NULL;
 	UNLOCK;
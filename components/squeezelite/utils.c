@@ -81,9 +81,15 @@ const char *logtime(void) {
 void logprint(const char *fmt, ...) {
 	va_list args;
 	va_start(args, fmt);
+#if LOG_DEFERRED
+	// go through the ring to stay in order with what is still there
+	log_ring_vprint(NULL, 0, fmt, args);
+	log_ring_wake();
+#else
 	vfprintf(stderr, fmt, args);
-	va_end(args);
 	fflush(stderr);
+#endif
+	va_end(args);
 }
 
 // cmdline parsing
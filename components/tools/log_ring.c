@@ -0,0 +1,398 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Deferred-format binary log ring
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "perf_counters.h"
+#include "log_ring.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_task.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+
+#define CORES			portNUM_PROCESSORS
+#define CORE_ID()		xPortGetCoreID()
+#define NOW_US()		esp_timer_get_time()
+#define FLUSH_PERIOD	100
+#define FLUSH_STACK		4096
+#else
+#define EXT_RAM_ATTR
+#define CORES			1
+#define CORE_ID()		0
+
+static int64_t NOW_US(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+/*
+ * Each core has its own ring so producers on different cores do not share a head.
+ * A producer reserves entry n with an atomic increment (a task can migrate to the
+ * other core meanwhile, this is still safe), sets its sequence to 2n+1, fills it and
+ * publishes it with 2n+2. The consumer only takes an entry whose sequence is still
+ * 2n+2 after copying it, so a lapping producer is detected as a drop. Strings use the
+ * same idea: a producer reserves characters with an atomic increment and the consumer
+ * checks, once it has copied them, that the character head has not gone around since.
+ * Heads stay in internal RAM as atomic read-modify-write does not work in PSRAM
+ */
+#define MASK		(LOG_RING_ENTRIES - 1)
+#define CHARS_MASK	(LOG_RING_CHARS - 1)
+#define TRUNCATED	0x8000
+
+typedef struct {
+	uint32_t seq;
+	uint16_t line;
+	uint8_t size;
+	const char *func, *fmt;
+	int64_t time;
+	uint8_t args[LOG_RING_ARGS];
+} entry_t;
+
+enum { ARG_NONE, ARG_INT, ARG_LONG, ARG_LLONG, ARG_PTR, ARG_DOUBLE, ARG_LDOUBLE, ARG_STR };
+
+static uint32_t heads[CORES], tails[CORES], char_heads[CORES];
+static EXT_RAM_ATTR entry_t entries[CORES][LOG_RING_ENTRIES];
+static EXT_RAM_ATTR char chars[CORES][LOG_RING_CHARS];
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static perf_metric_t *dropped;
+
+/****************************************************************************************
+ * Parse a conversion after '%', return what follows and the type of argument(s)
+ */
+static const char *parse(const char *fmt, int *type, int *stars) {
+	bool ldouble = false;
+	int longs = 0;
+
+	*type = ARG_NONE;
+	*stars = 0;
+
+	for (; *fmt && strchr("-+ #0123456789.*", *fmt); fmt++) if (*fmt == '*') (*stars)++;
+
+	for (; *fmt && strchr("hlLqjzt", *fmt); fmt++) {
+		if (*fmt == 'l') longs++;
+		else if (*fmt == 'z' || *fmt == 't') longs = 1;
+		else if (*fmt != 'h') longs = 2;
+		if (*fmt == 'L') ldouble = true;
+	}
+
+	switch (*fmt) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		*type = longs == 0 ? ARG_INT : longs == 1 ? ARG_LONG : ARG_LLONG;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		*type = ldouble ? ARG_LDOUBLE : ARG_DOUBLE;
+		break;
+	case 's':
+		*type = ARG_STR;
+		break;
+	case 'p': case 'n':
+		*type = ARG_PTR;
+		break;
+	case '\0':
+		return fmt;
+	}
+
+	return fmt + 1;
+}
+
+/****************************************************************************************
+ * Store arguments as printf will read them, return used size
+ */
+#define PUT(t, v) do { t _v = (t) (v); if (p + sizeof(t) > end) goto full; memcpy(p, &_v, sizeof(t)); p += sizeof(t); } while (0)
+
+static int pack(uint8_t *buf, int core, const char *fmt, va_list args) {
+	uint8_t *p = buf, *end = buf + LOG_RING_ARGS;
+	int type, stars;
+
+	while ((fmt = strchr(fmt, '%')) != NULL) {
+		fmt = parse(fmt + 1, &type, &stars);
+		while (stars--) PUT(int, va_arg(args, int));
+
+		switch (type) {
+		case ARG_INT: PUT(int, va_arg(args, int)); break;
+		case ARG_LONG: PUT(long, va_arg(args, long)); break;
+		case ARG_LLONG: PUT(long long, va_arg(args, long long)); break;
+		case ARG_PTR: PUT(void*, va_arg(args, void*)); break;
+		case ARG_DOUBLE: PUT(double, va_arg(args, double)); break;
+		case ARG_LDOUBLE: PUT(long double, va_arg(args, long double)); break;
+		case ARG_STR: {
+			const char *s = va_arg(args, const char*);
+			uint16_t len;
+			uint32_t pos;
+			if (!s) s = "(null)";
+			if (p + sizeof(pos) + sizeof(len) > end) goto full;
+			len = strnlen(s, LOG_RING_STRING + 1);
+			if (len > LOG_RING_STRING) len = LOG_RING_STRING | TRUNCATED;
+			pos = __atomic_fetch_add(char_heads + core, len & ~TRUNCATED, __ATOMIC_RELAXED);
+			// copy in two parts when wrapping around
+			size_t first = LOG_RING_CHARS - (pos & CHARS_MASK);
+			if (first > (len & ~TRUNCATED)) first = len & ~TRUNCATED;
+			memcpy(chars[core] + (pos & CHARS_MASK), s, first);
+			memcpy(chars[core], s + first, (len & ~TRUNCATED) - first);
+			PUT(uint32_t, pos);
+			PUT(uint16_t, len);
+			break;
+		}
+		}
+	}
+
+full:
+	return p - buf;
+}
+
+/****************************************************************************************
+ * Format an entry, arguments that did not fit or strings overwritten are printed as '?'
+ */
+#define GET(t, v) do { if (p + sizeof(t) > end) goto missing; memcpy(&v, p, sizeof(t)); p += sizeof(t); } while (0)
+#define EMIT(v) (stars == 2 ? snprintf(o, oend - o, spec, w[0], w[1], v) : \
+				 stars == 1 ? snprintf(o, oend - o, spec, w[0], v) : snprintf(o, oend - o, spec, v))
+
+static void unpack(char *out, size_t size, int core, const char *fmt, const uint8_t *args, int len) {
+	const uint8_t *p = args, *end = args + len;
+	char *o = out, *oend = out + size, spec[16];
+	int type, stars, w[2];
+
+	while (*fmt && o < oend - 1) {
+		const char *start = fmt;
+		int n = 0;
+
+		if (*fmt != '%') {
+			*o++ = *fmt++;
+			continue;
+		}
+
+		fmt = parse(fmt + 1, &type, &stars);
+		if (type == ARG_NONE) {
+			if (fmt[-1] == '%') *o++ = '%';
+			continue;
+		}
+
+		snprintf(spec, sizeof(spec), "%.*s", (int) (fmt - start), start);
+		for (int i = 0; i < stars; i++) GET(int, w[i]);
+
+		switch (type) {
+		case ARG_INT: { int v; GET(int, v); n = EMIT(v); break; }
+		case ARG_LONG: { long v; GET(long, v); n = EMIT(v); break; }
+		case ARG_LLONG: { long long v; GET(long long, v); n = EMIT(v); break; }
+		case ARG_DOUBLE: { double v; GET(double, v); n = EMIT(v); break; }
+		case ARG_LDOUBLE: { long double v; GET(long double, v); n = EMIT(v); break; }
+		case ARG_PTR: {
+			void *v;
+			GET(void*, v);
+			if (fmt[-1] == 'p') n = EMIT(v);
+			break;
+		}
+		case ARG_STR: {
+			char v[LOG_RING_STRING + 4];
+			uint32_t pos;
+			uint16_t chunk, count;
+			GET(uint32_t, pos);
+			GET(uint16_t, count);
+			chunk = LOG_RING_CHARS - (pos & CHARS_MASK);
+			if (chunk > (count & ~TRUNCATED)) chunk = count & ~TRUNCATED;
+			memcpy(v, chars[core] + (pos & CHARS_MASK), chunk);
+			memcpy(v + chunk, chars[core], (count & ~TRUNCATED) - chunk);
+			// producers went around the characters ring while we were copying
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(char_heads + core, __ATOMIC_RELAXED) - pos > LOG_RING_CHARS) goto missing;
+			strcpy(v + (count & ~TRUNCATED), count & TRUNCATED ? "..." : "");
+			n = EMIT(v);
+			break;
+		}
+		}
+
+		if (n > 0) o += n < oend - o ? n : oend - o - 1;
+		continue;
+missing:
+		*o++ = '?';
+	}
+
+	*o = '\0';
+}
+
+/****************************************************************************************
+ * Record a log entry
+ */
+void log_ring_vprint(const char *func, int line, const char *fmt, va_list args) {
+	int core = CORE_ID();
+	uint32_t n = __atomic_fetch_add(heads + core, 1, __ATOMIC_RELAXED);
+	entry_t *entry = entries[core] + (n & MASK);
+
+	__atomic_store_n(&entry->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	entry->time = NOW_US();
+	entry->func = func;
+	entry->line = line;
+	entry->fmt = fmt;
+
+	entry->size = pack(entry->args, core, fmt, args);
+
+	__atomic_store_n(&entry->seq, 2 * n + 2, __ATOMIC_RELEASE);
+}
+
+void log_ring_print(const char *func, int line, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	log_ring_vprint(func, line, fmt, args);
+	va_end(args);
+}
+
+/****************************************************************************************
+ * Copy next published entry of a core, if any (with flush_mutex)
+ */
+static bool peek(int core, entry_t *copy, uint32_t *lost) {
+	uint32_t head = __atomic_load_n(heads + core, __ATOMIC_ACQUIRE);
+
+	while (tails[core] != head) {
+		uint32_t tail = tails[core], seq;
+		entry_t *entry = entries[core] + (tail & MASK);
+
+		// producers went around the ring
+		if (head - tail > LOG_RING_ENTRIES) {
+			*lost += head - tail - LOG_RING_ENTRIES;
+			tails[core] = head - LOG_RING_ENTRIES;
+			continue;
+		}
+
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+
+		// not published yet, come back later
+		if ((int32_t) (seq - (2 * tail + 2)) < 0) return false;
+
+		if (seq == 2 * tail + 2) {
+			memcpy(copy, entry, sizeof(entry_t));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == seq) {
+				tails[core]++;
+				return true;
+			}
+		}
+
+		// overwritten while we were looking
+		(*lost)++;
+		tails[core]++;
+	}
+
+	return false;
+}
+
+/****************************************************************************************
+ * Format and output pending entries in time order, return how many (with flush_mutex)
+ */
+static int _flush(FILE *out) {
+	static entry_t pending[CORES];
+	static bool valid[CORES];
+	static char buf[512];
+	uint32_t lost = 0;
+	int count = 0;
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	int64_t offset = (int64_t) now.tv_sec * 1000000 + now.tv_usec - NOW_US();
+
+	while (1) {
+		int next = -1;
+
+		for (int core = 0; core < CORES; core++) {
+			if (!valid[core]) valid[core] = peek(core, pending + core, &lost);
+			if (valid[core] && (next < 0 || pending[core].time < pending[next].time)) next = core;
+		}
+
+		if (next < 0) break;
+
+		// same as logtime(), unless the format has its own prefix
+		entry_t *entry = pending + next;
+		size_t n = 0;
+		if (entry->func) {
+			int64_t wall = entry->time + offset;
+			time_t secs = wall / 1000000;
+			n = strftime(buf, sizeof(buf), "[%T.", localtime(&secs));
+			n += snprintf(buf + n, sizeof(buf) - n, "%03d] %s:%d ", (int) (wall % 1000000) / 1000, entry->func, (int) entry->line);
+		}	
+		if (n < sizeof(buf)) unpack(buf + n, sizeof(buf) - n, next, entry->fmt, entry->args, entry->size);
+
+		fputs(buf, out);
+		valid[next] = false;
+		count++;
+	}
+
+	if (lost) {
+		if (!dropped) dropped = perf_register("log.dropped", PERF_COUNTER, "entries");
+		perf_count(dropped, lost);
+		fprintf(out, "log ring: %u entries dropped\n", lost);
+	}
+
+	if (count || lost) fflush(out);
+
+	return count;
+}
+
+int log_ring_flush(FILE *out) {
+	pthread_mutex_lock(&flush_mutex);
+	int count = _flush(out);
+	pthread_mutex_unlock(&flush_mutex);
+	return count;
+}
+
+#ifdef ESP_PLATFORM
+static TaskHandle_t flush_handle;
+
+/****************************************************************************************
+ * Low priority task that formats logs, periodically or when woken up
+ */
+static void flush_task(void *arg) {
+	while (1) {
+		log_ring_flush(stderr);
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_PERIOD));
+	}
+}
+
+/****************************************************************************************
+ * Flush now if nobody else is, but never wait for the flush task as caller might have
+ * a higher priority (inversion). When busy, the flush task takes new entries anyway
+ */
+void log_ring_wake(void) {
+	if (pthread_mutex_trylock(&flush_mutex) == 0) {
+		_flush(stderr);
+		pthread_mutex_unlock(&flush_mutex);
+	} else if (flush_handle) {
+		xTaskNotifyGive(flush_handle);
+	}	
+}
+
+void log_ring_start(void) {
+	static bool started;
+	if (started) return;
+	started = true;
+
+	// same as telnet, stack can be in PSRAM
+	StaticTask_t *xTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	StackType_t *xStack = heap_caps_malloc(FLUSH_STACK, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	flush_handle = xTaskCreateStatic(flush_task, "log_ring", FLUSH_STACK, NULL, ESP_TASK_PRIO_MIN, xStack, xTaskBuffer);
+}
+#else
+/****************************************************************************************
+ * No flush task on host, so just flush
+ */
+void log_ring_wake(void) {
+	log_ring_flush(stderr);
+}
+#endif
@@ -0,0 +1,46 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Deferred-format binary log ring
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Instead of formatting, log_ring_print stores the format pointer, a timestamp and
+ * the raw arguments in a per-core ring, without lock or system call. Formatting is
+ * done later by log_ring_flush, usually from the low priority task created by
+ * log_ring_start. Format and function name must be static strings, %s arguments are
+ * copied in a separate per-core character ring (longer than LOG_RING_STRING, they end
+ * with "..." and if overwritten before being flushed, they are printed as '?'). When
+ * the ring is full, the oldest entries are overwritten and counted in "log.dropped".
+ * Entries are output in the order they were recorded, so messages that must be seen
+ * immediately are also recorded (with a NULL func when format has its own prefix) 
+ * and then log_ring_wake flushes them, or lets the flush task do it if it is busy
+ */
+#define LOG_RING_ENTRIES	128		// per core, must be a power of 2
+#define LOG_RING_ARGS		64		// bytes of arguments per entry
+#define LOG_RING_CHARS		4096	// bytes of %s arguments per core, must be a power of 2
+#define LOG_RING_STRING		192		// longest %s argument
+
+void	log_ring_print(const char *func, int line, const char *fmt, ...);
+void	log_ring_vprint(const char *func, int line, const char *fmt, va_list args);
+int		log_ring_flush(FILE *out);
+void	log_ring_wake(void);
+void	log_ring_start(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,271 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Registry of named performance counters, gauges and latency histograms
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "perf_counters.h"
+
+/*
+ * Updates only use relaxed atomics: a snapshot taken while a task updates a metric
+ * might be off by one sample, which is fine for statistics. The 64 bits sum is not
+ * natively atomic on 32 bits targets, the toolchain then masks interrupts briefly
+ */
+#define LOAD(x) 	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x,v) 	__atomic_store_n(&(x), v, __ATOMIC_RELAXED)
+#define ADD(x,v) 	__atomic_fetch_add(&(x), v, __ATOMIC_RELAXED)
+#define XCHG(x,v) 	__atomic_exchange_n(&(x), v, __ATOMIC_RELAXED)
+
+static perf_metric_t metrics[PERF_MAX_METRICS];
+static uint32_t histograms[PERF_MAX_HISTOGRAMS][PERF_HIST_BUCKETS];
+static int n_metrics, n_histograms;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/****************************************************************************************
+ * Value to bucket (see header)
+ */
+static inline int value_to_bucket(uint32_t value) {
+	if (value < (2 << PERF_HIST_SUB_BITS)) return value;
+	int exp = 31 - __builtin_clz(value);
+	int bucket = ((exp - PERF_HIST_SUB_BITS + 1) << PERF_HIST_SUB_BITS) +
+				 ((value >> (exp - PERF_HIST_SUB_BITS)) & ((1 << PERF_HIST_SUB_BITS) - 1));
+	return bucket < PERF_HIST_BUCKETS ? bucket : PERF_HIST_BUCKETS - 1;
+}
+
+/****************************************************************************************
+ * Lowest value of a bucket
+ */
+uint32_t perf_bucket_value(int bucket) {
+	if (bucket < (2 << PERF_HIST_SUB_BITS)) return bucket;
+	int exp = (bucket >> PERF_HIST_SUB_BITS) + PERF_HIST_SUB_BITS - 1;
+	uint32_t sub = bucket & ((1 << PERF_HIST_SUB_BITS) - 1);
+	return ((1 << PERF_HIST_SUB_BITS) + sub) << (exp - PERF_HIST_SUB_BITS);
+}
+
+/****************************************************************************************
+ * Register a metric, or get it if it exists
+ */
+perf_metric_t* perf_register(const char *name, perf_type_e type, const char *unit) {
+	perf_metric_t *metric;
+
+	pthread_mutex_lock(&registry_mutex);
+
+	if ((metric = perf_find(name)) == NULL && n_metrics < PERF_MAX_METRICS) {
+		if (type != PERF_HISTOGRAM || n_histograms < PERF_MAX_HISTOGRAMS) {
+			metric = metrics + n_metrics;
+			metric->name = name;
+			metric->unit = unit;
+			metric->type = type;
+			if (type == PERF_HISTOGRAM) metric->buckets = histograms[n_histograms++];
+			perf_reset(metric);
+			// readers iterate without lock, publish metric once it is complete
+			__atomic_store_n(&n_metrics, n_metrics + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	pthread_mutex_unlock(&registry_mutex);
+
+	return metric;
+}
+
+/****************************************************************************************
+ * Counters accumulate events (bytes, packets...)
+ */
+void perf_count(perf_metric_t *metric, uint32_t n) {
+	if (!metric) return;
+	ADD(metric->count, 1);
+	ADD(metric->sum, n);
+	STORE(metric->last, n);
+}
+
+/****************************************************************************************
+ * Gauges and histograms track a value (buffer level, duration...)
+ */
+void perf_set(perf_metric_t *metric, uint32_t value) {
+	uint32_t cur;
+
+	if (!metric) return;
+
+	STORE(metric->last, value);
+	ADD(metric->count, 1);
+	ADD(metric->sum, value);
+
+	for (cur = LOAD(metric->min); value < cur &&
+		 !__atomic_compare_exchange_n(&metric->min, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED); );
+	for (cur = LOAD(metric->max); value > cur &&
+		 !__atomic_compare_exchange_n(&metric->max, &cur, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED); );
+
+	if (metric->buckets) ADD(metric->buckets[value_to_bucket(value)], 1);
+}
+
+/****************************************************************************************
+ * Same as above with a reference (e.g. buffer size) to express value in %
+ */
+void perf_set_sized(perf_metric_t *metric, uint32_t value, uint32_t size) {
+	if (!metric) return;
+	STORE(metric->size, size);
+	perf_set(metric, value);
+}
+
+/****************************************************************************************
+ * Get a copy of a metric where count, sum and average only cover what happened since 
+ * previous (which is updated), without resetting it. Min, max and percentiles are 
+ * still since last reset as they cannot be subtracted
+ */
+void perf_snapshot_delta(perf_metric_t *metric, perf_snapshot_t *snapshot, perf_snapshot_t *previous) {
+	perf_snapshot_t current;
+
+	perf_snapshot(metric, &current, false);
+	*snapshot = current;
+
+	// when metric has been reset meanwhile, everything is new
+	if (current.count >= previous->count) {
+		snapshot->count -= previous->count;
+		snapshot->sum -= previous->sum;
+		snapshot->avg = snapshot->count ? snapshot->sum / snapshot->count : 0;
+	}
+
+	*previous = current;
+}
+
+/****************************************************************************************
+ * Get a copy of a metric, optionally resetting it in the same pass
+ */
+void perf_snapshot(perf_metric_t *metric, perf_snapshot_t *snapshot, bool reset) {
+	memset(snapshot, 0, sizeof(perf_snapshot_t));
+	if (!metric) return;
+
+	snapshot->name = metric->name;
+	snapshot->unit = metric->unit;
+	snapshot->type = metric->type;
+	snapshot->size = LOAD(metric->size);
+
+	if (reset) {
+		snapshot->last = XCHG(metric->last, 0);
+		snapshot->count = XCHG(metric->count, 0);
+		snapshot->sum = XCHG(metric->sum, 0);
+		snapshot->min = XCHG(metric->min, UINT32_MAX);
+		snapshot->max = XCHG(metric->max, 0);
+	} else {
+		snapshot->last = LOAD(metric->last);
+		snapshot->count = LOAD(metric->count);
+		snapshot->sum = LOAD(metric->sum);
+		snapshot->min = LOAD(metric->min);
+		snapshot->max = LOAD(metric->max);
+	}
+
+	if (snapshot->min == UINT32_MAX) snapshot->min = 0;
+	if (snapshot->count) snapshot->avg = snapshot->sum / snapshot->count;
+
+	if (!metric->buckets) return;
+
+	// percentiles are middle of bucket where they fall, clamped to min/max
+	uint32_t buckets[PERF_HIST_BUCKETS], total = 0, acc = 0;
+	uint32_t *p[] = { &snapshot->p50, &snapshot->p90, &snapshot->p99 };
+	int q[] = { 50, 90, 99 }, n = 0;
+
+	for (int i = 0; i < PERF_HIST_BUCKETS; i++) {
+		buckets[i] = reset ? XCHG(metric->buckets[i], 0) : LOAD(metric->buckets[i]);
+		total += buckets[i];
+	}
+
+	for (int i = 0; i < PERF_HIST_BUCKETS && n < 3 && total; i++) {
+		acc += buckets[i];
+		for (; n < 3 && (uint64_t) acc * 100 >= (uint64_t) total * q[n]; n++) {
+			uint32_t value = perf_bucket_value(i);
+			if (i < PERF_HIST_BUCKETS - 1) value += (perf_bucket_value(i + 1) - value - 1) / 2;
+			if (value < snapshot->min) value = snapshot->min;
+			if (value > snapshot->max) value = snapshot->max;
+			*p[n] = value;
+		}
+	}
+}
+
+/****************************************************************************************
+ * Reset a metric
+ */
+void perf_reset(perf_metric_t *metric) {
+	if (!metric) return;
+	STORE(metric->last, 0);
+	STORE(metric->count, 0);
+	STORE(metric->sum, 0);
+	STORE(metric->min, UINT32_MAX);
+	STORE(metric->max, 0);
+	if (metric->buckets) for (int i = 0; i < PERF_HIST_BUCKETS; i++) STORE(metric->buckets[i], 0);
+}
+
+/****************************************************************************************
+ * Registry access
+ */
+int perf_get_count(void) {
+	return __atomic_load_n(&n_metrics, __ATOMIC_ACQUIRE);
+}
+
+perf_metric_t* perf_get(int index) {
+	return index >= 0 && index < perf_get_count() ? metrics + index : NULL;
+}
+
+perf_metric_t* perf_find(const char *name) {
+	for (int i = 0; i < perf_get_count(); i++) {
+		if (!strcmp(metrics[i].name, name)) return metrics + i;
+	}
+	return NULL;
+}
+
+void perf_reset_all(void) {
+	for (int i = 0; i < perf_get_count(); i++) perf_reset(metrics + i);
+}
+
+const char* perf_type_name(perf_type_e type) {
+	switch (type) {
+	case PERF_COUNTER: return "counter";
+	case PERF_GAUGE: return "gauge";
+	case PERF_HISTOGRAM: return "histogram";
+	}
+	return "";
+}
+
+#ifndef PERF_NO_JSON
+/****************************************************************************************
+ * Export all metrics as a JSON object keyed by name
+ */
+cJSON* perf_to_json(bool reset) {
+	cJSON *root = cJSON_CreateObject();
+
+	for (int i = 0; i < perf_get_count(); i++) {
+		perf_snapshot_t s;
+		cJSON *item = cJSON_CreateObject();
+
+		perf_snapshot(metrics + i, &s, reset);
+		cJSON_AddStringToObject(item, "type", perf_type_name(s.type));
+		if (s.unit) cJSON_AddStringToObject(item, "unit", s.unit);
+		cJSON_AddNumberToObject(item, "count", s.count);
+
+		if (s.type == PERF_COUNTER) {
+			cJSON_AddNumberToObject(item, "total", s.sum);
+		} else {
+			cJSON_AddNumberToObject(item, "last", s.last);
+			cJSON_AddNumberToObject(item, "min", s.min);
+			cJSON_AddNumberToObject(item, "max", s.max);
+			cJSON_AddNumberToObject(item, "avg", s.avg);
+			if (s.size) cJSON_AddNumberToObject(item, "size", s.size);
+		}
+
+		if (s.type == PERF_HISTOGRAM) {
+			cJSON_AddNumberToObject(item, "p50", s.p50);
+			cJSON_AddNumberToObject(item, "p90", s.p90);
+			cJSON_AddNumberToObject(item, "p99", s.p99);
+		}
+
+		cJSON_AddItemToObject(root, s.name, item);
+	}
+
+	return root;
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Registry of named performance counters, gauges and latency histograms
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PERF_MAX_METRICS	32
+#define PERF_MAX_HISTOGRAMS	8
+
+/*
+ * Histograms use log-linear buckets: values 0..7 have their own bucket, then each
+ * power of 2 is split in 4 linear buckets (8,10,12,14,16,20,24,28,32...) so the
+ * relative error is below 25%. Values above 16M go to the last bucket
+ */
+#define PERF_HIST_SUB_BITS	2
+#define PERF_HIST_BUCKETS	96
+
+typedef enum { PERF_COUNTER, PERF_GAUGE, PERF_HISTOGRAM } perf_type_e;
+
+typedef struct perf_metric_s {
+	const char *name, *unit;
+	perf_type_e type;
+	uint32_t last, min, max, count, size;
+	uint64_t sum;
+	uint32_t *buckets;
+} perf_metric_t;
+
+typedef struct {
+	const char *name, *unit;
+	perf_type_e type;
+	uint32_t last, min, max, avg, count, size;
+	uint64_t sum;
+	uint32_t p50, p90, p99;
+} perf_snapshot_t;
+
+/*
+ * Metrics are registered once (registering an existing name returns it) and never
+ * freed. Updates are atomic and lock-free so they can be done from any task, a NULL
+ * metric (registry full) is silently ignored. Name and unit must be static strings
+ */
+perf_metric_t*	perf_register(const char *name, perf_type_e type, const char *unit);
+void 			perf_count(perf_metric_t *metric, uint32_t n);
+void 			perf_set(perf_metric_t *metric, uint32_t value);
+void 			perf_set_sized(perf_metric_t *metric, uint32_t value, uint32_t size);
+void 			perf_snapshot(perf_metric_t *metric, perf_snapshot_t *snapshot, bool reset);
+void 			perf_snapshot_delta(perf_metric_t *metric, perf_snapshot_t *snapshot, perf_snapshot_t *previous);
+void 			perf_reset(perf_metric_t *metric);
+
+int				perf_get_count(void);
+perf_metric_t*	perf_get(int index);
+perf_metric_t*	perf_find(const char *name);
+void 			perf_reset_all(void);
+uint32_t		perf_bucket_value(int bucket);
+const char*		perf_type_name(perf_type_e type);
+
+#ifndef PERF_NO_JSON
+#include "cJSON.h"
+cJSON* 			perf_to_json(bool reset);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
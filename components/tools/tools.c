@@ -237,6 +237,7 @@ void vTaskDeleteEXTRAM(TaskHandle_t xTask) {
 typedef struct {
 	void *user_context;
 	http_download_cb_t callback;
+	http_stream_cb_t stream_callback;
 	size_t max, bytes;
 	bool abort;
 	uint8_t *data;
@@ -244,6 +245,7 @@ typedef struct {
 } http_context_t;
 
 static void http_downloader(void *arg);
+static void http_streamer(void *arg);
 static esp_err_t http_event_handler(esp_http_client_event_t *evt);
 
 void http_download(char *url, size_t max, http_download_cb_t callback, void *context) {
@@ -273,6 +275,71 @@ static void http_downloader(void *arg) {
 	vTaskDeleteEXTRAM(NULL);
 }
 
+void http_download_stream(char *url, size_t max, http_stream_cb_t callback, void *context) {
+	http_context_t *http_context = (http_context_t*) heap_caps_calloc(sizeof(http_context_t), 1, MALLOC_CAP_SPIRAM);
+
+	esp_http_client_config_t config = {
+		.url = url,
+	};
+
+	http_context->stream_callback = callback;
+	http_context->user_context = context;
+	http_context->max = max;
+	http_context->client = esp_http_client_init(&config);
+
+	xTaskCreateEXTRAM(http_streamer, "downloader", 8*1024, http_context, ESP_TASK_PRIO_MIN + 1, NULL);
+}
+
+static size_t http_read(void *handle, uint8_t *data, size_t len) {
+	http_context_t *http_context = (http_context_t*) handle;
+	char skip[64];
+	size_t bytes = 0;
+
+	// length is unknown when chunked, so max is enforced here
+	if (len > http_context->max - http_context->bytes) len = http_context->max - http_context->bytes;
+
+	while (bytes < len) {
+		int n = data ? esp_http_client_read(http_context->client, (char*) data + bytes, len - bytes) :
+					   esp_http_client_read(http_context->client, skip, len - bytes < sizeof(skip) ? len - bytes : sizeof(skip));
+		if (n <= 0) break;
+		bytes += n;
+	}
+
+	http_context->bytes += bytes;
+	return bytes;
+}
+
+static void http_streamer(void *arg) {
+	http_context_t *http_context = (http_context_t*) arg;
+	int64_t len = -1;
+	int status = 0;
+
+	// we don't use perform() so redirections must be handled here
+	for (int redirect = 0; redirect < 3; redirect++) {
+		if (esp_http_client_open(http_context->client, 0) != ESP_OK) break;
+		len = esp_http_client_fetch_headers(http_context->client);
+		status = esp_http_client_get_status_code(http_context->client);
+		if (status < 300 || status >= 400 || esp_http_client_set_redirection(http_context->client) != ESP_OK) break;
+		esp_http_client_close(http_context->client);
+	}
+
+	// chunked responses have no content-length
+	if (len < 0 && status == 200 && esp_http_client_is_chunked_response(http_context->client)) len = 0;
+
+	if (status != 200 || len < 0 || len > http_context->max) {
+		ESP_LOGW(TAG, "HTTP stream error (status %d) or too large %lld / %zu", status, len, http_context->max);
+		http_context->stream_callback(NULL, NULL, 0, http_context->user_context);
+	} else {
+		http_context->stream_callback(http_read, http_context, len, http_context->user_context);
+	}
+
+	esp_http_client_close(http_context->client);
+	esp_http_client_cleanup(http_context->client);
+
+	free(http_context);
+	vTaskDeleteEXTRAM(NULL);
+}
+
 static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
 	http_context_t *http_context = (http_context_t*) evt->user_data;
 
@@ -56,6 +56,14 @@ const char* str_or_null(const char * str);
 typedef void (*http_download_cb_t)(uint8_t* data, size_t len, void *context);
 void		http_download(char *url, size_t max, http_download_cb_t callback, void *context);
 
+/* Streaming download: callback is called from download task once headers are received, 
+ * with read set to NULL on error. Callback pulls data using read (or skips it when data 
+ * is NULL) which returns less than requested at end of stream. Length is 0 if unknown
+ */
+typedef size_t (*http_read_t)(void *handle, uint8_t *data, size_t len);
+typedef void (*http_stream_cb_t)(http_read_t read, void *handle, size_t len, void *context);
+void		http_download_stream(char *url, size_t max, http_stream_cb_t callback, void *context);
+
 /* Use these to dynamically create tasks whose stack is on EXTRAM. Be aware that it 
  * requires configNUM_THREAD_LOCAL_STORAGE_POINTERS to bet set to 2 at least (index 0
  * is used by pthread and this uses index 1, obviously
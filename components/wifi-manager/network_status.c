@@ -14,6 +14,7 @@
 #include "network_wifi.h"
 #include "platform_config.h"
 #include "platform_esp32.h"
+#include "perf_counters.h"
 #include "tools.h"
 #include "trace.h"
 #ifndef CONFIG_SQUEEZELITE_ESP32_RELEASE_URL
@@ -98,7 +99,11 @@ void network_status_clear_ip() {
     }
 }
 char* network_status_alloc_get_ip_info_json() {
-    return cJSON_PrintUnformatted(ip_info_cjson);
+    // performance counters are not cached, take a fresh snapshot each time
+    cJSON_AddItemToObject(ip_info_cjson, "perf", perf_to_json(false));
+    char* json = cJSON_PrintUnformatted(ip_info_cjson);
+    cJSON_DeleteItemFromObjectCaseSensitive(ip_info_cjson, "perf");
+    return json;
 }
 
 void network_status_unlock_json_buffer() {
@@ -47,6 +47,7 @@
 #include "accessors.h"
 #include "cmd_system.h"
 #include "tools.h"
+#include "log_ring.h"
 
 const char unknown_string_placeholder[] = "unknown";
 const char null_string_placeholder[] = "null";
@@ -86,6 +87,8 @@ const DefaultNumVal defaultNumVals[] = {
 const DefaultStringVal defaultStringVals[] = {
     {"equalizer", ""},
     {"loudness", "0"},
+    {"eq_bands", ""},
+    {"spectrum_config", ""},
     {"actrls_config", ""},
     {"lms_ctrls_raw", "n"},
     {"rotary_config", CONFIG_ROTARY_ENCODER},
@@ -383,6 +386,9 @@ void app_main()
 	MEMTRACE_PRINT_DELTA();
 	ESP_LOGI(TAG,"Setting up telnet.");
 	init_telnet(); // align on 32 bits boundaries
+#if CONFIG_LOGGING_DEFERRED
+	log_ring_start();
+#endif
 	MEMTRACE_PRINT_DELTA();
 	ESP_LOGI(TAG,"Setting up config subsystem.");
 	config_init();
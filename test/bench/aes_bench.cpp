@@ -0,0 +1,127 @@
+/*
+ *  Squeezelite for esp32 - host benchmark
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Compares cspot audio decryption strategies on a Linux host, over a buffer of
+random data decrypted in windows as CDNAudioFile does:
+- "per-window": what was done before, for each window the IV is rebuilt with
+  bigNumAdd(), the key is expanded again and mbedtls_aes_crypt_ctr() runs
+- "stream": bell::AESCTRStream, key expanded once, counter carried over
+Both outputs are checked to be identical, including after random seeks.
+
+Usage: aes-bench [-w <window kB>] [-s <size MB>] [-l <loops>]
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <getopt.h>
+#include <mbedtls/aes.h>
+
+#include "AESCTRStream.h"
+
+static const std::vector<uint8_t> audioAESIV = {0x72, 0xe0, 0x67, 0xfb, 0xdd, 0xcb, 0xcf, 0x77,
+                                                0xeb, 0xe8, 0xbc, 0x64, 0x3f, 0x63, 0x0d, 0x93};
+
+// same as cspot's Utils.cpp
+static std::vector<uint8_t> bigNumAdd(std::vector<uint8_t> num, int n) {
+	auto carry = n;
+	for (int x = num.size() - 1; x >= 0; x--) {
+		int res = num[x] + carry;
+		if (res < 256) {
+			carry = 0;
+			num[x] = res;
+		} else {
+			carry = res / 256;
+			num[x] = res % 256;
+			if (x == 0) {
+				num.insert(num.begin(), carry);
+				return num;
+			}
+		}
+	}
+	return num;
+}
+
+// same as Crypto::aesCTRXcrypt, context is kept but key is set on every call
+static void perWindow(mbedtls_aes_context *ctx, const std::vector<uint8_t> &key, uint8_t *data, size_t nbytes, size_t pos) {
+	auto iv = bigNumAdd(audioAESIV, pos / 16);
+	size_t off = 0;
+	unsigned char streamBlock[16] = {0};
+
+	if (mbedtls_aes_setkey_enc(ctx, key.data(), key.size() * 8) != 0) throw std::runtime_error("Failed to set AES key");
+	if (mbedtls_aes_crypt_ctr(ctx, nbytes, &off, iv.data(), streamBlock, data, data) != 0) throw std::runtime_error("Failed to decrypt");
+}
+
+template <typename F> static double measure(F f) {
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+	size_t window = 14 * 1024, size = 16 * 1024 * 1024;
+	int loops = 3, opt;
+
+	while ((opt = getopt(argc, argv, "w:s:l:")) != -1) {
+		switch (opt) {
+		case 'w': window = atoi(optarg) * 1024; break;
+		case 's': size = atoi(optarg) * 1024 * 1024; break;
+		case 'l': loops = atoi(optarg); break;
+		default:
+			printf("%s [-w <window kB>] [-s <size MB>] [-l <loops>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::mt19937 rng(1234);
+	std::vector<uint8_t> key(16), source(size), a(size), b(size);
+	for (auto &k : key) k = rng();
+	for (auto &s : source) s = rng();
+
+	// check both give the same result, with windows at odd offsets
+	mbedtls_aes_context ctx;
+	mbedtls_aes_init(&ctx);
+	bell::AESCTRStream stream(key, audioAESIV);
+
+	a = source; b = source;
+	for (int i = 0; i < 1000; i++) {
+		size_t pos = rng() % (size - window), len = 1 + rng() % window, start = pos - pos % 16;
+		perWindow(&ctx, key, a.data() + start, pos + len - start, start);
+		stream.seek(pos);
+		stream.xcrypt(b.data() + pos, len);
+		if (memcmp(a.data() + pos, b.data() + pos, len)) {
+			printf("mismatch at %zu (len %zu)\n", pos, len);
+			return 1;
+		}
+		memcpy(a.data() + start, source.data() + start, pos + len - start);
+		memcpy(b.data() + pos, source.data() + pos, len);
+	}
+
+	printf("%-12s %8s %10s %10s\n", "method", "window", "MB/s", "us/window");
+
+	for (int loop = 0; loop < loops; loop++) {
+		double t1 = measure([&] {
+			for (size_t pos = 0; pos < size; pos += window) perWindow(&ctx, key, a.data() + pos, std::min(window, size - pos), pos);
+		});
+		double t2 = measure([&] {
+			stream.seek(0);
+			for (size_t pos = 0; pos < size; pos += window) stream.xcrypt(b.data() + pos, std::min(window, size - pos));
+		});
+		double windows = (size + window - 1) / window;
+
+		printf("%-12s %8zu %10.1f %10.1f\n", "per-window", window, size / t1 / 1e6, t1 * 1e6 / windows);
+		printf("%-12s %8zu %10.1f %10.1f\n", "stream", window, size / t2 / 1e6, t2 * 1e6 / windows);
+	}
+
+	mbedtls_aes_free(&ctx);
+	return 0;
+}
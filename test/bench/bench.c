@@ -0,0 +1,465 @@
+/*
+ *  Squeezelite for esp32 - host benchmark
+ *
+ *      Philippe G. 2019, philippe_44@outlook.com
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Runs the squeezelite decode -> (process) -> output path on a Linux host,
+out of a file-backed streambuf and into a null output sink, so that CPU
+regressions in codecs and output_pack can be caught before they become
+stutters on a loaded esp32. There is no thread here: the streambuf is
+refilled from the file, codec->decode() is called and then _output_frames()
+is called to drain the outputbuf, exactly as output_i2s would do (gain,
+crossfade and copy to a DMA-sized block), until the codec reports the end.
+
+For each file, it reports the number of frames decoded, frames/s (and the
+real-time factor), per-call latency percentiles of decode and output calls
+and the peak heap used.
+
+Usage: squeezelite-bench [-c <codec>] [-f <size><rate><chan><endian>]
+                         [-g <gain>] [-m <mono>] [-k <kernel>] [-e <gains>] [-l <loops>] [-s <kB>] [-o <kB>] [-d <level>] [-V] <file>...
+	-c codec letter as used by LMS (f,m,a,o,u,l,p), guessed from file extension otherwise
+	-f codec parameters as LMS would send them in strm (default ????, pcm is 1321)
+	-g gain (float) applied in the output stage, 1.0 bypasses gain processing
+	-m 1 for left mono, 2 for right, 3 for mixed
+	-k output_pack kernels, 0 for scalar reference, 1 for portable, 2 for native (default)
+	-e equalizer gains in dB for the 10 LMS bands (e.g. 6,3,0,0,-3,0,0,0,3,6), run after output stage
+	-V check output_pack kernels against scalar reference before running
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <time.h>
+#include <malloc.h>
+#include "squeezelite.h"
+#include "biquad.h"
+
+#define FRAME_BLOCK MAX_SILENCE_FRAMES
+
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+
+#define LOCK_S   mutex_lock(streambuf->mutex)
+#define UNLOCK_S mutex_unlock(streambuf->mutex)
+#define LOCK_O   mutex_lock(outputbuf->mutex)
+#define UNLOCK_O mutex_unlock(outputbuf->mutex)
+
+extern log_level loglevel;
+extern struct outputstate output;
+extern struct buffer *outputbuf;
+extern struct decodestate decode;
+extern struct codec *codec;
+extern bool pcm_check_header;
+extern u8_t *silencebuf;
+
+static struct buffer buf;
+struct buffer *streambuf = &buf;
+struct streamstate stream;
+
+static u8_t *obuf;
+static frames_t oframes;
+static struct codec *codecs[8];
+static struct biquad_s *eq;
+static struct biquad_band eq_bands[10];
+static uint32_t eq_rate;
+
+struct latency_s {
+	u32_t *us;
+	size_t count, size;
+};
+
+/****************************************************************************************
+ * Stubs for what the full player would provide
+ */
+void wake_controller(void) { }
+
+bool test_open(const char *device, unsigned rates[], bool userdef_rates) {
+	unsigned _rates[] = { 192000, 176400, 96000, 88200, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 0 };
+	memcpy(rates, _rates, sizeof(_rates));
+	return true;
+}
+
+#define CODEC_STUB(name, what) struct codec *register_##name(void) { LOG_INFO(what " unavailable on this host"); return NULL; }
+#ifdef BENCH_NO_FLAC
+CODEC_STUB(flac, "flac")
+#endif
+#ifdef BENCH_NO_MAD
+CODEC_STUB(mad, "mad")
+#endif
+#ifdef BENCH_NO_AAC
+CODEC_STUB(helixaac, "helix-aac")
+#endif
+#ifdef BENCH_NO_VORBIS
+CODEC_STUB(vorbis, "vorbis")
+#endif
+#ifdef BENCH_NO_OPUS
+CODEC_STUB(opus, "opus")
+#endif
+#ifdef BENCH_NO_ALAC
+CODEC_STUB(alac, "alac")
+#endif
+
+/****************************************************************************************
+ * Timing & memory helpers
+ */
+static u64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static size_t heap_used(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return mallinfo2().uordblks;
+#else
+	return (size_t) mallinfo().uordblks;
+#endif
+}
+
+static void latency_add(struct latency_s *l, u32_t us) {
+	if (l->count == l->size) {
+		l->size = l->size ? l->size * 2 : 4096;
+		l->us = realloc(l->us, l->size * sizeof(u32_t));
+	}
+	l->us[l->count++] = us;
+}
+
+static int latency_cmp(const void *a, const void *b) {
+	return *(u32_t*) a < *(u32_t*) b ? -1 : *(u32_t*) a > *(u32_t*) b;
+}
+
+static u32_t latency_pct(struct latency_s *l, unsigned pct) {
+	if (!l->count) return 0;
+	return l->us[min(l->count - 1, (l->count * pct) / 100)];
+}
+
+/****************************************************************************************
+ * Null output sink, same job as _i2s_write_frames minus the visualizer
+ */
+static int _null_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
+							  s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
+	out_frames = min(out_frames, FRAME_BLOCK - oframes);
+
+	if (!silence) {
+		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
+			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
+		}
+		_apply_gain_to(outputbuf, obuf + oframes * BYTES_PER_FRAME, out_frames, gainL, gainR, flags);
+	} else {
+		memcpy(obuf + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
+	}
+
+	oframes += out_frames;
+	return out_frames;
+}
+
+/****************************************************************************************
+ * Equalizer on what has been written to sink, same as equalizer_process
+ */
+static void eq_set(char *gains) {
+	static const float freqs[] = { 31, 62, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+	char *p = strtok(gains, ",");
+
+	for (int i = 0; i < 10; i++) {
+		eq_bands[i] = (struct biquad_band) { .type = BIQUAD_PEAK, .freq = freqs[i], .q = 1.41, .gain = p ? atof(p) : 0 };
+		if (p) p = strtok(NULL, ",");
+	}
+
+	eq = biquad_create(10);
+}
+
+static void eq_process(void) {
+	if (!eq) return;
+	if (eq_rate != output.current_sample_rate) {
+		eq_rate = output.current_sample_rate;
+		biquad_set(eq, eq_bands, eq_rate);
+	}
+#if BYTES_PER_FRAME == 4
+	biquad_process_s16(eq, (int16_t*) obuf, oframes);
+#else
+	biquad_process_s32(eq, (int32_t*) obuf, oframes);
+#endif
+}
+
+/****************************************************************************************
+ * Fill streambuf from file, flag end of stream like a disconnect would
+ */
+static void stream_fill(FILE *file) {
+	LOCK_S;
+	while (stream.state > DISCONNECT) {
+		size_t space = min(_buf_space(streambuf), _buf_cont_write(streambuf));
+		size_t n;
+		if (!space) break;
+		n = fread(streambuf->writep, 1, space, file);
+		if (!n) {
+			stream.state = DISCONNECT;
+			break;
+		}
+		_buf_inc_writep(streambuf, n);
+		stream.bytes += n;
+	}
+	UNLOCK_S;
+}
+
+/****************************************************************************************
+ * Run one file
+ */
+static char guess_codec(const char *name) {
+	const char *ext = strrchr(name, '.');
+	static const struct { const char *ext; char codec; } map[] = {
+		{ ".flac", 'f' }, { ".flc", 'f' }, { ".mp3", 'm' }, { ".aac", 'a' }, { ".m4a", 'a' },
+		{ ".ogg", 'o' }, { ".opus", 'u' }, { ".alc", 'l' }, { ".wav", 'p' }, { ".aif", 'p' },
+		{ ".aiff", 'p' }, { ".pcm", 'p' }, { ".raw", 'p' }, { NULL, 0 } };
+	for (int i = 0; ext && map[i].ext; i++) if (!strcasecmp(ext, map[i].ext)) return map[i].codec;
+	return 0;
+}
+
+static bool bench_file(const char *name, char id, const char *params, s32_t gain, u8_t mono) {
+	struct latency_s dec = { 0 }, out = { 0 };
+	u64_t start, total_dec = 0, total_out = 0, frames = 0;
+	size_t heap_base, heap_peak;
+	decode_state state = DECODE_RUNNING;
+	FILE *file;
+
+	codec = NULL;
+	for (int i = 0; codecs[i]; i++) if (codecs[i]->id == id) codec = codecs[i];
+
+	if (!codec) {
+		LOG_ERROR("no codec '%c' for %s", id ? id : '?', name);
+		return false;
+	}
+
+	if ((file = fopen(name, "rb")) == NULL) {
+		LOG_ERROR("can't open %s", name);
+		return false;
+	}
+
+	// same sequence as slimproto strm 's' + decode thread
+	buf_flush(streambuf);
+	output_flush();
+
+	memset(&stream, 0, sizeof(stream));
+	stream.state = STREAMING_FILE;
+
+	LOCK_O;
+	output.state = OUTPUT_RUNNING;
+	output.gainL = output.gainR = gain;
+	output.channels = mono;
+	output.next_replay_gain = output.current_replay_gain = 0;
+	UNLOCK_O;
+
+	heap_base = heap_peak = heap_used();
+
+	mutex_lock(decode.mutex);
+	decode.new_stream = true;
+	codec->open(params[0], params[1], params[2], params[3]);
+	mutex_unlock(decode.mutex);
+
+	start = now_us();
+
+	while (state == DECODE_RUNNING || _buf_used(outputbuf)) {
+		frames_t avail;
+		u64_t t;
+
+		stream_fill(file);
+
+		LOCK_O;
+		avail = _buf_space(outputbuf);
+		UNLOCK_O;
+
+		// decoder requires enough space, exactly as in decode_thread
+		if (state == DECODE_RUNNING && avail > codec->min_space) {
+			t = now_us();
+			mutex_lock(decode.mutex);
+			state = codec->decode();
+			mutex_unlock(decode.mutex);
+			t = now_us() - t;
+			total_dec += t;
+			latency_add(&dec, t);
+			heap_peak = max(heap_peak, heap_used());
+		}
+
+		// drain output by FRAME_BLOCK, like the i2s thread
+		LOCK_O;
+		avail = _buf_used(outputbuf) / BYTES_PER_FRAME;
+		if (state != DECODE_RUNNING || avail >= FRAME_BLOCK || _buf_space(outputbuf) <= codec->min_space) {
+			oframes = 0;
+			t = now_us();
+			_output_frames(FRAME_BLOCK);
+			eq_process();
+			t = now_us() - t;
+			total_out += t;
+			latency_add(&out, t);
+			frames += oframes;
+			if (!oframes && state != DECODE_RUNNING) _buf_flush(outputbuf);
+		}
+		UNLOCK_O;
+	}
+
+	start = now_us() - start;
+
+	mutex_lock(decode.mutex);
+	codec->close();
+	mutex_unlock(decode.mutex);
+	fclose(file);
+
+	qsort(dec.us, dec.count, sizeof(u32_t), latency_cmp);
+	qsort(out.us, out.count, sizeof(u32_t), latency_cmp);
+
+	printf("%-32.32s  %c %6u %10llu %9.0f %6.1fx | %6u %6u %6u %6u | %6u %6u %6u | %7zu\n",
+		   strrchr(name, '/') ? strrchr(name, '/') + 1 : name, codec->id, output.current_sample_rate, (unsigned long long) frames,
+		   start ? frames * 1e6 / start : 0.0, start && output.current_sample_rate ? frames * 1e6 / start / output.current_sample_rate : 0.0,
+		   latency_pct(&dec, 50), latency_pct(&dec, 90), latency_pct(&dec, 99), dec.count ? dec.us[dec.count - 1] : 0,
+		   latency_pct(&out, 50), latency_pct(&out, 99), out.count ? out.us[out.count - 1] : 0,
+		   (heap_peak - heap_base) / 1024);
+
+	LOG_INFO("%s: decode %llu us (%zu calls), output %llu us (%zu calls), state %d",
+			 name, (unsigned long long) total_dec, dec.count, (unsigned long long) total_out, out.count, state);
+
+	free(dec.us);
+	free(out.us);
+
+	return state == DECODE_COMPLETE;
+}
+
+// compare gain, mono and crossfade kernels against scalar reference
+static bool check_kernels(void) {
+	const s32_t gains[] = { 0, FIXED_ONE / 3, FIXED_ONE - 1, FIXED_ONE, -FIXED_ONE / 2, -FIXED_ONE, FIXED_ONE * 2, FIXED_ONE * 8 };
+	const u8_t flags[] = { 0, MONO_LEFT, MONO_RIGHT, MONO_LEFT | MONO_RIGHT };
+	const frames_t frames = 1001;
+	ISAMPLE_T *in = malloc(frames * BYTES_PER_FRAME), *ref = malloc(frames * BYTES_PER_FRAME);
+	ISAMPLE_T *cross = malloc(frames * BYTES_PER_FRAME * 2);
+	struct buffer test = { 0 };
+	s64_t worst = 0;
+
+	srand(1);
+	for (int i = 0; i < frames * 2; i++) in[i] = (ISAMPLE_T) ((rand() << 16) ^ rand());
+	for (int i = 0; i < frames * 4; i++) cross[i] = (ISAMPLE_T) ((rand() << 16) ^ rand());
+
+	for (pack_kernel_t k = PACK_PORTABLE; k <= PACK_NATIVE; k++) {
+		for (int g = 0; g < sizeof(gains) / sizeof(*gains); g++) {
+			for (int f = 0; f < sizeof(flags) / sizeof(*flags) + 1; f++) {
+				ISAMPLE_T *out = malloc(frames * BYTES_PER_FRAME);
+				for (int pass = 0; pass < 2; pass++) {
+					ISAMPLE_T *dst = pass ? out : ref, *cross_ptr;
+					memcpy(dst, in, frames * BYTES_PER_FRAME);
+					output_pack_kernel(pass ? k : PACK_REFERENCE);
+					test.readp = (u8_t*) dst;
+					if (f < sizeof(flags) / sizeof(*flags)) {
+						s32_t gainL = gains[g], gainR = gains[(g + 1) % (sizeof(gains) / sizeof(*gains))];
+						// reference is done in place, others are copying
+						if (pass) {
+							test.readp = (u8_t*) in;
+							_apply_gain_to(&test, (u8_t*) dst, frames, gainL, gainR, flags[f]);
+						} else {
+							_apply_gain(&test, frames, gainL, gainR, flags[f]);
+						}
+					} else {
+						// crossfade source wraps in the middle of the run
+						test.buf = (u8_t*) cross;
+						test.wrap = test.buf + frames * BYTES_PER_FRAME;
+						test.size = frames * BYTES_PER_FRAME;
+						cross_ptr = cross + frames / 2 * 2;
+						_apply_cross(&test, frames, gains[g], FIXED_ONE - gains[g], &cross_ptr);
+					}
+				}
+				for (int i = 0; i < frames * 2; i++) worst = max(worst, llabs((s64_t) ref[i] - out[i]));
+				free(out);
+			}
+		}
+		printf("kernel %d: max difference with reference %lld\n", k, (long long) worst);
+	}
+
+	free(in);
+	free(ref);
+	free(cross);
+
+	// native can round the lowest bit differently
+	return worst <= 1;
+}
+
+static void usage(const char *name) {
+	printf("%s [-c <codec>] [-f <size><rate><chan><endian>] [-g <gain>] [-m <mono>] [-k <kernel>] [-e <gains>] [-l <loops>] "
+		   "[-s <streambuf kB>] [-o <outputbuf kB>] [-d <log level>] [-V] <file>...\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	char id = 0, *params = NULL;
+	unsigned loops = 1, sbuf = STREAMBUF_SIZE, obufsize = OUTPUTBUF_SIZE;
+	float fgain = 1.0;
+	u8_t mono = 0;
+	pack_kernel_t kernel = PACK_NATIVE;
+	bool check = false;
+	int opt, ret = 0;
+
+	loglevel = lWARN;
+
+	while ((opt = getopt(argc, argv, "c:f:g:m:k:e:l:s:o:d:Vh")) != -1) {
+		switch (opt) {
+		case 'c': id = *optarg; break;
+		case 'f': params = optarg; break;
+		case 'g': fgain = atof(optarg); break;
+		case 'm': mono = atoi(optarg) & (MONO_LEFT | MONO_RIGHT); break;
+		case 'k': kernel = atoi(optarg); break;
+		case 'e': eq_set(optarg); break;
+		case 'V': check = true; break;
+		case 'l': loops = atoi(optarg); break;
+		case 's': sbuf = atoi(optarg) * 1024; break;
+		case 'o': obufsize = atoi(optarg) * 1024; break;
+		case 'd': loglevel = atoi(optarg); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (check && !check_kernels()) return 3;
+	output_pack_kernel(kernel);
+
+	if (optind >= argc) {
+		if (!check) usage(argv[0]);
+		return check ? 0 : 1;
+	}
+
+	// build a bare output and stream, no thread running
+	arena_init(lWARN, sbuf + obufsize + ARENA_SCRATCH_SIZE);
+	buf_init(streambuf, sbuf);
+	buf_init(outputbuf, obufsize - obufsize % BYTES_PER_FRAME);
+	mutex_create(decode.mutex);
+	silencebuf = calloc(MAX_SILENCE_FRAMES, BYTES_PER_FRAME);
+	obuf = malloc(FRAME_BLOCK * BYTES_PER_FRAME);
+	test_open(NULL, output.supported_rates, false);
+	output.write_cb = &_null_write_frames;
+	output.current_sample_rate = output.default_sample_rate = 44100;
+	pcm_check_header = true;
+
+	// only keep what is available on this host
+	{
+		struct codec *all[] = { register_flac(), register_mad(), register_helixaac(), register_vorbis(),
+								register_opus(), register_alac(), register_pcm() };
+		for (int i = 0, n = 0; i < sizeof(all) / sizeof(*all); i++) if (all[i]) codecs[n++] = all[i];
+	}
+
+	printf("%-32s  %c %6s %10s %9s %7s | %6s %6s %6s %6s | %6s %6s %6s | %7s\n", "file", 'c', "rate", "frames", "frames/s", "speed",
+		   "dp50", "dp90", "dp99", "dmax", "op50", "op99", "omax", "heap kB");
+
+	for (unsigned loop = 0; loop < loops; loop++) {
+		for (int i = optind; i < argc; i++) {
+			char lid = id ? id : guess_codec(argv[i]);
+			const char *p = params ? params : (lid == 'p' ? "1321" : lid == 'a' && strcasestr(argv[i], ".m4a") ? "5???" : "????");
+			if (!bench_file(argv[i], lid, p, to_gain(fgain), mono)) ret = 2;
+		}
+	}
+
+	biquad_destroy(eq);
+	free(obuf);
+	free(silencebuf);
+	buf_destroy(outputbuf);
+	buf_destroy(streambuf);
+
+	return ret;
+}
@@ -0,0 +1,78 @@
+/*
+ *  Squeezelite for esp32 - host unit test
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+A producer thread writes a byte counter into a BUF_LOCKFREE buffer while the
+consumer holds what it consumes (like output_i2s does), moves readp under mutex
+and only checks the data after releasing the mutex. Any byte overwritten before
+buf_release is detected as a counter mismatch.
+*/
+
+#include <pthread.h>
+#include "squeezelite.h"
+
+#define TOTAL	(20 * 1000 * 1000UL)
+
+log_level loglevel = lWARN;
+static struct buffer buf;
+
+static void *producer(void *arg) {
+	unsigned long count = 0;
+
+	while (count < TOTAL) {
+		mutex_lock(buf.mutex);
+		unsigned n = min(_buf_space(&buf), _buf_cont_write(&buf));
+		n = min(n, min(3000, TOTAL - count));
+		for (unsigned i = 0; i < n; i++) buf.writep[i] = (u8_t) (count + i);
+		count += n;
+		if (n) _buf_inc_writep(&buf, n);
+		else _buf_wait_space(&buf, 512, 10);
+		mutex_unlock(buf.mutex);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned long count = 0, errors = 0;
+	pthread_t thread;
+
+	arena_init(lWARN, 64 * 1024);
+	buf_init(&buf, 10007);
+	pthread_create(&thread, NULL, producer, NULL);
+
+	while (count < TOTAL) {
+		u8_t *src[3];
+		unsigned len[3];
+		int blocks = 0;
+
+		// hold up to 3 blocks, as many as _output_frames would give
+		mutex_lock(buf.mutex);
+		while (blocks < 3) {
+			unsigned n = min(min(_buf_used(&buf), _buf_cont_read(&buf)), 1500);
+			if (!n) break;
+			src[blocks] = buf.readp;
+			len[blocks++] = n;
+			_buf_hold(&buf, n);
+			_buf_inc_readp(&buf, n);
+		}
+		mutex_unlock(buf.mutex);
+
+		for (int i = 0; i < blocks; i++) {
+			for (unsigned j = 0; j < len[i]; j++) if (src[i][j] != (u8_t) (count + j)) errors++;
+			count += len[i];
+		}
+
+		buf_release(&buf);
+	}
+
+	pthread_join(thread, NULL);
+	printf("consumed %lu bytes, %lu errors\n", count, errors);
+
+	return errors ? 1 : 0;
+}
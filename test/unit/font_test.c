@@ -0,0 +1,126 @@
+/*
+ *  Squeezelite for esp32 - host unit test
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Glyphs drawn by GDS_FontDrawChar (cached column masks, direct framebuffer writes)
+must be pixel-identical to the original renderer that decodes the font and calls
+DrawPixel for each bit. Both draw on a random framebuffer at 1/8/16/24bpp, with
+all colors (including XOR) and positions clipped on every side.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gds_private.h"
+#include "gds_font.h"
+
+#define WIDTH	72
+#define HEIGHT	40
+
+// same as gds.c
+static void DrawPixel1Fast( struct GDS_Device* Device, int X, int Y, int Color ) {
+	uint8_t* FBOffset = Device->Framebuffer + ( ( Y >> 3 ) * Device->Width + X );
+	if ( Color == GDS_COLOR_XOR ) *FBOffset ^= BIT( Y & 0x07 );
+	else *FBOffset = ( Color == GDS_COLOR_BLACK ) ? *FBOffset & ~BIT( Y & 0x07 ) : *FBOffset | BIT( Y & 0x07 );
+}
+
+static void DrawPixel8Fast( struct GDS_Device* Device, int X, int Y, int Color ) {
+	Device->Framebuffer[Y * Device->Width + X] = Color;
+}
+
+static void DrawPixel16Fast( struct GDS_Device* Device, int X, int Y, int Color ) {
+	uint16_t* FBOffset = (uint16_t*) Device->Framebuffer + Y * Device->Width + X;
+	*FBOffset = __builtin_bswap16(Color);
+}
+
+static void DrawPixel24Fast( struct GDS_Device* Device, int X, int Y, int Color ) {
+	uint8_t* FBOffset = Device->Framebuffer + (Y * Device->Width + X) * 3;
+	*FBOffset++ = Color >> 16; *FBOffset++ = Color >> 8; *FBOffset = Color;
+}
+
+void GDS_SetDirtyArea( struct GDS_Device* Device, int x1, int y1, int x2, int y2 ) { }
+
+// previous GDS_FontDrawChar
+static void DrawCharReference( struct GDS_Device* Device, char Character, int x, int y, int Color ) {
+	const struct GDS_FontDef* Font = Device->Font;
+	int GlyphColumnLen = ( ( Font->Height + 7 ) / 8 );
+	const uint8_t* GlyphData = Font->FontData + ( Character - Font->StartChar ) * ( Font->Width * GlyphColumnLen + 1 ) + 1;
+
+	if ( Character < Font->StartChar || Character > Font->EndChar ) return;
+
+	int CharWidth = GDS_FontGetCharWidth( Device, Character ), CharHeight = Font->Height;
+	int CharEndX = x + CharWidth, CharEndY = y + CharHeight;
+	int OffsetX = x < 0 ? -x : 0, OffsetY = y < 0 ? -y : 0;
+	int CharStartX = x + OffsetX, CharStartY = y + OffsetY;
+
+	GlyphData+= OffsetX * GlyphColumnLen;
+	if ( CharEndX < 0 || CharStartX >= Device->TextWidth || CharEndY < 0 || CharStartY >= Device->Height ) return;
+	if ( CharEndX >= Device->TextWidth ) CharEndX = Device->TextWidth - 1;
+	if ( CharEndY >= Device->Height ) CharEndY = Device->Height - 1;
+
+	for ( x = CharStartX; x < CharEndX; x++, GlyphData+= GlyphColumnLen ) {
+		for ( int i = 0; CharStartY + i < CharEndY && i < CharHeight; i++ ) {
+			if ( GlyphData[ ( i + OffsetY ) / 8 ] & BIT( ( i + OffsetY ) & 0x07 ) ) DrawPixel( Device, x, CharStartY + i, Color );
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const struct GDS_FontDef* Fonts[] = { &Font_line_1, &Font_droid_sans_fallback_15x17, &Font_droid_sans_mono_13x24, &Font_Tarable7Seg_32x64 };
+	struct { int Depth; void (*Draw)( struct GDS_Device*, int, int, int ); } Modes[] = {
+		{ 1, DrawPixel1Fast }, { 8, DrawPixel8Fast }, { 16, DrawPixel16Fast }, { 24, DrawPixel24Fast },
+	};
+	int Colors[] = { GDS_COLOR_WHITE, GDS_COLOR_BLACK, GDS_COLOR_XOR, 0x1234 };
+	const char Text[] = "A0g%|W";
+	static uint8_t Fast[WIDTH * HEIGHT * 3], Reference[WIDTH * HEIGHT * 3], Init[WIDTH * HEIGHT * 3];
+	unsigned long checks = 0, errors = 0;
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(Init); i++) Init[i] = rand();
+
+	for (int m = 0; m < sizeof(Modes) / sizeof(*Modes); m++) {
+		struct GDS_Device Device = { .Width = WIDTH, .Height = HEIGHT, .Depth = Modes[m].Depth, .DrawPixelFast = Modes[m].Draw };
+		size_t Size = Device.Depth == 1 ? WIDTH * HEIGHT / 8 : WIDTH * HEIGHT * Device.Depth / 8;
+
+		for (int f = 0; f < sizeof(Fonts) / sizeof(*Fonts); f++) {
+			Device.Font = Fonts[f];
+			for (int c = 0; c < sizeof(Colors) / sizeof(*Colors); c++) {
+				for (int t = 0; t < 2; t++) {
+					// text area narrower than the display, like when artwork is on the side
+					Device.TextWidth = t ? WIDTH - 17 : WIDTH;
+					for (int y = -Device.Font->Height; y <= HEIGHT; y+= 3) {
+						for (int x = -Device.Font->Width; x <= WIDTH; x+= 5) {
+							for (const char *p = Text; *p; p++) {
+								memcpy(Fast, Init, Size);
+								memcpy(Reference, Init, Size);
+
+								Device.DefaultDraw = true;
+								Device.Framebuffer = Fast;
+								GDS_FontDrawChar(&Device, *p, x, y, Colors[c]);
+
+								Device.DefaultDraw = false;
+								Device.Framebuffer = Reference;
+								DrawCharReference(&Device, *p, x, y, Colors[c]);
+
+								checks++;
+								if (memcmp(Fast, Reference, Size)) {
+									if (!errors++) printf("mismatch depth %d font %dx%d color %d char '%c' at %d,%d\n",
+														   Device.Depth, Device.Font->Width, Device.Font->Height, Colors[c], *p, x, y);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	printf("%lu glyphs, %lu errors\n", checks, errors);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,5 @@
+/* host build of the display core, memory placement is meaningless */
+#pragma once
+
+#define IRAM_ATTR
+#define EXT_RAM_ATTR
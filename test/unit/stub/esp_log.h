@@ -0,0 +1,8 @@
+/* host build of the display core, logs are dropped */
+#pragma once
+
+#define ESP_LOGE(tag, ...)
+#define ESP_LOGW(tag, ...)
+#define ESP_LOGI(tag, ...)
+#define ESP_LOGD(tag, ...)
+#define ESP_LOGV(tag, ...)